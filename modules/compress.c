@@ -0,0 +1,198 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ *
+ * compress.c
+ *
+ * this file is part of LIBRESTACK
+ *
+ * Copyright (c) 2012-2020 Brett Sheffield <bacs@librecast.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program (see the file COPYING in the distribution).
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "compress.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <zlib.h>
+#ifdef USE_BROTLI
+#include <brotli/encode.h>
+#endif
+
+#define COMPRESS_ZLIB_LEVEL 6
+#define COMPRESS_BROTLI_QUALITY 5	/* higher is much slower, for little gain */
+
+struct compress_s {
+	http_encoding_t	enc;
+	unsigned char	*out;
+	z_stream	zs;
+#ifdef USE_BROTLI
+	BrotliEncoderState *br;
+#endif
+};
+
+int compress_supported(http_encoding_t enc)
+{
+	switch (enc) {
+	case HTTP_ENCODING_GZIP:
+	case HTTP_ENCODING_DEFLATE:
+		return 1;
+#ifdef USE_BROTLI
+	case HTTP_ENCODING_BR:
+		return 1;
+#endif
+	default:
+		return 0;
+	}
+}
+
+compress_t *compress_new(http_encoding_t enc)
+{
+	compress_t *z;
+	int bits;
+
+	if (!compress_supported(enc)) return NULL;
+	if (!(z = calloc(1, sizeof(compress_t)))) return NULL;
+	if (!(z->out = malloc(COMPRESS_BUFSIZ))) goto err_free;
+	z->enc = enc;
+#ifdef USE_BROTLI
+	if (enc == HTTP_ENCODING_BR) {
+		if (!(z->br = BrotliEncoderCreateInstance(NULL, NULL, NULL))) goto err_free;
+		BrotliEncoderSetParameter(z->br, BROTLI_PARAM_QUALITY, COMPRESS_BROTLI_QUALITY);
+		return z;
+	}
+#endif
+	/* deflate content coding is the zlib format (RFC 7230 4.2.2) */
+	bits = (enc == HTTP_ENCODING_GZIP) ? 15 + 16 : 15;
+	if (deflateInit2(&z->zs, COMPRESS_ZLIB_LEVEL, Z_DEFLATED, bits, 8,
+				Z_DEFAULT_STRATEGY) != Z_OK)
+		goto err_free;
+	return z;
+err_free:
+	free(z->out);
+	free(z);
+	return NULL;
+}
+
+#ifdef USE_BROTLI
+static int compress_brotli(compress_t *z, const void *data, size_t len, int last,
+		compress_sink_t sink, void *arg)
+{
+	BrotliEncoderOperation op = (last) ? BROTLI_OPERATION_FINISH : BROTLI_OPERATION_PROCESS;
+	const uint8_t *in = data;
+	uint8_t *out;
+	size_t avail;
+
+	do {
+		out = z->out;
+		avail = COMPRESS_BUFSIZ;
+		if (!BrotliEncoderCompressStream(z->br, op, &len, &in, &avail, &out, NULL))
+			return -1;
+		if (avail < COMPRESS_BUFSIZ && sink(arg, z->out, COMPRESS_BUFSIZ - avail))
+			return -1;
+	}
+	while (len || BrotliEncoderHasMoreOutput(z->br) || (last && !BrotliEncoderIsFinished(z->br)));
+
+	return 0;
+}
+#endif
+
+int compress_write(compress_t *z, const void *data, size_t len, int last,
+		compress_sink_t sink, void *arg)
+{
+	const unsigned char *in = data;
+	size_t n;
+	int flush, ret;
+
+#ifdef USE_BROTLI
+	if (z->br) return compress_brotli(z, data, len, last, sink, arg);
+#endif
+	do {
+		/* zlib counts in uInt, so feed it no more than a buffer at once */
+		n = (len > COMPRESS_BUFSIZ) ? COMPRESS_BUFSIZ : len;
+		flush = (last && n == len) ? Z_FINISH : Z_NO_FLUSH;
+		z->zs.next_in = (unsigned char *)in;
+		z->zs.avail_in = n;
+		do {
+			z->zs.next_out = z->out;
+			z->zs.avail_out = COMPRESS_BUFSIZ;
+			if ((ret = deflate(&z->zs, flush)) == Z_STREAM_ERROR) return -1;
+			if (z->zs.avail_out < COMPRESS_BUFSIZ
+			&& sink(arg, z->out, COMPRESS_BUFSIZ - z->zs.avail_out))
+				return -1;
+		}
+		while (!z->zs.avail_out || (flush == Z_FINISH && ret != Z_STREAM_END));
+		in += n;
+		len -= n;
+	}
+	while (len);
+
+	return 0;
+}
+
+void compress_free(compress_t *z)
+{
+	if (!z) return;
+#ifdef USE_BROTLI
+	if (z->br) BrotliEncoderDestroyInstance(z->br);
+	else
+#endif
+	deflateEnd(&z->zs);
+	free(z->out);
+	free(z);
+}
+
+static int compress_fd_sink(void *arg, const void *data, size_t len)
+{
+	int fd = *(int *)arg;
+	const char *p = data;
+	ssize_t byt;
+
+	while (len) {
+		if ((byt = write(fd, p, len)) == -1) {
+			if (errno == EINTR) continue;
+			return -1;
+		}
+		p += byt;
+		len -= byt;
+	}
+	return 0;
+}
+
+int compress_file(http_encoding_t enc, int in, int out)
+{
+	compress_t *z;
+	char *buf;
+	off_t off = 0;
+	ssize_t byt;
+	int err = -1;
+
+	if (!(z = compress_new(enc))) return -1;
+	if (!(buf = malloc(COMPRESS_BUFSIZ))) goto compress_file_free;
+	do {
+		if ((byt = pread(in, buf, COMPRESS_BUFSIZ, off)) == -1) {
+			if (errno == EINTR) continue;
+			goto compress_file_free;
+		}
+		off += byt;
+		if (compress_write(z, buf, byt, !byt, compress_fd_sink, &out))
+			goto compress_file_free;
+	}
+	while (byt);
+	err = 0;
+compress_file_free:
+	free(buf);
+	compress_free(z);
+	return err;
+}
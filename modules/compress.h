@@ -0,0 +1,58 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ *
+ * compress.h
+ *
+ * this file is part of LIBRESTACK
+ *
+ * Copyright (c) 2012-2020 Brett Sheffield <bacs@librecast.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program (see the file COPYING in the distribution).
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __LSD_COMPRESS_H
+#define __LSD_COMPRESS_H 1
+
+#include "http.h"
+#include <stddef.h>
+
+/* streaming content coding of response bodies. gzip and deflate always,
+ * and br when built with USE_BROTLI. Input and output pass through buffers
+ * of COMPRESS_BUFSIZ, so memory use doesn't grow with what is compressed */
+
+#define COMPRESS_BUFSIZ 65536	/* most bytes read or handed to a sink at once */
+
+typedef struct compress_s compress_t;
+
+/* take len bytes of output. Return nonzero to stop compressing */
+typedef int (*compress_sink_t)(void *arg, const void *data, size_t len);
+
+/* we can compress to this content coding */
+int compress_supported(http_encoding_t enc);
+
+/* start compressing. Returns NULL if enc isn't supported or out of memory */
+compress_t *compress_new(http_encoding_t enc);
+
+/* compress len bytes of data, passing output to sink as it is produced.
+ * Setting last ends the stream. Returns 0, or -1 on error */
+int compress_write(compress_t *z, const void *data, size_t len, int last,
+		compress_sink_t sink, void *arg);
+
+/* free compressor */
+void compress_free(compress_t *z);
+
+/* compress whole file in, from the start, writing it to out. Returns 0, or
+ * -1 on error */
+int compress_file(http_encoding_t enc, int in, int out);
+
+#endif /* __LSD_COMPRESS_H */
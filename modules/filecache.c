@@ -0,0 +1,256 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ *
+ * filecache.c
+ *
+ * this file is part of LIBRESTACK
+ *
+ * Copyright (c) 2012-2020 Brett Sheffield <bacs@librecast.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program (see the file COPYING in the distribution).
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "filecache.h"
+#include "../src/hash.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+struct filecache_s {
+	pthread_mutex_t		mtx;		/* handler threads share the cache */
+	filecache_render_t	render;
+	filecache_entry_t **	bucket;
+	size_t			buckets;	/* power of two */
+	size_t			count;
+	size_t			max;
+	time_t			ttl;
+	filecache_entry_t *	newest;
+	filecache_entry_t *	oldest;
+};
+
+static void filecache_now(struct timespec *ts)
+{
+	clock_gettime(CLOCK_MONOTONIC_COARSE, ts);
+}
+
+static void filecache_entry_free(filecache_entry_t *e)
+{
+	if (e->fd != -1) close(e->fd);
+	free(e->head);
+	free(e->path);
+	free(e);
+}
+
+static filecache_entry_t *filecache_entry_open(filecache_t *fc, const char *path)
+{
+	filecache_entry_t *e;
+
+	if (!(e = calloc(1, sizeof(filecache_entry_t)))) return NULL;
+	if (!(e->path = strdup(path))) {
+		free(e);
+		return NULL;
+	}
+	e->refs = 1;
+	filecache_now(&e->checked);
+	if ((e->fd = open(path, O_RDONLY | O_CLOEXEC)) == -1) {
+		e->err = errno;
+		return e;
+	}
+	if (fstat(e->fd, &e->sb) || !S_ISREG(e->sb.st_mode)) {
+		e->err = (S_ISDIR(e->sb.st_mode)) ? EISDIR : EINVAL;
+		close(e->fd);
+		e->fd = -1;
+		return e;
+	}
+	if (fc->render && fc->render(e)) {
+		filecache_entry_free(e);
+		return NULL;
+	}
+	return e;
+}
+
+/* entry still describes the file at its path */
+static int filecache_entry_valid(filecache_entry_t *e)
+{
+	struct stat sb;
+
+	if (stat(e->path, &sb)) return (e->fd == -1 && errno == e->err);
+	if (e->fd == -1) return 0;
+	return (sb.st_dev == e->sb.st_dev && sb.st_ino == e->sb.st_ino
+		&& sb.st_size == e->sb.st_size
+		&& sb.st_mtim.tv_sec == e->sb.st_mtim.tv_sec
+		&& sb.st_mtim.tv_nsec == e->sb.st_mtim.tv_nsec);
+}
+
+/* misses worth remembering. Running out of fds or memory is not */
+static int filecache_cacheable(filecache_entry_t *e)
+{
+	switch (e->err) {
+	case 0:
+	case ENOENT:
+	case ENOTDIR:
+	case EACCES:
+	case EISDIR:
+	case EINVAL:
+	case ELOOP:
+	case ENAMETOOLONG:
+		return 1;
+	}
+	return 0;
+}
+
+static filecache_entry_t *filecache_find(filecache_t *fc, const char *path, size_t h)
+{
+	filecache_entry_t *e;
+	for (e = fc->bucket[h]; e && strcmp(e->path, path); e = e->next);
+	return e;
+}
+
+static void filecache_lru_unlink(filecache_t *fc, filecache_entry_t *e)
+{
+	if (e->newer) e->newer->older = e->older;
+	else fc->newest = e->older;
+	if (e->older) e->older->newer = e->newer;
+	else fc->oldest = e->newer;
+	e->newer = e->older = NULL;
+}
+
+static void filecache_lru_push(filecache_t *fc, filecache_entry_t *e)
+{
+	e->older = fc->newest;
+	e->newer = NULL;
+	if (fc->newest) fc->newest->newer = e;
+	else fc->oldest = e;
+	fc->newest = e;
+}
+
+/* drop entry from table, freeing it unless in use. Call with lock held */
+static void filecache_drop(filecache_t *fc, filecache_entry_t *e)
+{
+	filecache_entry_t **p;
+	size_t h = hash_fnv1a(e->path, strlen(e->path)) & (fc->buckets - 1);
+
+	for (p = &fc->bucket[h]; *p != e; p = &(*p)->next);
+	*p = e->next;
+	filecache_lru_unlink(fc, e);
+	e->cached = 0;
+	fc->count--;
+	if (!e->refs) filecache_entry_free(e);
+}
+
+filecache_entry_t *filecache_get(filecache_t *fc, const char *path)
+{
+	filecache_entry_t *e, *old;
+	struct timespec now;
+	size_t h = hash_fnv1a(path, strlen(path)) & (fc->buckets - 1);
+
+	filecache_now(&now);
+	pthread_mutex_lock(&fc->mtx);
+	if ((e = filecache_find(fc, path, h))) {
+		e->refs++;
+		filecache_lru_unlink(fc, e);
+		filecache_lru_push(fc, e);
+		if (now.tv_sec - e->checked.tv_sec < fc->ttl) {
+			pthread_mutex_unlock(&fc->mtx);
+			return e;
+		}
+	}
+	pthread_mutex_unlock(&fc->mtx);
+
+	/* stale. Check outside the lock, as stat() may block */
+	if (e) {
+		if (filecache_entry_valid(e)) {
+			pthread_mutex_lock(&fc->mtx);
+			e->checked = now;
+			pthread_mutex_unlock(&fc->mtx);
+			return e;
+		}
+		filecache_put(fc, e);
+	}
+
+	if (!(e = filecache_entry_open(fc, path))) return NULL;
+	if (!fc->max || !filecache_cacheable(e)) return e;
+	pthread_mutex_lock(&fc->mtx);
+	/* another thread may have opened it meanwhile. Newest wins */
+	if ((old = filecache_find(fc, path, h))) filecache_drop(fc, old);
+	if (fc->count == fc->max) filecache_drop(fc, fc->oldest);
+	e->next = fc->bucket[h];
+	fc->bucket[h] = e;
+	filecache_lru_push(fc, e);
+	e->cached = 1;
+	fc->count++;
+	pthread_mutex_unlock(&fc->mtx);
+
+	return e;
+}
+
+void filecache_put(filecache_t *fc, filecache_entry_t *e)
+{
+	int unused;
+
+	pthread_mutex_lock(&fc->mtx);
+	unused = (!--e->refs && !e->cached);
+	pthread_mutex_unlock(&fc->mtx);
+	if (unused) filecache_entry_free(e);
+}
+
+void filecache_forget(filecache_t *fc, const char *path)
+{
+	filecache_entry_t *e;
+	size_t h = hash_fnv1a(path, strlen(path)) & (fc->buckets - 1);
+
+	pthread_mutex_lock(&fc->mtx);
+	if ((e = filecache_find(fc, path, h))) filecache_drop(fc, e);
+	pthread_mutex_unlock(&fc->mtx);
+}
+
+size_t filecache_count(filecache_t *fc)
+{
+	size_t n;
+	pthread_mutex_lock(&fc->mtx);
+	n = fc->count;
+	pthread_mutex_unlock(&fc->mtx);
+	return n;
+}
+
+filecache_t *filecache_new(size_t max, time_t ttl, filecache_render_t render)
+{
+	filecache_t *fc;
+
+	if (!(fc = calloc(1, sizeof(filecache_t)))) return NULL;
+	for (fc->buckets = 16; fc->buckets < max && fc->buckets < SIZE_MAX / 2; fc->buckets <<= 1);
+	if (!(fc->bucket = calloc(fc->buckets, sizeof(filecache_entry_t *)))) {
+		free(fc);
+		return NULL;
+	}
+	pthread_mutex_init(&fc->mtx, NULL);
+	fc->max = max;
+	fc->ttl = ttl;
+	fc->render = render;
+
+	return fc;
+}
+
+void filecache_free(filecache_t *fc)
+{
+	if (!fc) return;
+	while (fc->oldest) filecache_drop(fc, fc->oldest);
+	pthread_mutex_destroy(&fc->mtx);
+	free(fc->bucket);
+	free(fc);
+}
@@ -0,0 +1,85 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ *
+ * filecache.h
+ *
+ * this file is part of LIBRESTACK
+ *
+ * Copyright (c) 2012-2020 Brett Sheffield <bacs@librecast.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program (see the file COPYING in the distribution).
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __LSD_FILECACHE_H
+#define __LSD_FILECACHE_H 1
+
+#include <stddef.h>
+#include <sys/stat.h>
+#include <time.h>
+
+/* per-process cache of open files for static serving.
+ *
+ * Each entry holds an open fd, the file's stat and a header block rendered
+ * once when the file is opened, so a hit costs no syscalls at all. Files that
+ * could not be opened are cached too, as negative entries. An entry older
+ * than the ttl is checked with stat() on its next use, and reopened if the
+ * file changed. The least recently used entry is dropped when the cache is
+ * full. Entries are reference counted, so one dropped while a thread is still
+ * sending it stays open until that thread is done */
+
+#define FILECACHE_TTL 2	/* seconds before an entry is checked against its file */
+
+typedef struct filecache_s filecache_t;
+typedef struct filecache_entry_s filecache_entry_t;
+struct filecache_entry_s {
+	char		*path;
+	int		fd;		/* -1 for a negative entry */
+	int		err;		/* errno from open() or a non-regular file */
+	struct stat	sb;
+	char		*head;		/* header block, from render callback */
+	size_t		headlen;
+	int		flags;		/* for the render callback's use */
+	/* private */
+	struct timespec	checked;	/* when last known to match the file */
+	size_t		refs;
+	char		cached;		/* still in the table */
+	filecache_entry_t *next;	/* hash chain */
+	filecache_entry_t *newer;	/* lru list */
+	filecache_entry_t *older;
+};
+
+/* fill in e->head for a newly opened file. Return nonzero on error */
+typedef int (*filecache_render_t)(filecache_entry_t *e);
+
+/* create cache of up to max entries. With max 0, nothing is cached and
+ * each filecache_get() opens the file afresh */
+filecache_t *filecache_new(size_t max, time_t ttl, filecache_render_t render);
+
+/* fetch entry for path, opening the file if it isn't cached or has changed.
+ * Returns NULL only if out of memory. Every entry returned must be given back
+ * with filecache_put() */
+filecache_entry_t *filecache_get(filecache_t *fc, const char *path);
+
+/* give entry back */
+void filecache_put(filecache_t *fc, filecache_entry_t *e);
+
+/* drop any entry for path, so the next filecache_get() opens it afresh */
+void filecache_forget(filecache_t *fc, const char *path);
+
+/* number of cached entries */
+size_t filecache_count(filecache_t *fc);
+
+/* free cache and its entries, none of which may still be in use */
+void filecache_free(filecache_t *fc);
+
+#endif /* __LSD_FILECACHE_H */
@@ -24,18 +24,35 @@
 #define _GNU_SOURCE
 
 #include "http.h"
+#include "compress.h"
+#include "filecache.h"
+#include "ktls.h"
+#include "route.h"
+#include "shmcache.h"
+#include "sni.h"
+#include "tlscache.h"
 #include "websocket.h"
 #include "../src/err.h"
+#include "../src/hash.h"
 #include "../src/iov.h"
 #include "../src/log.h"
+#include "../src/lsd.h"
+#include "../src/module.h"
 #include "../src/str.h"
-#include <assert.h>
 #include <ctype.h>
 #include <fcntl.h>
+#include <inttypes.h>
 #include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <string.h>
+#include <strings.h>
+#include <sys/file.h>
 #include <sys/mman.h>
+#include <sys/random.h>
+#include <sys/resource.h>
 #include <sys/sendfile.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
@@ -43,13 +60,105 @@
 #include <netinet/tcp.h>
 #include <sys/uio.h>
 #include <unistd.h>
+#include <wolfssl/wolfcrypt/chacha20_poly1305.h>
 #include <wolfssl/wolfcrypt/coding.h>
 #include <wolfssl/wolfcrypt/sha.h>
 
 #define IOVSIZE 5 /* number of iov structures to allocate at once */
 #define BUFLEN BUFSIZ
-
-static char buf[BUFLEN];
+#define HTTP_FLUSH_IOV 16 /* most iovecs http_flush() gathers into one writev() */
+#define HTTP_SPLICE_MAX 1048576 /* most body bytes to splice() at once */
+#define HTTP_DISCARD_MAX 1048576 /* close rather than read a bigger unwanted body */
+#define HTTP_TLS_RECORD 16384 /* most plaintext one TLS record carries */
+#define HTTP_SNI_PRELOAD 64 /* up to this many hosts, load every cert before forking */
+#define HTTP_TLS_RX(c) ((c)->ssl && !((c)->ktls & KTLS_RX)) /* wolfSSL decrypts reads */
+#define HTTP_TLS_TX(c) ((c)->ssl && !((c)->ktls & KTLS_TX)) /* wolfSSL encrypts writes */
+#if defined(HAVE_SESSION_TICKET) && defined(HAVE_EXT_CACHE) \
+	&& defined(HAVE_CHACHA) && defined(HAVE_POLY1305)
+#define HTTP_TLS_SHARED 1 /* wolfSSL lets us keep sessions and seal tickets */
+#endif
+#if defined(HAVE_SNI) && defined(OPENSSL_EXTRA)
+#define HTTP_TLS_SNI 1 /* wolfSSL can switch context by server name */
+#endif
+
+/* bytes read or queued to write, consumed from off */
+typedef struct http_buf_s http_buf_t;
+struct http_buf_s {
+	char	*data;
+	size_t	size;
+	size_t	off;
+	size_t	len;
+};
+
+/* per connection state. Requests are parsed from in, and responses to
+ * pipelined requests queue in out until we would block for more input */
+typedef struct http_conn_s http_conn_t;
+struct http_conn_s {
+	http_buf_t	in;
+	http_buf_t	out;
+	http_buf_t	body;		/* request body read past in */
+	http_buf_t	z;		/* compressed response body */
+};
+
+static pthread_mutex_t env_mtx = PTHREAD_MUTEX_INITIALIZER;
+
+/* open files for static serving, one cache per handler process */
+static filecache_t *files;
+
+/* small static files shared by every handler, created before they fork */
+static shmcache_t *shm;
+
+/* content codings we send, smallest first. Precompressed copies of a static
+ * file are looked for beside it, with ext appended to its name */
+#define HTTP_VARY_ENCODING "Vary: Accept-Encoding\r\n"
+static const struct {
+	http_encoding_t	encoding;
+	char		*coding;	/* Accept-Encoding token */
+	char		*ext;
+	char		*header;
+	char		sidecar;	/* look for precompressed copies */
+} http_codings[] = {
+	{ HTTP_ENCODING_BR,	"br",	".br",	"Content-Encoding: br\r\n",		1 },
+	{ HTTP_ENCODING_GZIP,	"gzip",	".gz",	"Content-Encoding: gzip\r\n",		1 },
+	{ HTTP_ENCODING_DEFLATE, "deflate", ".zz", "Content-Encoding: deflate\r\n",	0 },
+};
+#define HTTP_CODINGS (sizeof http_codings / sizeof http_codings[0])
+
+/* types worth compressing on the fly. Anything else is already compressed,
+ * or we don't know what it is */
+static const char *http_compressible[] = {
+	"text/", "application/javascript", "application/json", "application/xml",
+	"application/xhtml+xml", "application/rss+xml", "application/atom+xml",
+	"application/wasm", "image/svg+xml", "image/x-icon", "font/ttf", "font/otf",
+};
+#define HTTP_FILE_COMPRESSIBLE 0x1 /* filecache_entry_t flag */
+
+/* on the fly compression. Files are compressed once into compressdir, but
+ * response() bodies on every request, so those have a threshold of their own */
+static char *compressdir;
+static int compressmin = -1;
+static int compressbody;
+
+/* compiled uri routes for http and https, and those being loaded */
+static route_table_t *routes[2];
+static route_table_t *pending[2];
+
+/* TLS context every https connection is made from, built from cert and key
+ * in the controller, so handlers inherit it ready to use */
+static WOLFSSL_CTX *tls;
+static int ktls;
+
+/* sessions and ticket keys shared by handlers, so resumption works whichever
+ * handler a client comes back to */
+static tlscache_t *tlsc;
+
+/* per host contexts, picked by the name a client asks for. With few hosts
+ * they are all built in the controller. With many, each handler builds one
+ * when its host is first asked for */
+static sni_t *snis;
+#ifdef HTTP_TLS_SNI
+static pthread_mutex_t sni_mtx = PTHREAD_MUTEX_INITIALIZER;
+#endif
 
 int setcork(int sock, int state)
 {
@@ -69,6 +178,209 @@ static size_t http_status(char *status, http_status_code_t code)
 	return sprintf(status, "HTTP/1.1 %i - %s\r\n", code, http_phrase(code));
 }
 
+#define HTTP_HEADER_NAME(id, name, field) name,
+#define HTTP_HEADER_LEN(id, name, field) sizeof(name) - 1,
+#define HTTP_HEADER_FIELD(id, name, field) offsetof(http_request_t, field),
+static const char *http_header_name[] = { HTTP_HEADERS(HTTP_HEADER_NAME) };
+static const size_t http_header_len[] = { HTTP_HEADERS(HTTP_HEADER_LEN) };
+static const size_t http_header_field[] = { HTTP_HEADERS(HTTP_HEADER_FIELD) };
+
+/* slot => header id + 1, or 0 if empty. Filled by http_header_init() */
+static unsigned char http_header_slot[HTTP_HEADER_SLOTS];
+
+/* length, first, middle and last bytes are enough to tell our headers apart.
+ * OR-ing 0x20 folds case for letters and leaves '-' alone */
+static inline size_t http_header_hash(const char *s, size_t len)
+{
+	return (len * 6 + (s[0] | 0x20) + (s[len / 2] | 0x20)
+		+ (s[len - 1] | 0x20) * 3) & (HTTP_HEADER_SLOTS - 1);
+}
+
+int http_header_init(void)
+{
+	size_t h;
+	memset(http_header_slot, 0, sizeof http_header_slot);
+	for (int i = 0; i < HTTP_HEADER_UNKNOWN; i++) {
+		h = http_header_hash(http_header_name[i], http_header_len[i]);
+		if (http_header_slot[h]) {
+			ERROR("header hash collision: %s, %s",
+				http_header_name[http_header_slot[h] - 1],
+				http_header_name[i]);
+			return -1;
+		}
+		http_header_slot[h] = i + 1;
+	}
+	return 0;
+}
+
+http_header_t http_header_id(struct iovec *name)
+{
+	size_t len = name->iov_len;
+	int id;
+
+	if (!len) return HTTP_HEADER_UNKNOWN;
+	if (!(id = http_header_slot[http_header_hash(name->iov_base, len)]))
+		return HTTP_HEADER_UNKNOWN;
+	id--;
+	if (len != http_header_len[id]
+	|| strncasecmp(name->iov_base, http_header_name[id], len))
+		return HTTP_HEADER_UNKNOWN;
+	return id;
+}
+
+/* digits of a byte position, saturating rather than overflowing. Returns -1
+ * if there are none */
+static off_t http_range_pos(const char **p, const char *end)
+{
+	off_t n = -1;
+
+	for (; *p < end && isdigit(**p); (*p)++) {
+		if (n == -1) n = 0;
+		n = (n > (INT64_MAX - 9) / 10) ? INT64_MAX : n * 10 + (**p - '0');
+	}
+	return n;
+}
+
+int http_range_parse(struct iovec *hdr, off_t size, http_range_t *r)
+{
+	const char *p = hdr->iov_base;
+	const char *end = p + hdr->iov_len;
+	off_t first, last;
+	int n = 0, specs = 0;
+
+	if (hdr->iov_len < 6 || strncasecmp(p, "bytes=", 6)) return -1;
+	for (p += 6; p < end;) {
+		while (p < end && (*p == ' ' || *p == '\t')) p++;
+		if (p == end) break;
+		if (*p == ',') { /* empty list element */
+			p++;
+			continue;
+		}
+		if (*p == '-') {
+			/* suffix: last bytes of the file */
+			p++;
+			if ((last = http_range_pos(&p, end)) == -1) return -1;
+			first = (last < size) ? size - last : 0;
+			last = size - 1;
+			if (first > last) first = size; /* zero length suffix */
+		}
+		else {
+			if ((first = http_range_pos(&p, end)) == -1) return -1;
+			if (p == end || *p++ != '-') return -1;
+			last = http_range_pos(&p, end);
+			if (last != -1 && last < first) return -1;
+			if (last == -1 || last >= size) last = size - 1;
+		}
+		while (p < end && (*p == ' ' || *p == '\t')) p++;
+		if (p < end && *p++ != ',') return -1;
+		if (++specs > HTTP_RANGES_MAX) return -1;
+		if (first >= size) continue; /* unsatisfiable, but others may not be */
+		r[n].off = first;
+		r[n].len = last - first + 1;
+		n++;
+	}
+	return (specs) ? n : -1;
+}
+
+int http_etag_match(struct iovec *list, struct iovec *etag, int strong)
+{
+	const char *p = list->iov_base;
+	const char *end = p + list->iov_len;
+	const char *e = etag->iov_base;
+	const char *tag;
+	size_t len = etag->iov_len;
+	int weak;
+
+	if (len > 2 && !memcmp(e, "W/", 2)) {
+		if (strong) return 0;
+		e += 2;
+		len -= 2;
+	}
+	while (p < end) {
+		while (p < end && (*p == ',' || *p == ' ' || *p == '\t')) p++;
+		if (p == end) break;
+		if (*p == '*') return 1;
+		if ((weak = (end - p > 2 && p[0] == 'W' && p[1] == '/'))) p += 2;
+		if (p == end || *p != '"') return 0;
+		for (tag = p++; p < end && *p != '"'; p++);
+		if (p++ == end) return 0;
+		if ((size_t)(p - tag) == len && !memcmp(tag, e, len) && !(strong && weak))
+			return 1;
+	}
+	return 0;
+}
+
+time_t http_date_parse(struct iovec *date)
+{
+	/* IMF-fixdate, then the obsolete RFC 850 and asctime() formats */
+	static const char *fmt[] = {
+		"%a, %d %b %Y %H:%M:%S GMT",
+		"%A, %d-%b-%y %H:%M:%S GMT",
+		"%a %b %e %H:%M:%S %Y",
+	};
+	struct tm tm;
+	char buf[64];
+	char *p;
+
+	if (date->iov_len >= sizeof buf) return -1;
+	memcpy(buf, date->iov_base, date->iov_len);
+	buf[date->iov_len] = '\0';
+	for (size_t i = 0; i < sizeof fmt / sizeof fmt[0]; i++) {
+		memset(&tm, 0, sizeof tm);
+		if ((p = strptime(buf, fmt[i], &tm)) && !*p) return timegm(&tm);
+	}
+	return -1;
+}
+
+/* qvalue from Accept-Encoding, "0" to "1.000", in thousandths */
+static int http_qvalue(const char **p, const char *end)
+{
+	int q = 0, scale = 1000;
+
+	if (*p < end && isdigit(**p)) q = (*(*p)++ - '0') * 1000;
+	if (*p < end && **p == '.') {
+		for ((*p)++; *p < end && isdigit(**p); (*p)++) {
+			if ((scale /= 10)) q += (**p - '0') * scale;
+		}
+	}
+	return (q > 1000) ? 1000 : q;
+}
+
+int http_accept_encoding(struct iovec *ae, const char *coding)
+{
+	const char *p = ae->iov_base;
+	const char *end = p + ae->iov_len;
+	const char *tok;
+	size_t len = strlen(coding);
+	size_t toklen;
+	int star = 0, q;
+
+	while (p < end) {
+		while (p < end && (*p == ',' || *p == ' ' || *p == '\t')) p++;
+		for (tok = p; p < end && *p != ',' && *p != ';' && *p != ' ' && *p != '\t'; p++);
+		toklen = p - tok;
+		q = 1000;
+		while (p < end && *p != ',') {
+			if (*p == ';') {
+				for (p++; p < end && (*p == ' ' || *p == '\t'); p++);
+				if (end - p >= 2 && (p[0] | 0x20) == 'q' && p[1] == '=') {
+					p += 2;
+					q = http_qvalue(&p, end);
+					continue;
+				}
+			}
+			p++;
+		}
+		if (!toklen) continue;
+		/* x-gzip is an old name for gzip (RFC 7230 4.2.3) */
+		if ((toklen == len && !strncasecmp(tok, coding, len))
+		|| (toklen == 6 && !strcmp(coding, "gzip") && !strncasecmp(tok, "x-gzip", 6)))
+			return q;
+		if (toklen == 1 && *tok == '*') star = q;
+	}
+	return star;
+}
+
 /*
  * first pass processing request headers
  * 1. ignore everything we can
@@ -76,238 +388,595 @@ static size_t http_status(char *status, http_status_code_t code)
  * 3. defer processing of everything else
  * return 0 for success, or http_status_code_t for error
  */
-static int http_header_process(http_request_t *req, http_response_t *res,
-			struct iovec *k, struct iovec *v)
+/* Content-Length is digits only, no sign or whitespace (RFC 7230 3.3.2) */
+static int http_content_length(struct iovec *v, size_t *len)
 {
-	(void) res; /* FIXME - unused */
-	if (!iovstrcmp(k, "Host")) {
-		iovcpy(&req->host, v);
-	}
-	else if (!iovstrcmp(k, "Accept")) {
-		iovcpy(&req->accept, v);
-	}
-	else if (!iovstrcmp(k, "Accept-Encoding")) {
-		iovcpy(&req->encoding, v);
-	}
-	else if (!iovstrcmp(k, "Accept-Language")) {
-		iovcpy(&req->lang, v);
-	}
-	else if (!iovstrcmp(k, "Cache-Control")) {
-		iovcpy(&req->cache, v);
+	const char *p = v->iov_base;
+	size_t n = 0;
+
+	if (!v->iov_len) return -1;
+	for (size_t i = 0; i < v->iov_len; i++) {
+		if (!isdigit(p[i]) || n > (SIZE_MAX - 9) / 10) return -1;
+		n = n * 10 + (p[i] - '0');
 	}
-	else if (!iovstrcmp(k, "Connection")) {
+	*len = n;
+	return 0;
+}
+
+static int http_header_process(http_request_t *req, struct iovec *k, struct iovec *v)
+{
+	struct iovec chunked = { "chunked", 7 };
+	struct iovec cont = { "100-continue", 12 };
+	http_header_t id;
+	size_t len;
+
+	if ((id = http_header_id(k)) == HTTP_HEADER_UNKNOWN) return 0;
+	iovcpy((struct iovec *)((char *)req + http_header_field[id]), v);
+	switch (id) {
+	case HTTP_HEADER_CONNECTION:
 		req->conn_upgrade = !iovstrtokmatch(v, "upgrade", ", ");
 		req->conn_keepalive = !iovstrtokmatch(v, "keep-alive", ", ");
-		req->close = !iovstrtokmatch(v, "close", ", ");
+		/* HTTP/1.0 closes by default, unless asked to keep-alive */
+		if (!iovstrtokmatch(v, "close", ", ")) req->close = 1;
+		else if (req->conn_keepalive) req->close = 0;
+		break;
+	case HTTP_HEADER_CONTENT_LENGTH:
+		if (http_content_length(v, &len)) return HTTP_BAD_REQUEST;
+		/* repeats must agree */
+		if (req->body.state == HTTP_BODY_LENGTH && req->body.left != len)
+			return HTTP_BAD_REQUEST;
+		req->body.state = HTTP_BODY_LENGTH;
+		req->body.left = len;
+		break;
+	case HTTP_HEADER_EXPECT:
+		if (iovstrcasecmp(v, &cont)) return HTTP_EXPECTATION_FAILED;
+		break;
+	case HTTP_HEADER_TRANSFER_ENCODING:
+		/* chunked is the only coding we decode */
+		if (iovstrcasecmp(v, &chunked)) return HTTP_NOT_IMPLEMENTED;
+		break;
+	case HTTP_HEADER_UPGRADE_INSECURE:
+		req->upsec = !iovstrcmp(v, "1");
+		break;
+	default:
+		break;
 	}
-	else if (!iovstrcmp(k, "Referrer")) {
-		iovcpy(&req->referrer, v);
+	return 0;
+}
+
+/* request line: method SP uri SP HTTP/version */
+static int http_request_line(http_request_t *req, char *line, size_t len)
+{
+	char *end = line + len;
+	char *sp;
+	size_t n;
+
+	if (!(sp = memchr(line, ' ', len))) return HTTP_BAD_REQUEST;
+	if (!(n = sp - line) || n > HTTP_METHOD_MAX) return HTTP_BAD_REQUEST;
+	iovset(&req->method, line, n);
+
+	line = sp + 1;
+	if (!(sp = memchr(line, ' ', end - line))) return HTTP_BAD_REQUEST;
+	if (!(n = sp - line)) return HTTP_BAD_REQUEST;
+	if (n > HTTP_URI_MAX) return HTTP_URI_TOO_LARGE;
+	iovset(&req->uri, line, n);
+
+	line = sp + 1;
+	n = end - line;
+	if (n < 5 || n > HTTP_VERSION_MAX || memcmp(line, "HTTP/", 5))
+		return HTTP_BAD_REQUEST;
+	iovset(&req->httpv, line + 5, n - 5);
+	DEBUG("HTTP_VERSION: %.*s", FMTV(req->httpv));
+	if (iovstrcmp(&req->httpv, "1.1")) {
+		if (iovstrcmp(&req->httpv, "1.0"))
+			return HTTP_VERSION_NOT_SUPPORTED;
+		req->close = 1;
 	}
-	else if (!iovstrcmp(k, "Sec-WebSocket-Extensions")) {
-		iovcpy(&req->secwebsocketextensions, v);
+	return 0;
+}
+
+/* header line: name ":" OWS value OWS */
+static int http_header_line(http_request_t *req, char *line, size_t len)
+{
+	struct iovec k, v;
+	char *colon;
+
+	/* obsolete line folding and whitespace before colon are rejected, as
+	 * RFC 7230 3.2.4 allows */
+	if (isblank(*line)) return HTTP_BAD_REQUEST;
+	if (!(colon = memchr(line, ':', len))) return HTTP_BAD_REQUEST;
+	iovset(&k, line, colon - line);
+	if (!k.iov_len || isblank(colon[-1])) return HTTP_BAD_REQUEST;
+	line = colon + 1;
+	len -= k.iov_len + 1;
+	while (len && isblank(*line)) { line++; len--; }
+	while (len && isblank(line[len - 1])) len--;
+	iovset(&v, line, len);
+
+	return http_header_process(req, &k, &v);
+}
+
+/* set up body decoder once all headers are in */
+static int http_body_init(http_request_t *req)
+{
+	if (req->transferencoding.iov_len) {
+		/* both is a smuggling attempt, or a broken proxy (RFC 7230 3.3.3) */
+		if (req->contentlength.iov_len) return HTTP_BAD_REQUEST;
+		req->body.state = HTTP_BODY_CHUNK_SIZE;
+		req->body.left = 0;
 	}
-	else if (!iovstrcmp(k, "Sec-WebSocket-Key")) {
-		iovcpy(&req->secwebsocketkey, v);
+	else if (req->body.state == HTTP_BODY_LENGTH && !req->body.left) {
+		req->body.state = HTTP_BODY_DONE;
 	}
-	else if (!iovstrcmp(k, "Sec-WebSocket-Protocol")) {
-		iovcpy(&req->secwebsocketprotocol, v);
+	return 0;
+}
+
+/* n bytes of body data used */
+static void http_body_advance(http_body_t *b, size_t n)
+{
+	if ((b->left -= n)) return;
+	if (b->state == HTTP_BODY_LENGTH) b->state = HTTP_BODY_DONE;
+	else b->state = HTTP_BODY_CHUNK_CRLF;
+}
+
+ssize_t http_body_parse(http_body_t *b, char *data, size_t len, struct iovec *chunk)
+{
+	char *nl, *p;
+	size_t n = 0;
+	int digits = 0;
+
+	iovset(chunk, data, 0);
+	switch (b->state) {
+	case HTTP_BODY_LENGTH:
+	case HTTP_BODY_CHUNK_DATA:
+		n = (len < b->left) ? len : b->left;
+		chunk->iov_len = n;
+		http_body_advance(b, n);
+		return n;
+	case HTTP_BODY_CHUNK_CRLF:
+		if (!len) return 0;
+		if (data[0] == '\n') n = 1;
+		else if (data[0] != '\r') return -1;
+		else if (len < 2) return 0;
+		else if (data[1] == '\n') n = 2;
+		else return -1;
+		b->state = HTTP_BODY_CHUNK_SIZE;
+		return n;
+	case HTTP_BODY_CHUNK_SIZE:
+	case HTTP_BODY_TRAILER:
+		if (!(nl = memchr(data, '\n', len)))
+			return (len < HTTP_REQUEST_MAX) ? 0 : -1;
+		if (nl - data >= HTTP_REQUEST_MAX) return -1;
+		if (b->state == HTTP_BODY_TRAILER) {
+			/* trailers are ignored, up to the blank line */
+			if (nl == data || (nl == data + 1 && data[0] == '\r'))
+				b->state = HTTP_BODY_DONE;
+			return nl - data + 1;
+		}
+		/* hex size, then optional ;extensions we ignore */
+		for (p = data; p < nl && isxdigit(*p); p++, digits++) {
+			if (n > (SIZE_MAX >> 4)) return -1;
+			n = (n << 4) | (isdigit(*p) ? *p - '0' : (*p | 0x20) - 'a' + 10);
+		}
+		if (!digits) return -1;
+		while (p < nl && isblank(*p)) p++;
+		if (p < nl && *p != ';' && *p != '\r') return -1;
+		b->left = n;
+		b->state = (n) ? HTTP_BODY_CHUNK_DATA : HTTP_BODY_TRAILER;
+		return nl - data + 1;
+	case HTTP_BODY_DONE:
+		break;
 	}
-	else if (!iovstrcmp(k, "Sec-WebSocket-Version")) {
-		iovcpy(&req->secwebsocketversion, v);
+	return 0;
+}
+
+int http_request_parse(http_parser_t *p, http_request_t *req, char *data, size_t len)
+{
+	char *line, *nl;
+	size_t linelen;
+	int err;
+
+	while (p->scan < len) {
+		/* memchr() is vectorized in libc, and never looks at a byte twice
+		 * as scan remembers where the last call stopped */
+		if (!(nl = memchr(data + p->scan, '\n', len - p->scan))) {
+			p->scan = len;
+			break;
+		}
+		line = data + p->off;
+		linelen = nl - line;
+		if (linelen && line[linelen - 1] == '\r') linelen--;
+		p->scan = p->off = nl - data + 1;
+
+		if (p->state == HTTP_PARSE_LINE) {
+			/* skip empty lines before the request line (RFC 7230 3.5) */
+			if (!linelen) {
+				p->start = p->off;
+				continue;
+			}
+			DEBUG("%.*s", (int)linelen, line);
+			if ((err = http_request_line(req, line, linelen))) return err;
+			p->state = HTTP_PARSE_HEADERS;
+		}
+		else if (!linelen) {
+			/* blank line ends the headers */
+			iovset(&req->head, data + p->start, p->off - p->start);
+			req->len = p->off;
+			return http_body_init(req);
+		}
+		else if ((err = http_header_line(req, line, linelen))) {
+			return err;
+		}
 	}
-	else if (!iovstrcmp(k, "Upgrade")) {
-		iovcpy(&req->upgrade, v);
+	return HTTP_PARSE_MORE;
+}
+
+/* make room at the end of b to read into. Unused space at the front is
+ * reclaimed first, then the buffer doubles up to max. Returns -1 if b is
+ * full, 1 if the data moved, so anything pointing into it must be redone */
+static int http_buf_reserve(http_buf_t *b, size_t max)
+{
+	size_t size;
+	char *tmp;
+
+	if (b->len < b->size) return 0;
+	if (b->off) {
+		memmove(b->data, b->data + b->off, b->len - b->off);
+		b->len -= b->off;
+		b->off = 0;
+		return 1;
 	}
-	else if (!iovstrcmp(k, "Upgrade-Insecure-Requests")) {
-		req->upsec = !iovstrcmp(v, "1");
+	if (b->size >= max) return -1;
+	size = (b->size) ? b->size * 2 : BUFLEN;
+	if (size > max) size = max;
+	if (!(tmp = realloc(b->data, size))) return -1;
+	b->data = tmp;
+	b->size = size;
+	return 1;
+}
+
+static int http_buf_append(http_buf_t *b, struct iovec *iov, size_t n)
+{
+	size_t len = 0;
+	size_t size;
+	char *tmp;
+
+	for (size_t i = 0; i < n; i++) len += iov[i].iov_len;
+	if (b->len + len > b->size) {
+		for (size = (b->size) ? b->size : BUFLEN; size < b->len + len; size *= 2);
+		if (!(tmp = realloc(b->data, size))) return -1;
+		b->data = tmp;
+		b->size = size;
 	}
-	else if (!iovstrcmp(k, "User-Agent")) {
-		iovcpy(&req->useragent, v);
+	for (size_t i = 0; i < n; i++) {
+		if (iov[i].iov_len) memcpy(b->data + b->len, iov[i].iov_base, iov[i].iov_len);
+		b->len += iov[i].iov_len;
 	}
 	return 0;
 }
 
-static int http_ready(int sock)
+static void http_buf_free(http_buf_t *b)
 {
-	return (recv(sock, buf, 1, MSG_PEEK | MSG_WAITALL) > 0);
+	free(b->data);
+	memset(b, 0, sizeof(http_buf_t));
 }
 
-/* top up http buffer, returning number of bytes read or -1 on error
- * lclen = value of Content-Length header, or -1 */
-static ssize_t http_fill_buffer(conn_t *c, void *ptr, size_t len)
+/* read whatever is available into the input buffer. Returns bytes read,
+ * 0 on EOF or -1 on error */
+static ssize_t http_fill_buffer(conn_t *c, http_buf_t *b)
 {
-	ssize_t byt = 0;
+	ssize_t byt;
 
 	TRACE("%s()", __func__);
-	if (c->ssl) {
-		if ((byt = wolfSSL_read(c->ssl, ptr, len)) < 0) {
+	if (HTTP_TLS_RX(c)) {
+		if ((byt = wolfSSL_read(c->ssl, b->data + b->len, b->size - b->len)) < 0)
 			return -1;
-		}
 	}
 	else {
-		if ((byt = recv(c->sock, ptr, len, 0)) == -1) {
+		while ((byt = recv(c->sock, b->data + b->len, b->size - b->len, 0)) == -1
+				&& errno == EINTR);
+		if (byt == -1) {
 			ERROR("recv() error '%s'", strerror(errno));
 			return -1;
 		}
 	}
-	DEBUG("%lu bytes read", byt);
+	DEBUG("%zi bytes read", byt);
+	b->len += byt;
 
 	return byt;
 }
 
-/* return one line at a time, reading from socket as we go */
-static ssize_t http_read_line(conn_t *c, char **line, http_request_t *req)
+/* wait until the socket is ready for wolfSSL to go again after err */
+static int http_tls_wait(conn_t *c, int err)
 {
-	static char *ptr = buf;		/* ptr to empty buffer */
-	static char *nxt = buf;		/* ptr to unprocessed bytes */
-	static size_t byt = 0;		/* unprocessed bytes */
-	char *nl = NULL;		/* ptr to newline */
-	ssize_t len = 0;		/* length of line */
+	struct pollfd pfd = { .fd = c->sock };
+	int ret;
 
-	TRACE("%s()", __func__);
+	pfd.events = (err == WOLFSSL_ERROR_WANT_READ) ? POLLIN : POLLOUT;
+	while ((ret = poll(&pfd, 1, -1)) == -1 && errno == EINTR);
+	return (ret == 1 && !(pfd.revents & (POLLERR | POLLNVAL))) ? 0 : -1;
+}
 
-	if (!req->len) {
-		ptr = nxt = buf;
-		byt = 0;
+/* write all of data over TLS, at most a record at a time. Returns 0, or -1 on
+ * error */
+static int http_tls_write(conn_t *c, const char *data, size_t len)
+{
+	int byt, err;
+
+	while (len) {
+		byt = wolfSSL_write(c->ssl, data, (len < HTTP_TLS_RECORD) ? (int)len : HTTP_TLS_RECORD);
+		if (byt <= 0) {
+			/* retry with the same arguments once the socket is ready */
+			err = wolfSSL_get_error(c->ssl, byt);
+			if ((err == WOLFSSL_ERROR_WANT_WRITE || err == WOLFSSL_ERROR_WANT_READ)
+			&& !http_tls_wait(c, err))
+				continue;
+			ERRMSG(LSD_ERROR_TLS_WRITE);
+			return -1;
+		}
+		data += byt;
+		len -= byt;
 	}
+	return 0;
+}
 
-	do {
-		if (byt) { /* have unprocessed bytes */
-
-			/* check for newline */
-			nl = memchr(nxt, '\n', byt);
-			if (nl) {
-				*line = nxt;
-				len = nl - nxt;
-				nxt = nl + 1;
-				req->len += len;
-				byt -= len;
-
-				/* chop CRLF */
-				len--;
-				if ((*line)[len - 1] == '\r') len--;
-
-				return len;
-			}
+/* write all of iov over TLS. Small iovecs are gathered into full records,
+ * big ones are written in place, so nothing is copied into one buffer the
+ * size of the response. Returns bytes written or -1 on error */
+static ssize_t http_tls_writev(conn_t *c, struct iovec *iov, int iovcnt)
+{
+	char rec[HTTP_TLS_RECORD];
+	size_t used = 0, total = 0, len, n;
+	char *p;
+
+	for (int i = 0; i < iovcnt; i++) {
+		p = iov[i].iov_base;
+		len = iov[i].iov_len;
+		total += len;
+		if (!len) continue;
+		if (used) {
+			n = (len < sizeof rec - used) ? len : sizeof rec - used;
+			memcpy(rec + used, p, n);
+			used += n;
+			p += n;
+			len -= n;
+			if (used < sizeof rec) continue;
+			if (http_tls_write(c, rec, used)) return -1;
+			used = 0;
 		}
-		/* either we have no bytes, or they don't contain a LF */
+		n = len - len % sizeof rec;
+		if (n && http_tls_write(c, p, n)) return -1;
+		memcpy(rec, p + n, len - n);
+		used = len - n;
+	}
+	if (used && http_tls_write(c, rec, used)) return -1;
+	return (ssize_t)total;
+}
 
-		len = BUFLEN - ((char *)ptr - buf); /* remaining buffer space */
+/* write all of iov, returning bytes written or -1 on error */
+static ssize_t http_writev(conn_t *c, struct iovec *iov, int iovcnt)
+{
+	ssize_t byt, total = 0;
 
-		/* we're near the end of the buffer */
-		/* FIXME - this doesn't actually work ... */
-		if (byt && len < LINE_MAX) {
-			/* move unprocessed bytes to beginning of buffer */
-			DEBUG("shifting unprocessed bytes");
-			memmove(buf, nxt, len);
-			len = BUFLEN;
-			nxt = ptr = buf;
+	if (HTTP_TLS_TX(c)) return http_tls_writev(c, iov, iovcnt);
+	while (iovcnt) {
+		if ((byt = writev(c->sock, iov, iovcnt)) == -1) {
+			if (errno == EINTR) continue;
+			ERROR("writev() error '%s'", strerror(errno));
+			return -1;
 		}
-
-		/* read some bytes */
-		len = http_fill_buffer(c, ptr, len);
-		if (len > 0) {
-			if (byt + len < BUFLEN) {
-				ptr += len;
-				byt += len;
-			}
-			else return -1;
+		total += byt;
+		/* short write: skip what was sent and go again */
+		for (; iovcnt && (size_t)byt >= iov->iov_len; iov++, iovcnt--)
+			byt -= iov->iov_len;
+		if (iovcnt) {
+			iov->iov_base = (char *)iov->iov_base + byt;
+			iov->iov_len -= byt;
 		}
-	} while (len > 0);
+	}
+	return total;
+}
 
-	return len;
+/* send queued responses, followed by iov if not NULL, in one writev().
+ * Returns bytes of iov written, or -1 on error */
+static ssize_t http_flush(conn_t *c, http_conn_t *hc, struct iovec *iov, int iovcnt)
+{
+	struct iovec v[HTTP_FLUSH_IOV];
+	size_t queued = hc->out.len;
+	ssize_t byt;
+	int n = 0;
+
+	if (iovcnt >= HTTP_FLUSH_IOV) {
+		/* too many to gather, send separately */
+		if (http_flush(c, hc, NULL, 0) == -1) return -1;
+		return http_writev(c, iov, iovcnt);
+	}
+	if (queued) iovset(&v[n++], hc->out.data, queued);
+	for (int i = 0; i < iovcnt; i++) v[n++] = iov[i];
+	if (!n) return 0;
+	if ((byt = http_writev(c, v, n)) == -1) return -1;
+	hc->out.len = 0;
+	return byt - queued;
 }
 
-static inline http_status_code_t
-http_headers_read(conn_t *c, http_request_t *req, http_response_t *res)
+/* read next request into req. Returns 0 on success, http_status_code_t on
+ * error, or -1 if the connection closed between requests */
+static int http_request_read(conn_t *c, http_conn_t *hc, http_request_t *req)
 {
-	char *ptr;
-	struct iovec header, val;
-	size_t i;
-	ssize_t len;
+	http_parser_t p = {0};
+	http_buf_t *in = &hc->in;
 	int err;
 
-	/* read headers until we find a blank line */
-	while ((len = http_read_line(c, &ptr, req)) > 0) {
-		i = wordend(&ptr, len, req->len);
-		if (i == 0 || i == req->len) break;
-		iovset(&header, ptr, i - 1);
-		ptr += i + 1;
-		iovset(&val, ptr, len - i - 1);
-		if ((err = http_header_process(req, res, &header, &val)))
-			return err;
+	TRACE("%s()", __func__);
+	if (in->off == in->len) {
+		in->off = in->len = 0;
+		/* bytes read past the last body are the start of this request */
+		if (hc->body.off < hc->body.len) {
+			http_buf_t tmp = *in;
+			*in = hc->body;
+			hc->body = tmp;
+		}
 	}
-	if (len == -1) {
+	while ((err = http_request_parse(&p, req, in->data + in->off,
+					in->len - in->off)) == HTTP_PARSE_MORE)
+	{
+		/* about to block, so answer the pipelined requests we have */
+		if (http_flush(c, hc, NULL, 0) == -1) return -1;
+		switch (http_buf_reserve(in, HTTP_REQUEST_MAX)) {
+		case -1:
+			req->close = 1;
+			return HTTP_HEADERS_TOO_LARGE;
+		case 1:
+			/* buffer moved, so start this request again */
+			memset(&p, 0, sizeof p);
+			memset(req, 0, sizeof(http_request_t));
+		}
+		if (http_fill_buffer(c, in) <= 0) return -1;
+	}
+	if (err) {
+		/* no way to find the next request, so answer this one and close */
 		req->close = 1;
-		return HTTP_BAD_REQUEST;
+		return err;
 	}
+	in->off += req->len;
+
+	/* set request time so we have consist timestamp when needed */
+	req->t = time(NULL);
+
 	return 0;
 }
 
-
-static http_status_code_t
-http_request_read(conn_t *c, http_request_t *req, http_response_t *res)
+/* tell a client waiting on Expect: 100-continue to send its body */
+static int http_body_continue(conn_t *c, http_conn_t *hc, http_request_t *req)
 {
-	size_t i, metlen, urilen, htvlen;
-	ssize_t len = 0;
-	char *ptr, *met, *uri, *htv;
+	struct iovec iov = { "HTTP/1.1 100 Continue\r\n\r\n", 25 };
 
-	TRACE("%s()", __func__);
-	memset(req, 0, sizeof(http_request_t));
-
-	/* set request time so we have consist timestamp when needed */
-	req->t = time(NULL);
+	if (!req->expect.iov_len || req->continued) return 0;
+	req->continued = 1;
+	return (http_flush(c, hc, &iov, 1) == -1) ? -1 : 0;
+}
 
-	/* read first request line */
-	if ((len = http_read_line(c, &ptr, req)) == -1) {
-		req->close = 1;
-		return HTTP_BAD_REQUEST;
+/* read more body into hc->body. Any part of a chunk header still in hc->in
+ * moves across first, to join what is read */
+static ssize_t http_body_fill(conn_t *c, http_conn_t *hc, http_request_t *req)
+{
+	http_buf_t *in = &hc->in;
+	http_buf_t *b = &hc->body;
+	struct iovec iov;
+
+	if (b->off == b->len) b->off = b->len = 0;
+	if (in->off < in->len) {
+		iovset(&iov, in->data + in->off, in->len - in->off);
+		if (http_buf_append(b, &iov, 1)) return -1;
+		in->off = in->len;
 	}
-	DEBUG("%.*s", (int)len, ptr);
-
-	i = wordend(&ptr, HTTP_METHOD_MAX, req->len);	/* HTTP method */
-	if (i == 0 || i == req->len)
-		return HTTP_BAD_REQUEST;
-	met = buf; metlen = i;
+	if (http_body_continue(c, hc, req)) return -1;
+	if (http_buf_reserve(b, HTTP_REQUEST_MAX) == -1) return -1;
+	return http_fill_buffer(c, b);
+}
 
-	if (skipspace(&ptr, i, req->len) == req->len)
-		return HTTP_BAD_REQUEST;
+/* next run of request body, which points into a connection buffer and is
+ * valid until the next call. Body bytes are read in at most buffer sized
+ * runs, so the whole body is never held in memory. Returns length of chunk,
+ * 0 at the end of the body, or -1 on error, when the connection must close */
+static ssize_t http_body_next(conn_t *c, http_conn_t *hc, http_request_t *req,
+		struct iovec *chunk)
+{
+	http_buf_t *b;
+	ssize_t used;
+
+	while (req->body.state != HTTP_BODY_DONE) {
+		/* request buffer first, as headers and body often arrive together */
+		b = (hc->in.off < hc->in.len) ? &hc->in : &hc->body;
+		used = http_body_parse(&req->body, b->data + b->off, b->len - b->off, chunk);
+		if (used == -1) return -1;
+		b->off += used;
+		if (chunk->iov_len) return chunk->iov_len;
+		if (!used && http_body_fill(c, hc, req) <= 0) return -1;
+	}
+	return 0;
+}
 
-	i = wordend(&ptr, HTTP_URI_MAX, req->len);	/* URI */
-	if (i == 0 || i == req->len)
-		return HTTP_BAD_REQUEST;
-	uri = ptr; urilen = i;
+/* move body data straight from socket to fd, through a pipe, without copying
+ * it to userspace. Returns bytes moved, or -1 on error */
+static ssize_t http_body_splice(conn_t *c, http_body_t *body, int pipefd[2], int fd)
+{
+	size_t len = (body->left < HTTP_SPLICE_MAX) ? body->left : HTTP_SPLICE_MAX;
+	ssize_t byt, out;
+
+	while ((byt = splice(c->sock, NULL, pipefd[1], NULL, len,
+				SPLICE_F_MOVE | SPLICE_F_MORE)) == -1 && errno == EINTR);
+	if (byt <= 0) return -1;
+	for (size_t left = byt; left; left -= out) {
+		out = splice(pipefd[0], NULL, fd, NULL, left, SPLICE_F_MOVE | SPLICE_F_MORE);
+		if (out == -1 && errno == EINTR) out = 0;
+		else if (out <= 0) return -1;
+	}
+	http_body_advance(body, byt);
+	return byt;
+}
 
-	if (skipspace(&ptr, i, req->len) == req->len)
-		return HTTP_BAD_REQUEST;
+/* write request body to fd. Buffered body bytes are written out, and on a
+ * plaintext connection the rest of each run is spliced from the socket */
+static int http_body_sink(conn_t *c, http_conn_t *hc, http_request_t *req, int fd)
+{
+	http_body_t *body = &req->body;
+	struct iovec chunk;
+	int pipefd[2] = { -1, -1 };
+	int err = 0;
 
-	i = wordend(&ptr, HTTP_VERSION_MAX, req->len);	/* HTTP version */
-	if (i == 0 || i == req->len)
-		return HTTP_BAD_REQUEST;
-	if (strncmp(ptr, "HTTP/", 5)) {
-		return HTTP_BAD_REQUEST;
-	}
-	ptr += 5; i -= 5;
-	htv = ptr; htvlen = i;
-	DEBUG("HTTP_VERSION: %.*s", (int)i, ptr);
-	if (strncmp(ptr, "1.1", i)) {
-		if (!strncmp(ptr, "1.0", i)) {
-			req->close = 1;
+	while (!err && body->state != HTTP_BODY_DONE) {
+		if (!HTTP_TLS_RX(c) && hc->in.off == hc->in.len && hc->body.off == hc->body.len
+		&& (body->state == HTTP_BODY_LENGTH || body->state == HTTP_BODY_CHUNK_DATA)
+		&& (pipefd[0] != -1 || !pipe(pipefd)))
+		{
+			if (http_body_continue(c, hc, req)) err = -1;
+			else if (http_body_splice(c, body, pipefd, fd) == -1) err = -1;
+			continue;
 		}
-		else {
-			return HTTP_VERSION_NOT_SUPPORTED;
+		if (http_body_next(c, hc, req, &chunk) <= 0) {
+			if (body->state != HTTP_BODY_DONE) err = -1;
+			break;
 		}
+		while (chunk.iov_len) {
+			ssize_t byt = write(fd, chunk.iov_base, chunk.iov_len);
+			if (byt == -1 && errno == EINTR) continue;
+			if (byt == -1) {
+				ERROR("write() error '%s'", strerror(errno));
+				err = -1;
+				break;
+			}
+			chunk.iov_base = (char *)chunk.iov_base + byt;
+			chunk.iov_len -= byt;
+		}
+	}
+	if (pipefd[0] != -1) {
+		close(pipefd[0]);
+		close(pipefd[1]);
 	}
-	iovset(&req->method, met, metlen);
-	iovset(&req->uri, uri, urilen);
-	iovset(&req->httpv, htv, htvlen);
+	return err;
+}
+
+/* read and drop a body nobody wanted, so the next request can be found.
+ * Returns -1 if the connection should close instead */
+static int http_body_discard(conn_t *c, http_conn_t *hc, http_request_t *req)
+{
+	struct iovec chunk;
+	size_t total = 0;
+	ssize_t len;
 
-	return http_headers_read(c, req, res);
+	if (req->body.state == HTTP_BODY_DONE) return 0;
+	/* client is waiting for our go ahead, so will send nothing more */
+	if (req->expect.iov_len && !req->continued) return -1;
+	while ((len = http_body_next(c, hc, req, &chunk)) > 0) {
+		if ((total += len) > HTTP_DISCARD_MAX) return -1;
+	}
+	return (int)len;
 }
 
 size_t rcv(conn_t *c, void *data, size_t len, int flags)
 {
-	if (c->ssl) {
+	if (HTTP_TLS_RX(c)) {
 		return wolfSSL_read(c->ssl, data, (int)len);
 	}
 	else {
@@ -317,9 +986,8 @@ size_t rcv(conn_t *c, void *data, size_t len, int flags)
 
 ssize_t snd(conn_t *c, void *data, size_t len, int flags)
 {
-	if (c->ssl) {
-		assert(len <= INT_MAX); /* FIXME - deal with wolfssl limit */
-		return wolfSSL_write(c->ssl, data, (int)len);
+	if (HTTP_TLS_TX(c)) {
+		return (http_tls_write(c, data, len)) ? -1 : (ssize_t)len;
 	}
 	else {
 		return send(c->sock, data, len, flags);
@@ -348,21 +1016,17 @@ ssize_t snd_string(conn_t *c, char *str, ...)
 	return len;
 }
 
-static int http_response_send(conn_t *c, http_request_t *req, http_response_t *res)
+/* queue response, to go out with any others in one write once we run out
+ * of pipelined requests */
+static int http_response_send(conn_t *c, http_conn_t *hc, http_response_t *res)
 {
-	(void) req;
-
-	setcork(c->sock, 1);
-	if (c->ssl) {
-		if (!wolfSSL_writev(c->ssl, res->iovs.iov, res->iovs.idx)) {
-			FAIL(LSD_ERROR_TLS_WRITE);
-		}
-	}
-	else {
-		if (writev(c->sock, res->iovs.iov, res->iovs.idx) == -1)
-			return -1;
+	if (http_buf_append(&hc->out, res->iovs.iov, res->iovs.idx)) {
+		ERRMSG(LSD_ERROR_NOMEM);
+		return -1;
 	}
-	setcork(c->sock, 0);
+	res->len = iovs_size(&res->iovs);
+	if (hc->out.len >= HTTP_OUTPUT_MAX && http_flush(c, hc, NULL, 0) == -1)
+		return -1;
 	return 0;
 }
 
@@ -474,29 +1138,11 @@ static char * unpackiov(char *ptr, struct iovec *iov)
 	return ptr + len;
 }
 
-static int http_match_uri(http_request_t *req, struct iovec uri[HTTP_PARTS])
-{
-	if (iovcmp(&req->method, &uri[HTTP_METHOD]))
-		return 0;
-	
-	/* Host: header */
-	if (uri[HTTP_DOMAIN].iov_len != 0) {
-		if ((iovcmp(&req->host, &uri[HTTP_DOMAIN])) 
-		&&  (iovcmp(&req->host, &uri[HTTP_HOST])))
-			return 0;
-	}
-
-	/* path */
-	if (!iovmatch(&uri[HTTP_PATH], &req->uri, 0))
-		return 1;
-
-	return 0;
-}
-
 /* output NCSA Common log format */
 static void http_request_log(conn_t *c, http_request_t *req, http_response_t *res)
 {
 	char ts[27];
+	struct tm tm;
 	struct iovec dash = { "-", 1 };
 	char httpv[9] = "-";
 
@@ -507,7 +1153,8 @@ static void http_request_log(conn_t *c, http_request_t *req, http_response_t *re
 	if (!req->referrer.iov_len) iovcpy(&req->referrer, &dash);
 	if (!req->useragent.iov_len) iovcpy(&req->useragent, &dash);
 
-	strftime(ts, 27, "%d/%b/%Y:%T %z", localtime(&req->t));
+	/* localtime() shares one buffer between worker threads */
+	strftime(ts, 27, "%d/%b/%Y:%T %z", localtime_r(&req->t, &tm));
 	INFO("%s - - [%s] \"%.*s %.*s %s\" %i %zu \"%.*s\" \"%.*s\"",
 		c->addr,
 		ts,
@@ -525,33 +1172,14 @@ static void http_request_log(conn_t *c, http_request_t *req, http_response_t *re
 static http_status_code_t
 http_request_handle(conn_t *c, http_request_t *req, http_response_t *res)
 {
-	MDB_val val = { 0, NULL };
+	route_table_t *t = routes[!strcmp(c->proto->module, "https")];
+	struct iovec *uri;
 
 	TRACE("%s()", __func__);
 
-	/* protocol, method, action, args, host, port, path */
-	char *ptr;
-	char found = 0;
-	char db_uri[16];
-	struct iovec uri[HTTP_PARTS];
-	size_t len = strlen(c->proto->module);
-	strncpy(db_uri, c->proto->module, len);
-	strcpy(db_uri + len, "_uri");
-
-	for (int i = 0; config_yield(db_uri, NULL, &val) == CONFIG_NEXT; i++) {
-		ptr = (char *)val.mv_data;
-		ptr++;
-		for (int j = 0; j < HTTP_PARTS; j++) {
-			ptr = unpackiov(ptr, &uri[j]);
-		}
-		if (http_match_uri(req, uri)) {
-			memcpy(res->uri, uri, sizeof(struct iovec) * HTTP_PARTS);
-			found++;
-			break;
-		}
-	}
-	config_yield_free();
-	if (!found) return HTTP_NOT_FOUND;
+	if (!t || !(uri = route_match(t, &req->method, &req->host, &req->uri)))
+		return HTTP_NOT_FOUND;
+	memcpy(res->uri, uri, sizeof(struct iovec) * HTTP_PARTS);
 
 	return 0;
 }
@@ -615,94 +1243,598 @@ static char *fileext(char *filename)
 	return NULL;
 }
 
-static int http_sendfile(conn_t *c, char *filename, http_request_t *req, http_response_t *res)
+/* render header block for a newly cached file */
+static int http_file_render(filecache_entry_t *f)
 {
-	struct stat sb;
 	char status[128];
-	char *clen = NULL;
-	char *ctyp = NULL;
-	char *mime = NULL;
-	char *map = NULL;
-	ssize_t ret = 0;
-	int f;
-
-	if ((f = open(filename, O_RDONLY)) == -1) {
-		ERROR("unable to open '%s': %s\n", filename, strerror(errno));
-		return HTTP_NOT_FOUND;
+	char date[64];
+	struct tm tm;
+	char *mime;
+	int len;
+
+	http_status(status, HTTP_OK);
+	mime = http_mimetype(fileext(f->path));
+	gmtime_r(&f->sb.st_mtim.tv_sec, &tm);
+	strftime(date, sizeof date, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+	/* validators. Any change to the file changes the etag */
+	len = asprintf(&f->head, "%sContent-Type: %s\r\nLast-Modified: %s\r\n"
+		"ETag: \"%jx-%jx-%jx\"\r\nAccept-Ranges: bytes\r\nContent-Length: %zu\r\n",
+		status, (mime) ? mime : "text/plain", date, (uintmax_t)f->sb.st_ino,
+		(uintmax_t)f->sb.st_size, (uintmax_t)f->sb.st_mtim.tv_sec * 1000000000
+		+ (uintmax_t)f->sb.st_mtim.tv_nsec, (size_t)f->sb.st_size);
+	for (size_t i = 0; mime && i < sizeof http_compressible / sizeof http_compressible[0]; i++) {
+		if (!strncmp(mime, http_compressible[i], strlen(http_compressible[i]))) {
+			f->flags |= HTTP_FILE_COMPRESSIBLE;
+			break;
+		}
 	}
-	fstat(f, &sb);
-	if (! S_ISREG(sb.st_mode)) {
-		ERROR("'%s' is not a regular file", filename);
-		return HTTP_NOT_FOUND;
+	free(mime);
+	if (len == -1) {
+		f->head = NULL;
+		return -1;
 	}
-	DEBUG("Sending %zu bytes", sb.st_size);
-	setcork(c->sock, 1);
-	iov_push(&res->iovs, status, http_status(status, HTTP_OK));
-	mime = http_mimetype(fileext(filename));
-	if (mime)
-		iov_pushf(&res->iovs, ctyp, "Content-Type: %s\r\n", mime);
-	else
-		iov_pushs(&res->iovs, "Content-Type: text/plain\r\n");
-	iov_pushf(&res->iovs, clen, "Content-Length: %zu\r\n", sb.st_size);
-	iov_pushs(&res->iovs, "\r\n");
+	f->headlen = len;
+	return 0;
+}
+
+static filecache_t *http_filecache_new(void)
+{
+	struct rlimit rl;
+	int n = FILECACHE_SIZE;
+	int threads = 1;
+	long room;
+	char db[2];
 
-	if (c->ssl) {
-		DEBUG("TLS ENABLED");
+	config_db(DB_GLOBAL, db);
+	config_get_int(db, "filecache", &n, NULL, 0);
+	config_get_int(db, "threads", &threads, NULL, 0);
+
+	/* every cached file holds a descriptor open. Leave enough under
+	 * RLIMIT_NOFILE for the connections each thread may hold while serving
+	 * a batch, its epoll fd, and the listening sockets, lmdb and logs */
+	if (!getrlimit(RLIMIT_NOFILE, &rl) && rl.rlim_cur != RLIM_INFINITY) {
+		room = (long)rl.rlim_cur - FILECACHE_FD_RESERVE
+			- HANDLER_ACCEPT_BATCH - 2L * threads;
+		if (room < 0) room = 0;
+		if (n > room) {
+			DEBUG("RLIMIT_NOFILE %lu leaves room to cache %li files",
+					(unsigned long)rl.rlim_cur, room);
+			n = room;
+		}
+	}
+	DEBUG("caching up to %i files", n);
+	return filecache_new(n, FILECACHE_TTL, http_file_render);
+}
 
-		map = mmap(NULL, sb.st_size, PROT_READ, MAP_SHARED, f, 0);
-		iov_push(&res->iovs, map, sb.st_size);
+static void http_compress_conf(void)
+{
+	char db[2];
 
-		DEBUG("iovs_size = %zu", iovs_size(&res->iovs));
+	compressmin = COMPRESS_MIN;
+	compressbody = COMPRESS_BODY_MIN;
+	config_db(DB_GLOBAL, db);
+	config_get_int(db, "compressmin", &compressmin, NULL, 0);
+	config_get_int(db, "compressbody", &compressbody, NULL, 0);
+	config_get_s(db, "compressdir", &compressdir, NULL, 0);
+	if (compressdir && mkdir(compressdir, 0755) && errno != EEXIST) {
+		ERROR("unable to create '%s': %s", compressdir, strerror(errno));
+		free(compressdir);
+		compressdir = NULL;
+	}
+}
 
-		/* FIXME: wolfssl casts size_t to int, imposing a 2GB filesize limit */
-		assert(iovs_size(&res->iovs) <= INT_MAX);
+/* coding we can compress to that the client likes best, or -1 for none */
+static int http_coding_best(http_request_t *req)
+{
+	int best = -1, q, bestq = 0;
 
-		if (!(ret = wolfSSL_writev(c->ssl, res->iovs.iov, res->iovs.idx))) {
-			ERRMSG(LSD_ERROR_TLS_WRITE);
-			req->close = 1;
+	for (size_t i = 0; i < HTTP_CODINGS; i++) {
+		if (!compress_supported(http_codings[i].encoding)) continue;
+		if ((q = http_accept_encoding(&req->encoding, http_codings[i].coding)) > bestq) {
+			best = i;
+			bestq = q;
 		}
-		setcork(c->sock, 0);
 	}
-	else {
-		if ((ret = writev(c->sock, res->iovs.iov, res->iovs.idx)) == -1) {
-			ERROR("error writing headers");
-			req->close = 1;
-			goto http_sendfile_free;
-		}
-		res->len += (size_t)ret;
-		ret = 0;
-		while ((ret = sendfile(c->sock, f, &ret, sb.st_size)) < sb.st_size) {
-			if (ret == -1) {
-				ERROR("error sending file '%s': %s", filename, strerror(errno));
-				req->close = 1;
-				break;
-			}
-		}
-		setcork(c->sock, 0);
+	return best;
+}
+
+static int http_compress_sink(void *arg, const void *data, size_t len)
+{
+	struct iovec iov = { (void *)data, len };
+	return http_buf_append((http_buf_t *)arg, &iov, 1);
+}
+
+/* compress response body into buf, if it's big enough and the client takes
+ * a coding we have */
+static void http_compress_body(http_request_t *req, http_response_t *res, http_buf_t *buf)
+{
+	compress_t *z;
+	int i;
+
+	if (compressbody <= 0 || res->body.iov_len < (size_t)compressbody) return;
+	iov_pushs(&res->head, HTTP_VARY_ENCODING);
+	if ((i = http_coding_best(req)) == -1) return;
+	if (!(z = compress_new(http_codings[i].encoding))) return;
+	buf->off = buf->len = 0;
+	if (!compress_write(z, res->body.iov_base, res->body.iov_len, 1, http_compress_sink, buf)) {
+		res->encoding = http_codings[i].encoding;
+		iovset(&res->body, buf->data, buf->len);
+		iov_pushs(&res->head, http_codings[i].header);
+	}
+	compress_free(z);
+}
+
+/* compress f into path, stamped with f's mtime so it can be checked against
+ * f later. The copy is built in a temp file that the builder holds locked, so
+ * handlers don't all compress the same file at once. Returns -1 if no copy
+ * was made, including while another handler is making it */
+static int http_compress_file(filecache_entry_t *f, char *path, http_encoding_t enc)
+{
+	struct timespec ts[2] = { { .tv_nsec = UTIME_OMIT }, f->sb.st_mtim };
+	struct stat sb, lsb;
+	char tmpname[PATH_MAX];
+	int fd, err = -1;
+
+	if (snprintf(tmpname, sizeof tmpname, "%s.tmp", path) >= (int)sizeof tmpname)
+		return -1;
+	if ((fd = open(tmpname, O_WRONLY | O_CREAT | O_CLOEXEC, 0644)) == -1) {
+		ERROR("unable to create '%s': %s", tmpname, strerror(errno));
+		return -1;
+	}
+	/* a lock, unlike the file, goes away with a builder that dies, and
+	 * whoever builds next truncates what it left */
+	if (flock(fd, LOCK_EX | LOCK_NB)) {
+		if (errno != EWOULDBLOCK)
+			ERROR("unable to lock '%s': %s", tmpname, strerror(errno));
+		goto http_compress_file_close;
 	}
-	if (ret > 0) {
+	/* the file we locked may be one the last builder has since renamed
+	 * into place, or that copy may be all we wanted */
+	if (fstat(fd, &lsb) || stat(tmpname, &sb)
+	|| sb.st_dev != lsb.st_dev || sb.st_ino != lsb.st_ino)
+		goto http_compress_file_close;
+	if (!stat(path, &sb) && sb.st_mtim.tv_sec == f->sb.st_mtim.tv_sec
+	&& sb.st_mtim.tv_nsec == f->sb.st_mtim.tv_nsec) {
+		unlink(tmpname);
+		err = 0;
+		goto http_compress_file_close;
+	}
+	DEBUG("compressing '%s'", f->path);
+	if (!ftruncate(fd, 0) && !compress_file(enc, f->fd, fd) && !fchmod(fd, 0644)
+	&& !futimens(fd, ts))
+		err = 0;
+	/* rename while still locked, so nobody truncates the copy */
+	if (!err && rename(tmpname, path)) {
+		ERROR("unable to rename '%s': %s", tmpname, strerror(errno));
+		err = -1;
+	}
+	if (err) unlink(tmpname);
+http_compress_file_close:
+	close(fd);
+	return err;
+}
+
+static int http_variant_valid(filecache_entry_t *v, filecache_entry_t *f)
+{
+	return (v->fd != -1 && v->sb.st_mtim.tv_sec == f->sb.st_mtim.tv_sec
+		&& v->sb.st_mtim.tv_nsec == f->sb.st_mtim.tv_nsec);
+}
+
+/* compressed copy of f, made once per (path, mtime, coding) and kept in
+ * compressdir, if the client takes a coding we have. *vary is set if the
+ * response depends on Accept-Encoding. The copy returned must be given back
+ * with filecache_put() */
+static filecache_entry_t *http_variant(http_request_t *req, filecache_entry_t *f,
+		int *vary, size_t *idx)
+{
+	filecache_entry_t *v;
+	char path[PATH_MAX];
+	struct stat sb;
+	int i;
+
+	if (!compressdir || compressmin <= 0 || f->sb.st_size < compressmin
+	|| !(f->flags & HTTP_FILE_COMPRESSIBLE))
+		return NULL;
+	*vary = 1;
+	if ((i = http_coding_best(req)) == -1) return NULL;
+	if (snprintf(path, sizeof path, "%s/%016" PRIx64 "%s", compressdir,
+			hash_fnv1a64(f->path, strlen(f->path)), http_codings[i].ext) >= (int)sizeof path)
+		return NULL;
+	if ((v = filecache_get(files, path)) && http_variant_valid(v, f)) goto http_variant_found;
+	if (v) filecache_put(files, v);
+
+	/* our entry is out of date. Another handler may have made a new copy
+	 * already, or we make one. While someone else is making it, f goes out
+	 * uncompressed */
+	filecache_forget(files, path);
+	if (stat(path, &sb) || sb.st_mtim.tv_sec != f->sb.st_mtim.tv_sec
+	|| sb.st_mtim.tv_nsec != f->sb.st_mtim.tv_nsec) {
+		if (http_compress_file(f, path, http_codings[i].encoding)) return NULL;
+	}
+	if (!(v = filecache_get(files, path))) return NULL;
+	if (!http_variant_valid(v, f)) {
+		filecache_put(files, v);
+		return NULL;
+	}
+http_variant_found:
+	*idx = i;
+	return v;
+}
+
+/* start of the nth last line of a rendered header block. The last lines are
+ * Last-Modified, ETag, Accept-Ranges and Content-Length */
+#define HTTP_HEAD_MODIFIED 4
+#define HTTP_HEAD_ETAG 3
+#define HTTP_HEAD_RANGES 2
+#define HTTP_HEAD_LENGTH 1
+static size_t http_head_split(filecache_entry_t *f, int lines)
+{
+	size_t i = f->headlen;
+	while (lines--) {
+		for (i -= 2; i && f->head[i - 1] != '\n'; i--);
+	}
+	return i;
+}
+
+/* push line of rendered header block */
+static void http_head_push(http_response_t *res, filecache_entry_t *f, int line)
+{
+	size_t start = http_head_split(f, line);
+	iov_push(&res->iovs, f->head + start, http_head_split(f, line - 1) - start);
+}
+
+static void http_head_etag(filecache_entry_t *f, struct iovec *etag)
+{
+	size_t start = http_head_split(f, HTTP_HEAD_ETAG) + strlen("ETag: ");
+	iovset(etag, f->head + start, http_head_split(f, HTTP_HEAD_RANGES) - 2 - start);
+}
+
+/* client's copy, with validators in f, is current (RFC 7232 6) */
+static int http_not_modified(http_request_t *req, filecache_entry_t *f, struct iovec *etag)
+{
+	time_t t;
+
+	if (req->ifnonematch.iov_len) return http_etag_match(&req->ifnonematch, etag, 0);
+	if (req->ifmodifiedsince.iov_len && (t = http_date_parse(&req->ifmodifiedsince)) != -1)
+		return (f->sb.st_mtim.tv_sec <= t);
+	return 0;
+}
+
+/* ranges the client asked for are still of the copy it has */
+static int http_if_range(http_request_t *req, filecache_entry_t *f)
+{
+	struct iovec etag;
+
+	if (!req->ifrange.iov_len) return 1;
+	if (iovidx(req->ifrange, 0) == '"' || iovidx(req->ifrange, 0) == 'W') {
+		http_head_etag(f, &etag);
+		return http_etag_match(&req->ifrange, &etag, 1);
+	}
+	return (http_date_parse(&req->ifrange) == f->sb.st_mtim.tv_sec);
+}
+
+/* read len bytes of f from off into buf. Files are read, never mapped, as one
+ * truncated under a mapping would kill the handler with SIGBUS. Returns 0, or
+ * -1 on error or if the file is now shorter */
+static int http_file_read(filecache_entry_t *f, char *buf, size_t len, off_t off)
+{
+	ssize_t ret;
+
+	for (size_t n = 0; n < len; n += (size_t)ret) {
+		if ((ret = pread(f->fd, buf + n, len - n, off + n)) == -1 && errno == EINTR)
+			ret = 0;
+		else if (ret <= 0) {
+			ERROR("error reading file '%s': %s", f->path,
+				(ret) ? strerror(errno) : "truncated");
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/* send len bytes of f from off. Returns 0, or -1 on error */
+static int http_sendfile_slice(conn_t *c, http_response_t *res, filecache_entry_t *f,
+		off_t off, off_t len)
+{
+	char rec[HTTP_TLS_RECORD];
+	off_t end = off + len;
+	ssize_t ret;
+
+	if (HTTP_TLS_TX(c)) {
+		/* encrypted in userspace, so read a record at a time */
+		for (; off < end; off += len, res->len += (size_t)len) {
+			len = (end - off < (off_t)sizeof rec) ? end - off : (off_t)sizeof rec;
+			if (http_file_read(f, rec, len, off) || http_tls_write(c, rec, len))
+				return -1;
+		}
+		return 0;
+	}
+	for (; off < end; res->len += (size_t)ret) {
+		ret = sendfile(c->sock, f->fd, &off, end - off);
+		if (ret == -1 && errno == EINTR) ret = 0;
+		else if (ret <= 0) {
+			ERROR("error sending file '%s': %s", f->path, strerror(errno));
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/* send byte ranges r[0..n) of f as 206 Partial Content, several as
+ * multipart/byteranges, or 416 if there are none */
+static int http_sendfile_ranges(conn_t *c, http_conn_t *hc, http_request_t *req,
+		http_response_t *res, filecache_entry_t *f, http_range_t *r, int n)
+{
+	char status[128];
+	char hdr[256];
+	char boundary[32];
+	char *parts = NULL;
+	char *type, *p;
+	size_t typelen, split, size;
+	size_t partlen[HTTP_RANGES_MAX];
+	intmax_t total = 0;
+	ssize_t ret;
+	int len;
+
+	/* status line, then Content-Type */
+	type = (char *)memchr(f->head, '\n', f->headlen) + 1;
+	typelen = (char *)memchr(type, '\n', f->headlen - (type - f->head)) + 1 - type;
+	split = http_head_split(f, HTTP_HEAD_LENGTH);
+
+	if (!n) {
+		res->code = HTTP_RANGE_FAIL;
+		iov_push(&res->iovs, status, http_status(status, res->code));
+		iov_push(&res->iovs, hdr, snprintf(hdr, sizeof hdr,
+			"Content-Range: bytes */%jd\r\nContent-Length: 0\r\n\r\n",
+			(intmax_t)f->sb.st_size));
+		goto http_sendfile_ranges_flush;
+	}
+	res->code = HTTP_PARTIAL_CONTENT;
+	iov_push(&res->iovs, status, http_status(status, res->code));
+	if (n == 1) {
+		iov_push(&res->iovs, type, split - (type - f->head));
+		iov_push(&res->iovs, hdr, snprintf(hdr, sizeof hdr,
+			"Content-Range: bytes %jd-%jd/%jd\r\nContent-Length: %jd\r\n\r\n",
+			(intmax_t)r->off, (intmax_t)(r->off + r->len - 1),
+			(intmax_t)f->sb.st_size, (intmax_t)r->len));
+	}
+	else {
+		/* the part headers, and the closing boundary, are all kept in parts */
+		snprintf(boundary, sizeof boundary, "lsd-%016" PRIx64,
+			hash_fnv1a64(f->path, strlen(f->path)) ^ (uint64_t)f->sb.st_ino
+			^ (uint64_t)f->sb.st_mtim.tv_nsec ^ (uint64_t)f->sb.st_mtim.tv_sec);
+		size = n * (typelen + 128) + 64;
+		if (!(parts = malloc(size))) return HTTP_INTERNAL_SERVER_ERROR;
+		for (int i = 0; i < n; i++) {
+			p = parts + total;
+			len = snprintf(p, size - total, "\r\n--%s\r\n%.*s"
+				"Content-Range: bytes %jd-%jd/%jd\r\n\r\n",
+				boundary, (int)typelen, type, (intmax_t)r[i].off,
+				(intmax_t)(r[i].off + r[i].len - 1), (intmax_t)f->sb.st_size);
+			partlen[i] = len;
+			total += len;
+		}
+		len = snprintf(parts + total, size - total, "\r\n--%s--\r\n", boundary);
+		for (int i = 0; i < n; i++) total += r[i].len;
+		total += len;
+		iov_push(&res->iovs, type + typelen, split - (type + typelen - f->head));
+		iov_push(&res->iovs, hdr, snprintf(hdr, sizeof hdr,
+			"Content-Type: multipart/byteranges; boundary=%s\r\n"
+			"Content-Length: %jd\r\n\r\n", boundary, total));
+	}
+	setcork(c->sock, 1);
+	p = parts;
+	for (int i = 0; i < n && !req->close; i++) {
+		if (parts) {
+			iov_push(&res->iovs, p, partlen[i]);
+			p += partlen[i];
+		}
+		/* headers go before each slice is sent from the file */
+		if ((ret = http_flush(c, hc, res->iovs.iov, res->iovs.idx)) == -1
+		|| http_sendfile_slice(c, res, f, r[i].off, r[i].len)) {
+			req->close = 1;
+			break;
+		}
+		res->len += (size_t)ret;
+		iovs_clear(&res->iovs);
+	}
+	if (parts) iov_push(&res->iovs, p, len); /* closing boundary */
+http_sendfile_ranges_flush:
+	if (!req->close) {
+		if ((ret = http_flush(c, hc, res->iovs.iov, res->iovs.idx)) == -1)
+			req->close = 1;
+		else
+			res->len += (size_t)ret;
+	}
+	setcork(c->sock, 0);
+	free(parts);
+
+	return 0;
+}
+
+/* precompressed copy of f the client will take, if there is one at least as
+ * new as f. *vary is set if f has any such copy, as the response then depends
+ * on Accept-Encoding. The copy returned must be given back with
+ * filecache_put() */
+static filecache_entry_t *http_sidecar(http_request_t *req, filecache_entry_t *f,
+		int *vary, size_t *idx)
+{
+	filecache_entry_t *s, *best = NULL;
+	char path[PATH_MAX];
+	int q, bestq = 0;
+
+	for (size_t i = 0; i < HTTP_CODINGS; i++) {
+		if (!http_codings[i].sidecar) continue;
+		if (snprintf(path, sizeof path, "%s%s", f->path, http_codings[i].ext)
+				>= (int)sizeof path)
+			break;
+		if (!(s = filecache_get(files, path))) continue;
+		if (s->fd == -1 || s->sb.st_mtim.tv_sec < f->sb.st_mtim.tv_sec
+		|| (s->sb.st_mtim.tv_sec == f->sb.st_mtim.tv_sec
+			&& s->sb.st_mtim.tv_nsec < f->sb.st_mtim.tv_nsec)) {
+			filecache_put(files, s);
+			continue;
+		}
+		*vary = 1;
+		/* ties go to the first listed, which is the smallest */
+		if ((q = http_accept_encoding(&req->encoding, http_codings[i].coding)) > bestq) {
+			if (best) filecache_put(files, best);
+			best = s;
+			bestq = q;
+			*idx = i;
+		}
+		else filecache_put(files, s);
+	}
+	return best;
+}
+
+static int http_sendfile(conn_t *c, http_conn_t *hc, char *filename,
+		http_request_t *req, http_response_t *res)
+{
+	filecache_entry_t *f, *b = NULL;
+	http_range_t ranges[HTTP_RANGES_MAX];
+	struct iovec sv[2];
+	struct iovec etag;
+	char rec[HTTP_TLS_RECORD];
+	char status[128];
+	size_t i = 0;
+	ssize_t ret;
+	int vary = 0;
+	int code;
+	int slot;
+	int n;
+
+	if (!files || !(f = filecache_get(files, filename)))
+		return HTTP_INTERNAL_SERVER_ERROR;
+	if (f->fd == -1) {
+		ERROR("unable to open '%s': %s", filename, strerror(f->err));
+		code = (f->err == EACCES) ? HTTP_FORBIDDEN : HTTP_NOT_FOUND;
+		filecache_put(files, f);
+		return code;
+	}
+	res->code = HTTP_OK;
+
+	/* ranges are always of the file itself, never a compressed copy.
+	 * Otherwise, pick a precompressed or compressed copy if there is one */
+	n = -1;
+	if (req->range.iov_len && http_if_range(req, f))
+		n = http_range_parse(&req->range, f->sb.st_size, ranges);
+	if (n == -1 && !(b = http_sidecar(req, f, &vary, &i)))
+		b = http_variant(req, f, &vary, &i);
+
+	/* validators are those of the copy we would send */
+	http_head_etag((b) ? b : f, &etag);
+	if (http_not_modified(req, f, &etag)) {
+		res->code = HTTP_NOT_MODIFIED;
+		iov_push(&res->iovs, status, http_status(status, res->code));
+		http_head_push(res, f, HTTP_HEAD_MODIFIED);
+		http_head_push(res, (b) ? b : f, HTTP_HEAD_ETAG);
+		if (vary) iov_push(&res->iovs, HTTP_VARY_ENCODING, strlen(HTTP_VARY_ENCODING));
+		iov_push(&res->iovs, CRLF, 2);
+		if ((ret = http_flush(c, hc, res->iovs.iov, res->iovs.idx)) == -1)
+			req->close = 1;
+		else
+			res->len += (size_t)ret;
+		if (!b) b = f;
+		goto http_sendfile_free;
+	}
+	if (n != -1) {
+		code = http_sendfile_ranges(c, hc, req, res, f, ranges, n);
+		filecache_put(files, f);
+		return code;
+	}
+
+	/* the copy's headers are those of the original, but for its validator,
+	 * encoding and length, and we don't take ranges of it */
+	if (b) {
+		res->encoding = http_codings[i].encoding;
+		iov_push(&res->iovs, f->head, http_head_split(f, HTTP_HEAD_ETAG));
+		http_head_push(res, b, HTTP_HEAD_ETAG);
+		iov_push(&res->iovs, http_codings[i].header, strlen(http_codings[i].header));
+		iov_push(&res->iovs, HTTP_VARY_ENCODING, strlen(HTTP_VARY_ENCODING));
+		http_head_push(res, b, HTTP_HEAD_LENGTH);
+		iov_push(&res->iovs, CRLF, 2);
+	}
+	else {
+		b = f;
+		/* headers and contents straight from shared memory, in one write */
+		if (shm && (slot = shmcache_get(shm, filename, &f->sb, sv)) != -1) {
+			iov_push(&res->iovs, sv[0].iov_base, sv[0].iov_len);
+			if (vary) iov_push(&res->iovs, HTTP_VARY_ENCODING, strlen(HTTP_VARY_ENCODING));
+			iov_push(&res->iovs, CRLF, 2);
+			if (sv[1].iov_len) iov_push(&res->iovs, sv[1].iov_base, sv[1].iov_len);
+			if ((ret = http_flush(c, hc, res->iovs.iov, res->iovs.idx)) == -1)
+				req->close = 1;
+			else
+				res->len += (size_t)ret;
+			shmcache_release(shm, slot);
+			filecache_put(files, f);
+			return 0;
+		}
+		iov_push(&res->iovs, f->head, f->headlen);
+		if (vary) iov_push(&res->iovs, HTTP_VARY_ENCODING, strlen(HTTP_VARY_ENCODING));
+		iov_push(&res->iovs, CRLF, 2);
+	}
+	DEBUG("Sending %zu bytes", (size_t)b->sb.st_size);
+	setcork(c->sock, 1);
+
+	if (HTTP_TLS_TX(c) && b->sb.st_size && b->sb.st_size <= (off_t)sizeof rec) {
+		/* small enough to go out with the headers, in as few records as
+		 * it takes. Queued responses go out in the same write */
+		if (http_file_read(b, rec, b->sb.st_size, 0)) {
+			req->close = 1;
+			goto http_sendfile_free;
+		}
+		iov_push(&res->iovs, rec, b->sb.st_size);
+		if ((ret = http_flush(c, hc, res->iovs.iov, res->iovs.idx)) == -1)
+			req->close = 1;
+		else
+			res->len += (size_t)ret;
+	}
+	else {
+		/* queued responses go out in the same write as the headers */
+		if ((ret = http_flush(c, hc, res->iovs.iov, res->iovs.idx)) == -1) {
+			ERROR("error writing headers");
+			req->close = 1;
+			goto http_sendfile_free;
+		}
 		res->len += (size_t)ret;
-		res->code = HTTP_OK;
-		ret = 0;
+		if (http_sendfile_slice(c, res, b, 0, b->sb.st_size)) req->close = 1;
 	}
+	if (shm && b == f && !req->close)
+		shmcache_add(shm, filename, &f->sb, &(struct iovec){ f->head, f->headlen }, f->fd);
 http_sendfile_free:
-	if (map) munmap(map, sb.st_size);
-	close(f);
-	free(clen);
-	free(ctyp);
-	free(mime);
+	setcork(c->sock, 0);
+	if (b != f) filecache_put(files, b);
+	filecache_put(files, f);
 
-	return ret;
+	return 0;
+}
+
+/* path has no ".." segment to climb out of the directory it's appended to */
+static int http_path_safe(struct iovec *path)
+{
+	const char *p = path->iov_base;
+	const char *end = p + path->iov_len;
+	const char *seg;
+
+	for (seg = p; p <= end; p++) {
+		if (p == end || *p == '/') {
+			if (p - seg == 2 && seg[0] == '.' && seg[1] == '.') return 0;
+			seg = p + 1;
+		}
+	}
+	return 1;
 }
 
+/* map request uri to a file named by the matched config args, appending
+ * whatever the wildcard matched if args is a directory. Caller frees */
 static http_status_code_t
-http_response_static(conn_t *c, http_request_t *req, http_response_t *res)
+http_filename(http_request_t *req, http_response_t *res, char **filename)
 {
-	char *filename = NULL;
 	struct iovec trail;
 	size_t len;
 	size_t i;
-	int err = 0;
 
 	/* config missing args */
 	if (!res->uri[HTTP_ARGS].iov_len) return HTTP_INTERNAL_SERVER_ERROR;
@@ -714,38 +1846,91 @@ http_response_static(conn_t *c, http_request_t *req, http_response_t *res)
 		DEBUG("exact match: '%.*s'", FMTV(req->uri));
 		if (iovidx(res->uri[HTTP_ARGS], -1) == '/') /* directory */
 			return HTTP_INTERNAL_SERVER_ERROR;
-		filename = iovdup(&res->uri[HTTP_ARGS]);
+		*filename = iovdup(&res->uri[HTTP_ARGS]);
 	}
-	else if (!iovmatch(&res->uri[HTTP_PATH], &req->uri, 0)) {
+	else if (!iovglob(&res->uri[HTTP_PATH], &req->uri, 0, &i)) {
 		/* wildcard match */
 		DEBUG("wildcard match: '%.*s'", FMTV(req->uri));
 		if (iovidx(res->uri[HTTP_ARGS], -1) != '/') {
-			/* wildcard, but path points to file. Just serve the file */
-			filename = iovdup(&res->uri[HTTP_ARGS]);
-			goto sendnow;
+			/* wildcard, but path points to file. Just use the file */
+			*filename = iovdup(&res->uri[HTTP_ARGS]);
+			return (*filename) ? 0 : HTTP_INTERNAL_SERVER_ERROR;
 		}
 		/* wildcard match & path is a directory, append trailing chars */
-		i = iov_matchlen(&req->uri, &res->uri[HTTP_PATH]);
 		trail.iov_base = (char *)req->uri.iov_base + i;
 		trail.iov_len = req->uri.iov_len - i;
+		if (!http_path_safe(&trail)) return HTTP_FORBIDDEN;
 		len = snprintf(NULL, 0, "%.*s%.*s", FMTV(res->uri[HTTP_ARGS]), FMTV(trail));
-		filename = malloc(len + 1);
-		snprintf(filename, len + 1, "%.*s%.*s", FMTV(res->uri[HTTP_ARGS]), FMTV(trail));
+		if ((*filename = malloc(len + 1)))
+			snprintf(*filename, len + 1, "%.*s%.*s", FMTV(res->uri[HTTP_ARGS]), FMTV(trail));
 	}
 	else return HTTP_NOT_FOUND;
-	if (filename) {
-sendnow:
-		DEBUG("sending file '%s'", filename);
-		err = http_sendfile(c, filename, req, res);
+
+	return (*filename) ? 0 : HTTP_INTERNAL_SERVER_ERROR;
+}
+
+static http_status_code_t
+http_response_static(conn_t *c, http_conn_t *hc, http_request_t *req, http_response_t *res)
+{
+	char *filename = NULL;
+	int err;
+
+	if ((err = http_filename(req, res, &filename))) return err;
+	DEBUG("sending file '%s'", filename);
+	err = http_sendfile(c, hc, filename, req, res);
+	free(filename);
+
+	return err;
+}
+
+/* write request body to the file mapped from the uri, as http_filename().
+ * The body goes to a temporary file first, which replaces the target once
+ * complete, so a failed upload leaves nothing behind */
+static http_status_code_t
+http_response_upload(conn_t *c, http_conn_t *hc, http_request_t *req, http_response_t *res)
+{
+	struct stat sb;
+	char *filename = NULL;
+	char *tmpname = NULL;
+	int code, existed;
+	int fd;
+
+	if ((code = http_filename(req, res, &filename))) return code;
+	if (asprintf(&tmpname, "%s.XXXXXX", filename) == -1) {
 		free(filename);
+		return HTTP_INTERNAL_SERVER_ERROR;
+	}
+	if ((fd = mkstemp(tmpname)) == -1) {
+		ERROR("unable to create '%s': %s", tmpname, strerror(errno));
+		code = (errno == ENOENT) ? HTTP_NOT_FOUND
+		     : (errno == EACCES) ? HTTP_FORBIDDEN : HTTP_INTERNAL_SERVER_ERROR;
+		goto http_response_upload_free;
+	}
+	fchmod(fd, 0644);
+	existed = !stat(filename, &sb);
+	DEBUG("receiving file '%s'", filename);
+	if (http_body_sink(c, hc, req, fd)) {
+		/* can't tell where the next request starts */
+		req->close = 1;
+		code = HTTP_BAD_REQUEST;
+	}
+	if (close(fd) && !code) code = HTTP_INTERNAL_SERVER_ERROR;
+	if (!code && rename(tmpname, filename)) {
+		ERROR("unable to rename '%s': %s", tmpname, strerror(errno));
+		code = HTTP_INTERNAL_SERVER_ERROR;
 	}
+	if (code) unlink(tmpname);
+	else code = (existed) ? HTTP_OK : HTTP_CREATED;
+http_response_upload_free:
+	free(tmpname);
+	free(filename);
 
-	return err;
+	return code;
 }
 
 /* returning nonzero means the response has already been sent by the handler */
 static http_status_code_t
-http_response(conn_t *c, http_request_t *req, http_response_t *res)
+http_response(conn_t *c, http_conn_t *hc, http_request_t *req, http_response_t *res)
 {
 	http_status_code_t code = 0;
 	char *ptr;
@@ -754,6 +1939,7 @@ http_response(conn_t *c, http_request_t *req, http_response_t *res)
 		DEBUG("RESPONSE: response");
 		code = http_response_code(&res->uri[HTTP_ACTION], 8);
 		res->body = res->uri[HTTP_ARGS];
+		http_compress_body(req, res, &hc->z);
 	}
 	else if (!iovstrncmp(&res->uri[HTTP_ACTION], "redirect", 8)) {
 		code = http_response_code(&res->uri[HTTP_ACTION], 8);
@@ -778,11 +1964,15 @@ http_response(conn_t *c, http_request_t *req, http_response_t *res)
 	}
 	else if (!iovstrcmp(&res->uri[HTTP_ACTION], "static")) {
 		DEBUG("RESPONSE: static");
-		code = http_response_static(c, req, res);
+		code = http_response_static(c, hc, req, res);
+	}
+	else if (!iovstrcmp(&res->uri[HTTP_ACTION], "upload")) {
+		DEBUG("RESPONSE: upload");
+		code = http_response_upload(c, hc, req, res);
 	}
 	else if (!iovstrcmp(&res->uri[HTTP_ACTION], "echo")) {
 		DEBUG("RESPONSE: echo");
-		iovset(&res->body, buf, req->len);
+		iovcpy(&res->body, &req->head);
 		iov_pushs(&res->head, "Content-type: text-plain\r\n");
 		code = HTTP_OK;
 	}
@@ -795,50 +1985,49 @@ int conn(conn_t *c)
 {
 	http_response_t res = {0};
 	http_request_t req = {0};
+	http_conn_t hc = {0};
 	char status[128];
 	char clen[128];
-	char db[2];
-	char *cert = NULL;
-	char *key = NULL;
 	int err = 0;
-	WOLFSSL_CTX *ctx = NULL;
 
 	res.iovs.nmemb = IOVSIZE;
 	res.head.nmemb = IOVSIZE;
-	env = NULL; config_init_db(dbdir);
+
+	/* handlers are persistent, so open the env on first use and keep it */
+	pthread_mutex_lock(&env_mtx);
+	if (!env) config_init_db(dbdir);
+	if (!files) files = http_filecache_new();
+	if (compressmin == -1) http_compress_conf();
+	pthread_mutex_unlock(&env_mtx);
+	ws_proto = WS_PROTOCOL_INVALID;
 
 	/* handle TLS connection */
 	if (!strcmp(c->proto->module, "https")) {
-		/* Initialize wolfSSL */
-		wolfSSL_Init();
-		if ((ctx = wolfSSL_CTX_new(wolfSSLv23_server_method())) == NULL) {
-			ERROR("failed to create WOLFSSL_CTX");
-			goto conn_cleanup;
-		}
-		/* load certificate */
-		config_db(DB_GLOBAL, db);
-		config_get_s(db, "cert", &cert, NULL, 0);
-		config_get_s(db, "key", &key, NULL, 0);
-		if (wolfSSL_CTX_use_certificate_chain_file(ctx, cert) != SSL_SUCCESS) {
-			ERROR("failed to load cert: %s", cert);
-			goto conn_cleanup;
-		}
-		/* load private key */
-		if (wolfSSL_CTX_use_PrivateKey_file(ctx, key, SSL_FILETYPE_PEM) != SSL_SUCCESS) {
-			ERROR("failed to load key: %s", key);
+		if (!tls) {
+			ERROR("no TLS context, check cert and key");
 			goto conn_cleanup;
 		}
 		/* create new session */
-		if ((c->ssl = wolfSSL_new(ctx)) == NULL) {
+		if ((c->ssl = wolfSSL_new(tls)) == NULL) {
 			ERROR("failed to create WOLFSSL object");
 			goto conn_cleanup;
 		}
 		wolfSSL_set_fd(c->ssl, c->sock);
+		/* handshake now, rather than on first read, so the kernel can
+		 * take the records over before any request is read */
+		if (ktls) {
+			if (wolfSSL_accept(c->ssl) != SSL_SUCCESS) {
+				ERROR("TLS handshake failed");
+				goto conn_cleanup;
+			}
+			c->ktls = ktls_enable(c->sock, c->ssl);
+			DEBUG("ktls = %i", c->ktls);
+		}
 	}
 
 	loglevel = 127;
 
-	while (!req.close && http_ready(c->sock)) {
+	while (!req.close) {
 		DEBUG("ws_proto = %i", ws_proto);
 		if (ws_proto != WS_PROTOCOL_INVALID) {
 			DEBUG("Request on established websocket");
@@ -847,13 +2036,17 @@ int conn(conn_t *c)
 		}
 		memset(&req, 0, sizeof(http_request_t));
 		memset(&res, 0, sizeof(http_response_t));
-		err = http_request_read(c, &req, &res);
+		if ((err = http_request_read(c, &hc, &req)) == -1) {
+			err = 0; /* closed between requests */
+			break;
+		}
 		if (!err && req.upgrade.iov_len && !handler_upgrade_connection_check(&req)) {
+			if (http_flush(c, &hc, NULL, 0) == -1) break;
 			err = response_upgrade(c, &req);
 			continue;
 		}
 		if (!err) err = http_request_handle(c, &req, &res);
-		if (!err) err = http_response(c, &req, &res);
+		if (!err) err = http_response(c, &hc, &req, &res);
 		if (err) {
 			res.code = err;
 			iov_push(&res.iovs, status, http_status(status, err));
@@ -866,27 +2059,24 @@ int conn(conn_t *c)
 			}
 			iov_push(&res.iovs, CRLF, 2);
 			if (res.body.iov_len) iov_pushv(&res.iovs, &res.body);
-			err = http_response_send(c, &req, &res);
+			if (http_response_send(c, &hc, &res)) req.close = 1;
 		}
-		if (err > 0) res.code = err;
+		if (!req.close && http_body_discard(c, &hc, &req)) req.close = 1;
 		http_request_log(c, &req, &res);
 		iovs_clear(&res.iovs);
 		iovs_clear(&res.head);
 		DEBUG("request finished");
 		DEBUG("req.close=%i", req.close);
 	}
+	http_flush(c, &hc, NULL, 0);
 conn_cleanup:
-	free(key);
-	free(cert);
+	http_buf_free(&hc.in);
+	http_buf_free(&hc.out);
+	http_buf_free(&hc.body);
+	http_buf_free(&hc.z);
 	iovs_free(&res.iovs);
 	iovs_free(&res.head);
-	mdb_env_close(env); env = NULL;
-
-	if (!strcmp(c->proto->module, "https")) {
-		if (c->ssl) wolfSSL_free(c->ssl);
-		if (ctx) wolfSSL_CTX_free(ctx);
-		wolfSSL_Cleanup();
-	}
+	if (c->ssl) wolfSSL_free(c->ssl);
 
 	return err;
 }
@@ -919,6 +2109,9 @@ int load_uri(char *line, MDB_txn *txn)
 	char * ptr;
 	char * pp = pack;
 	char db_uri[16];
+	struct iovec route[HTTP_PARTS];
+	char *up;
+	int err = 0;
 
 	memset(pack, 0, sizeof(pack));
 
@@ -981,6 +2174,15 @@ int load_uri(char *line, MDB_txn *txn)
 	ptr = packstr(ptr, domain);
 	ptr = packstr(ptr, port);
 	ptr = packstr(ptr, path);
+
+	/* compile route, ready for conf() to swap in */
+	up = pack + 1;
+	for (int i = 0; i < HTTP_PARTS; i++) up = unpackiov(up, &route[i]);
+	if (!pending[(int)proto] && !(pending[(int)proto] = route_table_new()))
+		err = LSD_ERROR_NOMEM;
+	else if (route_add(pending[(int)proto], route))
+		err = LSD_ERROR_NOMEM;
+
 	k.mv_data = &uris;
 	k.mv_size = sizeof(size_t);
 	v.mv_data = pack;
@@ -990,21 +2192,358 @@ int load_uri(char *line, MDB_txn *txn)
 	free(host);
 	if (path != uri) free(path);
 
-	return 0;
+	return err;
+}
+static void http_tls_ctx_free(void *ctx)
+{
+	wolfSSL_CTX_free(ctx);
 }
+
 void finit(void)
 {
+	filecache_free(files);
+	files = NULL;
+	shmcache_free(shm);
+	shm = NULL;
+	free(compressdir);
+	compressdir = NULL;
+	compressmin = -1;
+	for (int i = 0; i < 2; i++) {
+		route_table_free(routes[i]);
+		route_table_free(pending[i]);
+		routes[i] = pending[i] = NULL;
+	}
+	wolfSSL_CTX_free(tls);
+	tls = NULL;
+	sni_free(snis, http_tls_ctx_free);
+	snis = NULL;
+	tlscache_free(tlsc);
+	tlsc = NULL;
+	wolfSSL_Cleanup();
+	mdb_env_close(env); env = NULL;
+}
+
+#ifdef HTTP_TLS_SHARED
+/* hash of the server name the client asked for, binding sessions and tickets
+ * to it. A session made for one name must not be resumed under another, or
+ * its host's certificate would go unchecked (RFC 6066, 3) */
+static uint64_t http_tls_host(WOLFSSL *ssl)
+{
+	void *name = NULL;
+	size_t len = 0;
+
+#ifdef HAVE_SNI
+	len = wolfSSL_SNI_GetRequest(ssl, WOLFSSL_SNI_HOST_NAME, &name);
+#else
+	(void)ssl;
+#endif
+	return hash_fnv1a64((name) ? name : "", (name) ? len : 0);
+}
+
+/* keep a new session where every handler can find it */
+static int http_tls_session_new(WOLFSSL *ssl, WOLFSSL_SESSION *sess)
+{
+	unsigned char data[TLSCACHE_DATA];
+	unsigned char *p = data;
+	const unsigned char *id;
+	unsigned int idlen;
+	int len;
+
+	id = wolfSSL_SESSION_get_id(sess, &idlen);
+	len = wolfSSL_i2d_SSL_SESSION(sess, NULL);
+	if (len > 0 && len <= (int)sizeof data && wolfSSL_i2d_SSL_SESSION(sess, &p) == len)
+		tlscache_add(tlsc, id, idlen, http_tls_host(ssl), data, len);
+	return 0; /* wolfSSL still owns sess */
+}
+
+static WOLFSSL_SESSION *http_tls_session_get(WOLFSSL *ssl, const unsigned char *id,
+		int idlen, int *copy)
+{
+	unsigned char data[TLSCACHE_DATA];
+	const unsigned char *p = data;
+	size_t len;
+
+	*copy = 0; /* wolfSSL frees what we return */
+	len = tlscache_get(tlsc, id, idlen, http_tls_host(ssl), data, sizeof data);
+	if (!len) return NULL;
+	return wolfSSL_d2i_SSL_SESSION(NULL, &p, (long)len);
+}
+
+static void http_tls_session_remove(WOLFSSL_CTX *ctx, WOLFSSL_SESSION *sess)
+{
+	const unsigned char *id;
+	unsigned int idlen;
+
+	(void)ctx;
+	id = wolfSSL_SESSION_get_id(sess, &idlen);
+	tlscache_remove(tlsc, id, idlen);
+}
+
+/* seal or open a session ticket with the key handlers share. A ticket under
+ * the key before is taken, but replaced */
+static int http_tls_ticket(WOLFSSL *ssl, unsigned char name[WOLFSSL_TICKET_NAME_SZ],
+		unsigned char iv[WOLFSSL_TICKET_IV_SZ], unsigned char mac[WOLFSSL_TICKET_MAC_SZ],
+		int enc, unsigned char *ticket, int len, int *outlen, void *arg)
+{
+	unsigned char aad[WOLFSSL_TICKET_NAME_SZ + WOLFSSL_TICKET_IV_SZ + 8 + 2];
+	unsigned char *p = aad;
+	uint64_t host = http_tls_host(ssl);
+	tlscache_key_t k;
+	int ret = WOLFSSL_TICKET_RET_OK;
+	int err;
+
+	(void)arg;
+	if (enc) {
+		if (tlscache_key_current(tlsc, &k)) return WOLFSSL_TICKET_RET_FATAL;
+		if (getrandom(iv, WOLFSSL_TICKET_IV_SZ, 0) != WOLFSSL_TICKET_IV_SZ) {
+			explicit_bzero(&k, sizeof k);
+			return WOLFSSL_TICKET_RET_FATAL;
+		}
+		memcpy(name, k.name, WOLFSSL_TICKET_NAME_SZ);
+	}
+	else {
+		switch (tlscache_key_find(tlsc, name, &k)) {
+		case -1:
+			return WOLFSSL_TICKET_RET_REJECT;
+		case 1:
+			ret = WOLFSSL_TICKET_RET_CREATE;
+		}
+	}
+	/* key name, iv, server name and length are authenticated with the
+	 * ticket, so one issued for another name won't open */
+	memcpy(p, name, WOLFSSL_TICKET_NAME_SZ);
+	p += WOLFSSL_TICKET_NAME_SZ;
+	memcpy(p, iv, WOLFSSL_TICKET_IV_SZ);
+	p += WOLFSSL_TICKET_IV_SZ;
+	for (int i = 7; i >= 0; i--) *p++ = (host >> (i * 8)) & 0xff;
+	*p++ = (len >> 8) & 0xff;
+	*p = len & 0xff;
+	if (enc)
+		err = wc_ChaCha20Poly1305_Encrypt(k.key, iv, aad, sizeof aad,
+				ticket, len, ticket, mac);
+	else
+		err = wc_ChaCha20Poly1305_Decrypt(k.key, iv, aad, sizeof aad,
+				ticket, len, mac, ticket);
+	explicit_bzero(&k, sizeof k);
+	if (err) return (enc) ? WOLFSSL_TICKET_RET_FATAL : WOLFSSL_TICKET_RET_REJECT;
+	*outlen = len;
+
+	return ret;
+}
+#endif /* HTTP_TLS_SHARED */
+
+/* new context with cert and key, if any, sharing sessions through tlsc */
+static WOLFSSL_CTX *http_tls_ctx_new(const char *cert, const char *key)
+{
+	WOLFSSL_CTX *ctx;
+
+	if ((ctx = wolfSSL_CTX_new(wolfSSLv23_server_method())) == NULL) {
+		ERROR("failed to create WOLFSSL_CTX");
+		return NULL;
+	}
+	/* load certificate */
+	if (cert && wolfSSL_CTX_use_certificate_chain_file(ctx, cert) != SSL_SUCCESS) {
+		ERROR("failed to load cert: %s", cert);
+		wolfSSL_CTX_free(ctx);
+		return NULL;
+	}
+	/* load private key */
+	if (key && wolfSSL_CTX_use_PrivateKey_file(ctx, key, SSL_FILETYPE_PEM) != SSL_SUCCESS) {
+		ERROR("failed to load key: %s", key);
+		wolfSSL_CTX_free(ctx);
+		return NULL;
+	}
+#ifdef HTTP_TLS_SHARED
+	if (tlsc) {
+		wolfSSL_CTX_set_session_cache_mode(ctx, WOLFSSL_SESS_CACHE_NO_INTERNAL);
+		wolfSSL_CTX_sess_set_new_cb(ctx, http_tls_session_new);
+		wolfSSL_CTX_sess_set_get_cb(ctx, http_tls_session_get);
+		wolfSSL_CTX_sess_set_remove_cb(ctx, http_tls_session_remove);
+		wolfSSL_CTX_set_timeout(ctx, TLSCACHE_TIMEOUT);
+		wolfSSL_CTX_set_TicketEncCb(ctx, http_tls_ticket);
+		wolfSSL_CTX_set_TicketHint(ctx, TLSCACHE_TIMEOUT);
+	}
+#endif
+	return ctx;
+}
+
+#ifdef HTTP_TLS_SNI
+/* host's context, built on first use. One that won't load isn't tried again
+ * until the config is reloaded */
+static WOLFSSL_CTX *http_tls_sni_ctx(sni_host_t *h)
+{
+	pthread_mutex_lock(&sni_mtx);
+	if (!h->ctx && !h->failed && !(h->ctx = http_tls_ctx_new(h->cert, h->key)))
+		h->failed = 1;
+	pthread_mutex_unlock(&sni_mtx);
+	return h->ctx;
+}
+
+static int http_tls_sni_load(sni_host_t *h, void *arg)
+{
+	(void)arg;
+	http_tls_sni_ctx(h);
+	return 0;
+}
+
+/* switch the connection to the context for the host the client named. Any
+ * other name gets the default cert */
+static int http_tls_sni(WOLFSSL *ssl, int *ret, void *arg)
+{
+	const char *name;
+	sni_host_t *h;
+	WOLFSSL_CTX *ctx;
+
+	(void)ret; (void)arg;
+	name = wolfSSL_get_servername(ssl, WOLFSSL_SNI_HOST_NAME);
+	if (name && (h = sni_find(snis, name)) && (ctx = http_tls_sni_ctx(h)))
+		wolfSSL_set_SSL_CTX(ssl, ctx);
+	return SSL_TLSEXT_ERR_OK;
 }
+#endif /* HTTP_TLS_SNI */
 
-/* load/reload config */
+/* per host certs from the sni lines, or NULL if there are none. Call with
+ * env open */
+static sni_t *http_tls_sni_conf(void)
+{
+	config_iter_t it;
+	MDB_val key, val;
+	sni_t *sni;
+	char db[2];
+
+	if (!(sni = sni_new())) return NULL;
+	if (config_iter_open(&it, config_db(DB_SNI, db))) return sni;
+	while (config_iter_next(&it, &key, &val) == CONFIG_NEXT) {
+		if (sni_add(sni, val.mv_data, val.mv_size))
+			ERROR("bad sni line: %.*s", (int)val.mv_size, (char *)val.mv_data);
+	}
+	config_iter_close(&it);
+	if (!sni_count(sni)) {
+		sni_free(sni, NULL);
+		return NULL;
+	}
+	return sni;
+}
+
+/* build the TLS contexts from cert and key, and the sni lines. A cert or key
+ * that won't load leaves the default context we had, so a bad reload doesn't
+ * take https down. Without cert and key, only clients naming an sni host can
+ * connect */
+static void http_tls_conf(void)
+{
+	WOLFSSL_CTX *ctx;
+	sni_t *sni;
+	char *cert = NULL;
+	char *key = NULL;
+	char db[2];
+	int sessions = TLSCACHE_SIZE;
+
+	/* the env mustn't outlive the fork, so open it just long enough */
+	config_init_db(dbdir);
+	config_db(DB_GLOBAL, db);
+	config_get_s(db, "cert", &cert, NULL, 0);
+	config_get_s(db, "key", &key, NULL, 0);
+	config_get_int(db, "ktls", &ktls, NULL, 0);
+	config_get_int(db, "tlscache", &sessions, NULL, 0);
+	sni = http_tls_sni_conf();
+	mdb_env_close(env); env = NULL;
+#ifndef HTTP_TLS_SNI
+	if (sni) {
+		ERROR("sni lines ignored: wolfSSL built without --enable-sni or opensslextra");
+		sni_free(sni, NULL);
+		sni = NULL;
+	}
+#endif
+	if ((!cert || !key) && !sni) goto http_tls_conf_free;
+
+	/* made once, so sessions and ticket keys outlive a reload */
+	if (!tlsc && sessions) {
+#ifdef HTTP_TLS_SHARED
+		tlsc = tlscache_new(sessions, TLSCACHE_TIMEOUT, TLSCACHE_KEY_LIFETIME);
+		if (!tlsc) ERROR("unable to create TLS session cache");
+#else
+		DEBUG("no shared TLS sessions: wolfSSL built without session tickets or external cache");
+#endif
+	}
+
+	if (!(ctx = http_tls_ctx_new((key) ? cert : NULL, (cert) ? key : NULL)))
+		goto http_tls_conf_free;
+	sni_free(snis, http_tls_ctx_free);
+	snis = sni;
+	sni = NULL;
+#ifdef HTTP_TLS_SNI
+	if (snis) {
+		if (sni_count(snis) <= HTTP_SNI_PRELOAD) sni_each(snis, http_tls_sni_load, NULL);
+		wolfSSL_CTX_set_servername_callback(ctx, http_tls_sni);
+		DEBUG("%zu sni hosts", sni_count(snis));
+	}
+#endif
+	wolfSSL_CTX_free(tls);
+	tls = ctx;
+http_tls_conf_free:
+	sni_free(sni, NULL);
+	free(key);
+	free(cert);
+}
+
+/* load/reload config. Called in the controller once the uri lines have all
+ * been through load_uri(), so handlers forked afterwards share the tables */
 int conf(void)
 {
+	http_tls_conf();
+	for (int i = 0; i < 2; i++) {
+		route_table_free(routes[i]);
+		routes[i] = pending[i];
+		pending[i] = NULL;
+		DEBUG("%s: %zu routes", (i) ? "https" : "http",
+				(routes[i]) ? route_count(routes[i]) : 0);
+	}
 	return 0;
 }
 
+/* create the shared file cache, so every handler inherits the same mapping.
+ * Called in the controller before the pool forks, perhaps more than once */
+int warmup(void)
+{
+	int mib = 0;
+	char db[2];
+
+	if (shm) return 0;
+	/* the env mustn't outlive the fork, so open it just long enough */
+	config_init_db(dbdir);
+	config_db(DB_GLOBAL, db);
+	config_get_int(db, "shmcache", &mib, NULL, 0);
+	mdb_env_close(env); env = NULL;
+	if (!mib) return 0;
+	if (!(shm = shmcache_new((size_t)mib * 1048576)))
+		FAIL(LSD_ERROR_NOMEM);
+	DEBUG("shared cache of %zu small files", shmcache_slots(shm));
+	return 0;
+}
+
+/* drop the shared cache pins a dead handler left behind */
+void reap(pid_t pid)
+{
+	if (shm) shmcache_reap(shm, pid);
+}
+
 /* initialize */
 int init(char *dbname)
 {
 	dbdir = dbname;
-	return 0;
+	wolfSSL_Init();
+	return http_header_init();
 }
+
+lsd_module_ops_t lsd_module = {
+	.version	= LSD_MODULE_ABI_VERSION,
+	.flags		= LSD_MODULE_THREADSAFE | LSD_MODULE_WARMUP,
+	.name		= "http",
+	.init		= init,
+	.conf		= conf,
+	.warmup		= warmup,
+	.conn		= conn,
+	.load_uri	= load_uri,
+	.finit		= finit,
+	.reap		= reap,
+};
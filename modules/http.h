@@ -32,6 +32,9 @@
 #define HTTP_METHOD_MAX 8	/* maximum length of HTTP method */
 #define HTTP_URI_MAX 4096	/* maximum length of HTTP uri */
 #define HTTP_VERSION_MAX 9	/* maximum length of HTTP uri */
+#define HTTP_REQUEST_MAX 65536	/* most bytes of request line and headers we buffer */
+#define HTTP_OUTPUT_MAX 65536	/* flush pipelined responses once this many are queued */
+#define HTTP_PARSE_MORE -1	/* http_request_parse() needs more data */
 #define CRLF "\r\n"
 
 #define HTTP_CODES(X) \
@@ -48,6 +51,7 @@
 	X(301,	HTTP_MOVED_PERMANENTLY,		"Moved Permanently") \
 	X(302,	HTTP_FOUND,			"Found") \
 	X(303,	HTTP_SEE_OTHER,			"See Other") \
+	X(304,	HTTP_NOT_MODIFIED,		"Not Modified") \
 	X(400,	HTTP_BAD_REQUEST,		"Bad Request") \
 	X(401,	HTTP_UNAUTHORIZED,		"Unauthorized") \
 	X(402,	HTTP_PAYMENT_REQUIRED,		"Payment Required") \
@@ -68,6 +72,7 @@
 	X(417,	HTTP_EXPECTATION_FAILED,	"Expectation Failed") \
 	X(418,	HTTP_TEAPOT,			"I am a teapot") \
 	X(419,	HTTP_UNAVAILABLE_LEGAL,		"Unavailable for Legal Reasons") \
+	X(431,	HTTP_HEADERS_TOO_LARGE,		"Request Header Fields Too Large") \
 	X(500,	HTTP_INTERNAL_SERVER_ERROR,	"Internal Server Error") \
 	X(501,	HTTP_NOT_IMPLEMENTED,		"Not Implemented") \
 	X(502,	HTTP_BAD_GATEWAY,		"Bad Gateway") \
@@ -86,8 +91,43 @@ typedef enum {
 	HTTP_ENCODING_NONE		= 0,
 	HTTP_ENCODING_GZIP		= 1,
 	HTTP_ENCODING_DEFLATE		= 2,
+	HTTP_ENCODING_BR		= 3,
 } http_encoding_t;
 
+/* request headers we act on. Each is stored in its http_request_t field.
+ * Names are hashed by http_header_id(), which must stay collision free */
+#define HTTP_HEADERS(X) \
+	X(HTTP_HEADER_HOST,		"Host",				host) \
+	X(HTTP_HEADER_ACCEPT,		"Accept",			accept) \
+	X(HTTP_HEADER_ACCEPT_ENCODING,	"Accept-Encoding",		encoding) \
+	X(HTTP_HEADER_ACCEPT_LANGUAGE,	"Accept-Language",		lang) \
+	X(HTTP_HEADER_CACHE_CONTROL,	"Cache-Control",		cache) \
+	X(HTTP_HEADER_CONNECTION,	"Connection",			connection) \
+	X(HTTP_HEADER_CONTENT_LENGTH,	"Content-Length",		contentlength) \
+	X(HTTP_HEADER_EXPECT,		"Expect",			expect) \
+	X(HTTP_HEADER_IF_MODIFIED_SINCE, "If-Modified-Since",		ifmodifiedsince) \
+	X(HTTP_HEADER_IF_NONE_MATCH,	"If-None-Match",		ifnonematch) \
+	X(HTTP_HEADER_IF_RANGE,		"If-Range",			ifrange) \
+	X(HTTP_HEADER_RANGE,		"Range",			range) \
+	X(HTTP_HEADER_REFERER,		"Referer",			referrer) \
+	X(HTTP_HEADER_REFERRER,		"Referrer",			referrer) \
+	X(HTTP_HEADER_WS_EXTENSIONS,	"Sec-WebSocket-Extensions",	secwebsocketextensions) \
+	X(HTTP_HEADER_WS_KEY,		"Sec-WebSocket-Key",		secwebsocketkey) \
+	X(HTTP_HEADER_WS_PROTOCOL,	"Sec-WebSocket-Protocol",	secwebsocketprotocol) \
+	X(HTTP_HEADER_WS_VERSION,	"Sec-WebSocket-Version",	secwebsocketversion) \
+	X(HTTP_HEADER_TRANSFER_ENCODING, "Transfer-Encoding",		transferencoding) \
+	X(HTTP_HEADER_UPGRADE,		"Upgrade",			upgrade) \
+	X(HTTP_HEADER_UPGRADE_INSECURE,	"Upgrade-Insecure-Requests",	upgradeinsecure) \
+	X(HTTP_HEADER_USER_AGENT,	"User-Agent",			useragent)
+#undef X
+
+#define HTTP_HEADER_ENUM(id, name, field) id,
+typedef enum {
+	HTTP_HEADERS(HTTP_HEADER_ENUM)
+	HTTP_HEADER_UNKNOWN	/* also the count of known headers */
+} http_header_t;
+#define HTTP_HEADER_SLOTS 64	/* size of header hash, power of two */
+
 enum {
 	HTTP_METHOD,
 	HTTP_ACTION,
@@ -99,6 +139,45 @@ enum {
 	HTTP_PARTS,	/* count items in enum */
 };
 
+typedef enum {
+	HTTP_PARSE_LINE,		/* looking for request line */
+	HTTP_PARSE_HEADERS,		/* reading header lines */
+} http_parse_state_t;
+
+/* request parser state, kept between reads so a partial request is never
+ * scanned twice. Offsets are from the start of the request */
+typedef struct http_parser_s http_parser_t;
+struct http_parser_s {
+	http_parse_state_t state;
+	size_t start;			/* first byte of request line */
+	size_t off;			/* first byte of current line */
+	size_t scan;			/* bytes searched for end of line so far */
+};
+
+typedef enum {
+	HTTP_BODY_DONE,			/* no body, or all of it read */
+	HTTP_BODY_LENGTH,		/* Content-Length bytes */
+	HTTP_BODY_CHUNK_SIZE,		/* chunked: size line */
+	HTTP_BODY_CHUNK_DATA,		/* chunked: chunk bytes */
+	HTTP_BODY_CHUNK_CRLF,		/* chunked: CRLF after chunk */
+	HTTP_BODY_TRAILER,		/* chunked: trailer lines */
+} http_body_state_t;
+
+/* request body decoder */
+typedef struct http_body_s http_body_t;
+struct http_body_s {
+	http_body_state_t state;
+	size_t left;			/* bytes left of body or chunk */
+};
+
+#define HTTP_RANGES_MAX 16	/* requests for more byte ranges are sent the whole file */
+
+typedef struct http_range_s http_range_t;
+struct http_range_s {
+	off_t off;
+	off_t len;
+};
+
 typedef struct http_request_s http_request_t;
 struct http_request_s {
 	struct iovec httpv;             /* HTTP version */
@@ -110,19 +189,30 @@ struct http_request_s {
 	struct iovec lang;		/* Accept-Language */
 	struct iovec cache;		/* Cache-Control */
 	struct iovec connection;	/* Connection */
+	struct iovec contentlength;	/* Content-Length */
+	struct iovec expect;		/* Expect */
+	struct iovec ifmodifiedsince;	/* If-Modified-Since */
+	struct iovec ifnonematch;	/* If-None-Match */
+	struct iovec ifrange;		/* If-Range */
+	struct iovec transferencoding;	/* Transfer-Encoding */
+	struct iovec range;		/* Range */
 	struct iovec referrer;		/* Referrer */
 	struct iovec secwebsocketextensions;	/* Sec-WebSocket-Extensions */
 	struct iovec secwebsocketkey;		/* Sec-WebSocket-Key */
 	struct iovec secwebsocketprotocol;	/* Sec-WebSocket-Protocol */
 	struct iovec secwebsocketversion;	/* Sec-WebSocket-Version */
 	struct iovec upgrade;		/* Upgrade */
+	struct iovec upgradeinsecure;	/* Upgrade-Insecure-Requests */
 	struct iovec useragent;		/* User-Agent */
-	size_t len;                     /* bytes recv()'d */
+	struct iovec head;		/* request line and headers, as received */
+	http_body_t body;		/* body still to be read */
+	size_t len;                     /* bytes of buffer used by request */
 	time_t t;			/* timestamp so we have one consistent one to use */
 	char upsec;			/* Upgrade-Insecure-Requests */
 	char close;                     /* Connection: close */
 	char conn_keepalive;		/* Connection: keep-alive */
 	char conn_upgrade;		/* Connection: upgrade */
+	char continued;			/* sent 100 Continue */
 };
 
 typedef struct http_response_s http_response_t;
@@ -138,6 +228,42 @@ struct http_response_s {
 
 char *http_phrase(http_status_code_t code);
 
+/* build header hash. Returns -1 if two names in HTTP_HEADERS collide */
+int http_header_init(void);
+
+/* look up request header by name, ignoring case. Returns HTTP_HEADER_UNKNOWN
+ * for headers we don't act on */
+http_header_t http_header_id(struct iovec *name);
+
+/* parse request in data[0..len), which http_request_parse() may be called on
+ * again with more bytes appended, until it returns 0 for a complete request
+ * (req->len bytes long), or an http_status_code_t on error. Returns
+ * HTTP_PARSE_MORE if the request is incomplete. req fields point into data */
+int http_request_parse(http_parser_t *p, http_request_t *req, char *data, size_t len);
+
+/* decode body bytes from data[0..len). chunk is set to the body bytes found
+ * in data, if any, and framing is skipped. Returns bytes of data used, which is
+ * 0 if more are needed, or -1 if the body is malformed. b->state is
+ * HTTP_BODY_DONE once the body is complete */
+ssize_t http_body_parse(http_body_t *b, char *data, size_t len, struct iovec *chunk);
+
+/* parse Range header for a file of size bytes, filling in up to
+ * HTTP_RANGES_MAX ranges. Returns the number of ranges, 0 if none can be
+ * satisfied, or -1 if the header is malformed or to be ignored */
+int http_range_parse(struct iovec *hdr, off_t size, http_range_t *r);
+
+/* entity tag etag, quotes and all, is in list, an If-None-Match or If-Range
+ * value. Weak tags match their strong twins unless strong is set */
+int http_etag_match(struct iovec *list, struct iovec *etag, int strong);
+
+/* parse HTTP-date, in any of the three formats of RFC 7231 7.1.1.1. Returns
+ * -1 if invalid */
+time_t http_date_parse(struct iovec *date);
+
+/* weight, in thousandths, an Accept-Encoding header gives content coding.
+ * Returns 0 if the coding is not acceptable, as it is with no header at all */
+int http_accept_encoding(struct iovec *ae, const char *coding);
+
 /* set TCP cork */
 int setcork(int sock, int state);
 
@@ -165,6 +291,12 @@ int conf();
 /* finalize */
 void finit();
 
+/* prepare anything handlers share, before they are forked */
+int warmup(void);
+
+/* drop what handler pid held in shared memory, once it has exited */
+void reap(pid_t pid);
+
 /* initialize */
 int init(char *dbname);
 
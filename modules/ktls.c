@@ -0,0 +1,151 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ *
+ * ktls.c
+ *
+ * this file is part of LIBRESTACK
+ *
+ * Copyright (c) 2012-2020 Brett Sheffield <bacs@librecast.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program (see the file COPYING in the distribution).
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "ktls.h"
+
+#ifdef USE_KTLS
+#ifndef ATOMIC_USER
+#error "USE_KTLS needs wolfSSL configured with --enable-atomicuser"
+#endif
+#include <linux/tls.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#ifndef SOL_TLS
+#define SOL_TLS 282
+#endif
+#ifndef TCP_ULP
+#define TCP_ULP 31
+#endif
+
+typedef union {
+	struct tls12_crypto_info_aes_gcm_128	gcm128;
+	struct tls12_crypto_info_aes_gcm_256	gcm256;
+#ifdef TLS_CIPHER_CHACHA20_POLY1305
+	struct tls12_crypto_info_chacha20_poly1305 chacha;
+#endif
+} ktls_crypto_t;
+
+/* one direction's keys, as wolfSSL has them */
+typedef struct {
+	const unsigned char	*key;
+	const unsigned char	*iv;
+	word64			seq;
+} ktls_keys_t;
+
+/* sequence number, big endian */
+static void ktls_seq(unsigned char out[8], word64 seq)
+{
+	for (int i = 7; i >= 0; i--, seq >>= 8) out[i] = seq & 0xff;
+}
+
+/* salt is the implicit part of the nonce, iv the rest. TLS 1.2 AES-GCM
+ * sends that part with each record, and the kernel counts it up from
+ * whatever it is given, so it starts from the sequence number */
+#define KTLS_CRYPTO(ci, cipher, explicit) do {					\
+	(ci).info.version = version;						\
+	(ci).info.cipher_type = (cipher);					\
+	memcpy((ci).key, k->key, sizeof (ci).key);				\
+	memcpy((ci).salt, k->iv, sizeof (ci).salt);				\
+	if (explicit) ktls_seq((ci).iv, k->seq);				\
+	else memcpy((ci).iv, k->iv + sizeof (ci).salt, sizeof (ci).iv);		\
+	ktls_seq((ci).rec_seq, k->seq);						\
+} while (0)
+
+/* fill in ci for the kernel. Returns its size, or 0 if the kernel can't
+ * take this protocol version or cipher */
+static socklen_t ktls_crypto(WOLFSSL *ssl, ktls_keys_t *k, ktls_crypto_t *ci)
+{
+	unsigned short version;
+
+	memset(ci, 0, sizeof(ktls_crypto_t));
+	switch (wolfSSL_version(ssl)) {
+	case TLS1_2_VERSION:
+		version = TLS_1_2_VERSION;
+		break;
+	case TLS1_3_VERSION:
+		version = TLS_1_3_VERSION;
+		break;
+	default:
+		return 0;
+	}
+	switch (wolfSSL_GetBulkCipher(ssl)) {
+	case wolfssl_aes_gcm:
+		if (wolfSSL_GetKeySize(ssl) == TLS_CIPHER_AES_GCM_128_KEY_SIZE) {
+			KTLS_CRYPTO(ci->gcm128, TLS_CIPHER_AES_GCM_128, version == TLS_1_2_VERSION);
+			return sizeof ci->gcm128;
+		}
+		if (wolfSSL_GetKeySize(ssl) == TLS_CIPHER_AES_GCM_256_KEY_SIZE) {
+			KTLS_CRYPTO(ci->gcm256, TLS_CIPHER_AES_GCM_256, version == TLS_1_2_VERSION);
+			return sizeof ci->gcm256;
+		}
+		break;
+#ifdef TLS_CIPHER_CHACHA20_POLY1305
+	case wolfssl_chacha:
+		KTLS_CRYPTO(ci->chacha, TLS_CIPHER_CHACHA20_POLY1305, 0);
+		return sizeof ci->chacha;
+#endif
+	}
+	return 0;
+}
+
+int ktls_enable(int sock, WOLFSSL *ssl)
+{
+	ktls_crypto_t tx, rx;
+	ktls_keys_t k;
+	socklen_t txlen, rxlen = 0;
+	int ret = 0;
+
+	/* we are the server, so write with the server's keys */
+	k.key = wolfSSL_GetServerWriteKey(ssl);
+	k.iv = wolfSSL_GetServerWriteIV(ssl);
+	if (!k.key || !k.iv || wolfSSL_GetSequenceNumber(ssl, &k.seq) < 0) return 0;
+	if (!(txlen = ktls_crypto(ssl, &k, &tx))) return 0;
+
+	/* wolfSSL may have read the start of the first request already */
+	k.key = wolfSSL_GetClientWriteKey(ssl);
+	k.iv = wolfSSL_GetClientWriteIV(ssl);
+	if (k.key && k.iv && !wolfSSL_has_pending(ssl)
+	&& wolfSSL_GetPeerSequenceNumber(ssl, &k.seq) >= 0)
+		rxlen = ktls_crypto(ssl, &k, &rx);
+
+	/* without the tls module, or the cipher, the socket is left as it was */
+	if (setsockopt(sock, SOL_TCP, TCP_ULP, "tls", sizeof "tls")) goto ktls_enable_done;
+	if (setsockopt(sock, SOL_TLS, TLS_TX, &tx, txlen)) goto ktls_enable_done;
+	ret |= KTLS_TX;
+	if (rxlen && !setsockopt(sock, SOL_TLS, TLS_RX, &rx, rxlen)) ret |= KTLS_RX;
+ktls_enable_done:
+	explicit_bzero(&tx, sizeof tx);
+	explicit_bzero(&rx, sizeof rx);
+	return ret;
+}
+#else
+int ktls_enable(int sock, WOLFSSL *ssl)
+{
+	(void)sock; (void)ssl;
+	return 0;
+}
+#endif
@@ -0,0 +1,47 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ *
+ * ktls.h
+ *
+ * this file is part of LIBRESTACK
+ *
+ * Copyright (c) 2012-2020 Brett Sheffield <bacs@librecast.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program (see the file COPYING in the distribution).
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __LSD_KTLS_H
+#define __LSD_KTLS_H 1
+
+#include "../src/config.h"
+
+/* kernel TLS.
+ *
+ * Once wolfSSL has done the handshake, the record keys and sequence numbers
+ * are handed to the kernel, which then encrypts what is written to the
+ * socket and decrypts what is read from it. Files can then go out with
+ * sendfile(), and responses with a plain writev(). Only AES-GCM and
+ * ChaCha20-Poly1305 under TLS 1.2 and 1.3 can be offloaded, and only where
+ * lsd is built with USE_KTLS and the kernel has the tls module */
+
+#define KTLS_TX 0x1	/* kernel encrypts what we write */
+#define KTLS_RX 0x2	/* kernel decrypts what we read */
+
+/* offload records on sock to the kernel, once ssl's handshake is done.
+ * Returns which directions were offloaded, as KTLS_TX | KTLS_RX, or 0 if
+ * neither was and wolfSSL carries on as before. Reads are only offloaded
+ * along with writes, and not if wolfSSL has already read past the
+ * handshake */
+int ktls_enable(int sock, WOLFSSL *ssl);
+
+#endif /* __LSD_KTLS_H */
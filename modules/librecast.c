@@ -692,9 +692,9 @@ int lcast_cmd_noop(conn_t *c, lcast_frame_t *req, char *payload)
 
 int lcast_cmd_handler(conn_t *c, ws_frame_t *f)
 {
-	static char *stash = NULL;
+	static __thread char *stash = NULL;
 	char *payload = NULL;
-	static uint64_t len = 0;
+	static __thread uint64_t len = 0;
 	char *data = (char *)(f->data) + sizeof(lcast_frame_t);
 	lcast_frame_t *req = NULL;
 
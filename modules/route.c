@@ -0,0 +1,358 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ *
+ * route.c
+ *
+ * this file is part of LIBRESTACK
+ *
+ * Copyright (c) 2012-2020 Brett Sheffield <bacs@librecast.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program (see the file COPYING in the distribution).
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "route.h"
+#include "../src/hash.h"
+#include "../src/iov.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ROUTE_HOSTS 16 /* initial size of host hash, doubles as it fills */
+
+/* methods with their own tree. Any other method shares the last one, and
+ * is compared in full */
+#define ROUTE_METHODS(X) \
+	X("GET") X("HEAD") X("POST") X("PUT") X("DELETE") \
+	X("CONNECT") X("OPTIONS") X("TRACE") X("PATCH")
+#define ROUTE_METHOD_COUNT(m) + 1
+#define ROUTE_METHOD_OTHER (0 ROUTE_METHODS(ROUTE_METHOD_COUNT))
+#define ROUTE_METHOD_STR(m) m,
+
+typedef struct route_s route_t;
+struct route_s {
+	struct iovec	uri[HTTP_PARTS];	/* parts of uri line */
+	iovglob_t	path;			/* compiled uri[HTTP_PATH] */
+	size_t		n;			/* position in config, lowest wins */
+	char		data[];			/* copies uri points into */
+};
+
+typedef struct route_node_s route_node_t;
+struct route_node_s {
+	const char *	label;		/* path bytes on edge from parent */
+	size_t		len;
+	route_node_t **	child;		/* at most one per first byte of label */
+	size_t		children;
+	route_t **	exact;		/* literal paths ending here, in order */
+	size_t		exacts;
+	route_t **	glob;		/* patterns with this literal prefix, in order */
+	size_t		globs;
+};
+
+typedef struct route_host_s route_host_t;
+struct route_host_s {
+	const char *	name;		/* Host header to match */
+	size_t		len;
+	uint32_t	methods;	/* bitmask of trees below */
+	route_node_t *	tree[ROUTE_METHOD_OTHER + 1];
+	route_host_t *	next;		/* hash chain */
+};
+
+struct route_table_s {
+	route_host_t	any;		/* routes without a host */
+	route_host_t **	host;		/* hash of hosts */
+	size_t		hosts;
+	size_t		buckets;
+	route_t **	route;		/* all routes, in order */
+	size_t		routes;
+};
+
+static const char *route_method_name[] = { ROUTE_METHODS(ROUTE_METHOD_STR) };
+
+static int route_method(struct iovec *method)
+{
+	for (int i = 0; i < ROUTE_METHOD_OTHER; i++) {
+		if (strlen(route_method_name[i]) == method->iov_len
+		&& !memcmp(route_method_name[i], method->iov_base, method->iov_len))
+			return i;
+	}
+	return ROUTE_METHOD_OTHER;
+}
+
+static int route_push(route_t ***list, size_t *n, route_t *r)
+{
+	route_t **tmp;
+	if (!(tmp = realloc(*list, (*n + 1) * sizeof(route_t *)))) return -1;
+	*list = tmp;
+	(*list)[(*n)++] = r;
+	return 0;
+}
+
+static route_node_t *route_node_new(const char *label, size_t len)
+{
+	route_node_t *node = calloc(1, sizeof(route_node_t));
+	if (node) {
+		node->label = label;
+		node->len = len;
+	}
+	return node;
+}
+
+static int route_node_attach(route_node_t *parent, route_node_t *child)
+{
+	route_node_t **tmp;
+	size_t n = parent->children + 1;
+	if (!(tmp = realloc(parent->child, n * sizeof(route_node_t *)))) return -1;
+	parent->child = tmp;
+	parent->child[parent->children++] = child;
+	return 0;
+}
+
+static route_node_t *route_node_child(route_node_t *node, char c)
+{
+	for (size_t i = 0; i < node->children; i++) {
+		if (node->child[i]->label[0] == c) return node->child[i];
+	}
+	return NULL;
+}
+
+/* return node for literal prefix key, creating and splitting nodes as needed */
+static route_node_t *route_node_insert(route_node_t *node, const char *key, size_t len)
+{
+	route_node_t *c, *mid;
+	size_t common;
+
+	while (len) {
+		if (!(c = route_node_child(node, *key))) {
+			if (!(c = route_node_new(key, len))) return NULL;
+			if (route_node_attach(node, c)) { free(c); return NULL; }
+			return c;
+		}
+		for (common = 0; common < c->len && common < len; common++) {
+			if (c->label[common] != key[common]) break;
+		}
+		if (common < c->len) {
+			/* split edge, putting mid between node and c */
+			if (!(mid = route_node_new(c->label, common))) return NULL;
+			if (route_node_attach(mid, c)) { free(mid); return NULL; }
+			for (size_t i = 0; i < node->children; i++) {
+				if (node->child[i] == c) node->child[i] = mid;
+			}
+			c->label += common;
+			c->len -= common;
+			c = mid;
+		}
+		node = c;
+		key += common;
+		len -= common;
+	}
+	return node;
+}
+
+static void route_node_free(route_node_t *node)
+{
+	if (!node) return;
+	for (size_t i = 0; i < node->children; i++) route_node_free(node->child[i]);
+	free(node->child);
+	free(node->exact);
+	free(node->glob);
+	free(node);
+}
+
+static route_host_t *route_host_find(route_table_t *t, const char *name, size_t len)
+{
+	route_host_t *h;
+	if (!t->buckets) return NULL;
+	for (h = t->host[hash_fnv1a(name, len) & (t->buckets - 1)]; h; h = h->next) {
+		if (h->len == len && !memcmp(h->name, name, len)) return h;
+	}
+	return NULL;
+}
+
+static route_host_t *route_host_get(route_table_t *t, const char *name, size_t len)
+{
+	route_host_t *h, **tmp;
+	size_t b;
+
+	if ((h = route_host_find(t, name, len))) return h;
+	if (t->hosts >= t->buckets) {
+		size_t n = (t->buckets) ? t->buckets * 2 : ROUTE_HOSTS;
+		if (!(tmp = calloc(n, sizeof(route_host_t *)))) return NULL;
+		for (size_t i = 0; i < t->buckets; i++) {
+			while ((h = t->host[i])) {
+				t->host[i] = h->next;
+				b = hash_fnv1a(h->name, h->len) & (n - 1);
+				h->next = tmp[b];
+				tmp[b] = h;
+			}
+		}
+		free(t->host);
+		t->host = tmp;
+		t->buckets = n;
+	}
+	if (!(h = calloc(1, sizeof(route_host_t)))) return NULL;
+	h->name = name;
+	h->len = len;
+	b = hash_fnv1a(name, len) & (t->buckets - 1);
+	h->next = t->host[b];
+	t->host[b] = h;
+	t->hosts++;
+
+	return h;
+}
+
+static int route_host_add(route_host_t *h, route_t *r)
+{
+	struct iovec *path = &r->uri[HTTP_PATH];
+	size_t prefix = r->path.prefix;
+	int m = route_method(&r->uri[HTTP_METHOD]);
+	route_node_t *node;
+
+	if (!h->tree[m] && !(h->tree[m] = route_node_new("", 0))) return -1;
+	if (!(node = route_node_insert(h->tree[m], path->iov_base, prefix))) return -1;
+	h->methods |= 1u << m;
+	if (r->path.literal)
+		return route_push(&node->exact, &node->exacts, r);
+	return route_push(&node->glob, &node->globs, r);
+}
+
+static void route_host_free(route_host_t *h)
+{
+	for (int i = 0; i <= ROUTE_METHOD_OTHER; i++) route_node_free(h->tree[i]);
+}
+
+/* lowest numbered route in h matching request, or best if that's lower */
+static route_t *route_host_match(route_host_t *h, int m, struct iovec *method,
+		struct iovec *path, route_t *best)
+{
+	route_node_t *node;
+	const char *p = path->iov_base;
+	size_t left = path->iov_len;
+	route_t *r;
+
+	if (!(h->methods & (1u << m))) return best;
+	for (node = h->tree[m]; node; ) {
+		/* patterns are in route order, so the first to match is the
+		 * best this node has */
+		for (size_t i = 0; i < node->globs; i++) {
+			r = node->glob[i];
+			if (best && r->n > best->n) break;
+			if (m == ROUTE_METHOD_OTHER && iovcmp(method, &r->uri[HTTP_METHOD]))
+				continue;
+			if (!iovglob_match(&r->path, path, NULL)) {
+				best = r;
+				break;
+			}
+		}
+		if (!left) {
+			for (size_t i = 0; i < node->exacts; i++) {
+				r = node->exact[i];
+				if (best && r->n > best->n) break;
+				if (m == ROUTE_METHOD_OTHER && iovcmp(method, &r->uri[HTTP_METHOD]))
+					continue;
+				best = r;
+				break;
+			}
+			break;
+		}
+		if (!(node = route_node_child(node, *p))) break;
+		if (node->len > left || memcmp(node->label, p, node->len)) break;
+		p += node->len;
+		left -= node->len;
+	}
+	return best;
+}
+
+route_table_t *route_table_new(void)
+{
+	return calloc(1, sizeof(route_table_t));
+}
+
+int route_add(route_table_t *t, struct iovec uri[HTTP_PARTS])
+{
+	struct iovec *host, *domain;
+	route_host_t *h;
+	route_t *r, **tmp;
+	size_t len = 0;
+	char *ptr;
+	int err = 0;
+
+	for (int i = 0; i < HTTP_PARTS; i++) len += uri[i].iov_len;
+	if (!(r = malloc(sizeof(route_t) + len))) return -1;
+	ptr = r->data;
+	for (int i = 0; i < HTTP_PARTS; i++) {
+		r->uri[i].iov_len = uri[i].iov_len;
+		r->uri[i].iov_base = (uri[i].iov_len) ? ptr : NULL;
+		if (uri[i].iov_len) memcpy(ptr, uri[i].iov_base, uri[i].iov_len);
+		ptr += uri[i].iov_len;
+	}
+	iovglob_compile(&r->path, &r->uri[HTTP_PATH], 0);
+	if (!(tmp = realloc(t->route, (t->routes + 1) * sizeof(route_t *)))) {
+		free(r);
+		return -1;
+	}
+	t->route = tmp;
+	r->n = t->routes;
+	t->route[t->routes++] = r;
+
+	/* a route with a domain matches Host: domain, or Host: host:port */
+	domain = &r->uri[HTTP_DOMAIN];
+	host = &r->uri[HTTP_HOST];
+	if (!domain->iov_len)
+		return route_host_add(&t->any, r);
+	if (!(h = route_host_get(t, domain->iov_base, domain->iov_len))) return -1;
+	err = route_host_add(h, r);
+	if (!err && host->iov_len && iovcmp(host, domain)) {
+		if (!(h = route_host_get(t, host->iov_base, host->iov_len))) return -1;
+		err = route_host_add(h, r);
+	}
+	return err;
+}
+
+struct iovec *route_match(route_table_t *t, struct iovec *method,
+		struct iovec *host, struct iovec *path)
+{
+	route_t *best = NULL;
+	route_host_t *h;
+	int m = route_method(method);
+
+	if (host->iov_len && (h = route_host_find(t, host->iov_base, host->iov_len)))
+		best = route_host_match(h, m, method, path, best);
+	best = route_host_match(&t->any, m, method, path, best);
+
+	return (best) ? best->uri : NULL;
+}
+
+size_t route_count(route_table_t *t)
+{
+	return t->routes;
+}
+
+void route_table_free(route_table_t *t)
+{
+	route_host_t *h;
+
+	if (!t) return;
+	for (size_t i = 0; i < t->buckets; i++) {
+		while ((h = t->host[i])) {
+			t->host[i] = h->next;
+			route_host_free(h);
+			free(h);
+		}
+	}
+	route_host_free(&t->any);
+	for (size_t i = 0; i < t->routes; i++) free(t->route[i]);
+	free(t->route);
+	free(t->host);
+	free(t);
+}
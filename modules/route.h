@@ -0,0 +1,55 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ *
+ * route.h
+ *
+ * this file is part of LIBRESTACK
+ *
+ * Copyright (c) 2012-2020 Brett Sheffield <bacs@librecast.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program (see the file COPYING in the distribution).
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __LSD_ROUTE_H
+#define __LSD_ROUTE_H 1
+
+#include "http.h"
+
+/* compiled http routes. A table is built once from the uri config lines and
+ * is read only after that, so handler threads share it without locking.
+ *
+ * Routes are grouped by Host, then method, then held in a radix tree over
+ * the literal prefix of their path. Patterns hang off the node for their
+ * literal prefix, so a lookup walks the request path once, trying only the
+ * patterns that could match. As with a linear scan of the uri lines, the
+ * first matching line in config order wins */
+
+typedef struct route_table_s route_table_t;
+
+/* create empty table */
+route_table_t *route_table_new(void);
+
+/* add route, copying uri. Routes match in the order they are added */
+int route_add(route_table_t *t, struct iovec uri[HTTP_PARTS]);
+
+/* find first route matching request, returning its uri parts or NULL */
+struct iovec *route_match(route_table_t *t, struct iovec *method,
+		struct iovec *host, struct iovec *path);
+
+/* number of routes in table */
+size_t route_count(route_table_t *t);
+
+/* free table */
+void route_table_free(route_table_t *t);
+
+#endif /* __LSD_ROUTE_H */
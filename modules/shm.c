@@ -0,0 +1,83 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ *
+ * shm.c
+ *
+ * this file is part of LIBRESTACK
+ *
+ * Copyright (c) 2012-2020 Brett Sheffield <bacs@librecast.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program (see the file COPYING in the distribution).
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+
+#include "shm.h"
+#include <errno.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define SHM_HUGEPAGE_SIZE 2097152	/* hugetlb mappings are a multiple of this */
+
+void *shm_map(size_t *size, int flags)
+{
+	pthread_mutexattr_t attr;
+	size_t hugesize = (*size + SHM_HUGEPAGE_SIZE - 1) & ~(size_t)(SHM_HUGEPAGE_SIZE - 1);
+	shm_t *shm = MAP_FAILED;
+
+	if (*size < sizeof(shm_t)) *size = sizeof(shm_t);
+	if (flags & SHM_HUGEPAGE) {
+		shm = mmap(NULL, hugesize, PROT_READ | PROT_WRITE,
+				MAP_SHARED | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (shm != MAP_FAILED) *size = hugesize;
+	}
+	if (shm == MAP_FAILED) {
+		shm = mmap(NULL, *size, PROT_READ | PROT_WRITE,
+				MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+		if (shm == MAP_FAILED) return NULL;
+	}
+	shm->owner = getpid();
+	shm->size = *size;
+
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+	pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+	pthread_mutex_init(&shm->mtx, &attr);
+	pthread_mutexattr_destroy(&attr);
+
+	return shm;
+}
+
+void shm_lock(shm_t *shm)
+{
+	if (pthread_mutex_lock(&shm->mtx) == EOWNERDEAD)
+		pthread_mutex_consistent(&shm->mtx);
+}
+
+void shm_unlock(shm_t *shm)
+{
+	pthread_mutex_unlock(&shm->mtx);
+}
+
+int shm_owner(shm_t *shm)
+{
+	return (shm->owner == getpid());
+}
+
+void shm_unmap(shm_t *shm)
+{
+	if (!shm) return;
+	if (shm_owner(shm)) pthread_mutex_destroy(&shm->mtx);
+	munmap(shm, shm->size);
+}
@@ -0,0 +1,62 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ *
+ * shm.h
+ *
+ * this file is part of LIBRESTACK
+ *
+ * Copyright (c) 2012-2020 Brett Sheffield <bacs@librecast.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program (see the file COPYING in the distribution).
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __LSD_SHM_H
+#define __LSD_SHM_H 1
+
+#include <pthread.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+/* memory shared by the controller and the handlers it forks, for the caches
+ * that live in it.
+ *
+ * The mapping starts with a shm_t, holding a robust process shared mutex.
+ * A handler may die holding it, in which case the next to lock it carries
+ * on, so what it guards must be left usable at every step. Handlers exiting
+ * only unmap their view: the lock is destroyed by the process that made it */
+
+#define SHM_HUGEPAGE 0x1	/* back with hugepages, if there are any free */
+
+typedef struct shm_s shm_t;
+struct shm_s {
+	pthread_mutex_t	mtx;
+	pid_t		owner;		/* process that made the mapping */
+	size_t		size;		/* bytes mapped */
+};
+
+/* map at least *size bytes of zeroed shared memory, setting *size to what
+ * was mapped. Call before forking. Returns the mapping, which starts with
+ * its shm_t, or NULL */
+void *shm_map(size_t *size, int flags);
+
+/* lock, taking over from a holder that died */
+void shm_lock(shm_t *shm);
+void shm_unlock(shm_t *shm);
+
+/* this process made the mapping */
+int shm_owner(shm_t *shm);
+
+/* unmap, destroying the lock if this process made it */
+void shm_unmap(shm_t *shm);
+
+#endif /* __LSD_SHM_H */
@@ -0,0 +1,334 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ *
+ * shmcache.c
+ *
+ * this file is part of LIBRESTACK
+ *
+ * Copyright (c) 2012-2020 Brett Sheffield <bacs@librecast.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program (see the file COPYING in the distribution).
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+
+#include "shmcache.h"
+#include "shm.h"
+#include "../src/hash.h"
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#define SHMCACHE_NONE UINT32_MAX	/* end of hash chain */
+#define SHMCACHE_PINNERS 8		/* processes that may pin a slot at once */
+
+typedef enum {
+	SHMCACHE_FREE,
+	SHMCACHE_LOADING,	/* being filled, not yet findable */
+	SHMCACHE_READY,
+	SHMCACHE_STALE,		/* replaced while pinned, free once unpinned */
+} shmcache_state_t;
+
+/* pins one process holds on a slot, so they can be dropped if it dies */
+typedef struct shmcache_pin_s shmcache_pin_t;
+struct shmcache_pin_s {
+	pid_t		pid;		/* 0 if unused */
+	uint32_t	count;
+};
+
+typedef struct shmcache_slot_s shmcache_slot_t;
+struct shmcache_slot_s {
+	uint64_t	hash;
+	uint32_t	next;		/* hash chain */
+	uint32_t	pins;		/* readers sending from slot */
+	shmcache_pin_t	pinner[SHMCACHE_PINNERS];
+	pid_t		loader;		/* process filling a LOADING slot */
+	uint8_t		state;
+	uint8_t		ref;		/* used since clock hand passed */
+	dev_t		dev;
+	ino_t		ino;
+	off_t		size;
+	struct timespec	mtim;
+	uint32_t	pathlen;	/* data holds path, then headers, then body */
+	uint32_t	headlen;
+};
+
+/* the index is changed in single steps, so a handler dying while holding
+ * the lock leaves it usable */
+struct shmcache_s {
+	shm_t		shm;
+	uint32_t	slots;
+	uint32_t	buckets;	/* power of two */
+	uint32_t	hand;		/* clock hand */
+	uint32_t *	bucket;		/* these point into the mapping, which */
+	shmcache_slot_t *slot;		/* is at the same address in every */
+	char *		data;		/* handler as it was mapped pre-fork */
+};
+
+static char *shmcache_data(shmcache_t *sc, uint32_t i)
+{
+	return sc->data + (size_t)i * SHMCACHE_SLOT;
+}
+
+static int shmcache_match(shmcache_slot_t *s, struct stat *sb)
+{
+	return (s->dev == sb->st_dev && s->ino == sb->st_ino && s->size == sb->st_size
+		&& s->mtim.tv_sec == sb->st_mtim.tv_sec
+		&& s->mtim.tv_nsec == sb->st_mtim.tv_nsec);
+}
+
+static uint32_t shmcache_find(shmcache_t *sc, const char *path, size_t len, uint64_t h)
+{
+	uint32_t i;
+	for (i = sc->bucket[h & (sc->buckets - 1)]; i != SHMCACHE_NONE; i = sc->slot[i].next) {
+		if (sc->slot[i].hash == h && sc->slot[i].pathlen == len
+		&& !memcmp(shmcache_data(sc, i), path, len))
+			break;
+	}
+	return i;
+}
+
+/* take slot out of its hash chain. Call with lock held */
+static void shmcache_unlink(shmcache_t *sc, uint32_t i)
+{
+	uint32_t *p = &sc->bucket[sc->slot[i].hash & (sc->buckets - 1)];
+	while (*p != i) p = &sc->slot[*p].next;
+	*p = sc->slot[i].next;
+	sc->slot[i].state = (sc->slot[i].pins) ? SHMCACHE_STALE : SHMCACHE_FREE;
+}
+
+/* find a slot to reuse, clearing ref bits as the hand passes. Call with lock
+ * held. Returns SHMCACHE_NONE if every slot is pinned or loading */
+static uint32_t shmcache_victim(shmcache_t *sc)
+{
+	shmcache_slot_t *s;
+	uint32_t i;
+
+	for (uint32_t n = 0; n < sc->slots * 2; n++) {
+		i = sc->hand;
+		sc->hand = (sc->hand + 1) % sc->slots;
+		s = &sc->slot[i];
+		if (s->state == SHMCACHE_FREE) return i;
+		if (s->state != SHMCACHE_READY || s->pins) continue;
+		if (s->ref) {
+			s->ref = 0;
+			continue;
+		}
+		shmcache_unlink(sc, i);
+		return i;
+	}
+	return SHMCACHE_NONE;
+}
+
+/* pin record for pid, or a free one if it has none. NULL if all are taken */
+static shmcache_pin_t *shmcache_pinner(shmcache_slot_t *s, pid_t pid)
+{
+	shmcache_pin_t *unused = NULL;
+
+	for (int i = 0; i < SHMCACHE_PINNERS; i++) {
+		if (s->pinner[i].pid == pid) return &s->pinner[i];
+		if (!s->pinner[i].pid && !unused) unused = &s->pinner[i];
+	}
+	return unused;
+}
+
+/* drop n of slot's pins. Call with lock held */
+static void shmcache_unpin(shmcache_slot_t *s, shmcache_pin_t *p, uint32_t n)
+{
+	if (n > p->count) n = p->count;
+	if (!(p->count -= n)) p->pid = 0;
+	s->pins -= n;
+	if (!s->pins && s->state == SHMCACHE_STALE) s->state = SHMCACHE_FREE;
+}
+
+int shmcache_get(shmcache_t *sc, const char *path, struct stat *sb, struct iovec iov[2])
+{
+	size_t len = strlen(path);
+	uint64_t h = hash_fnv1a64(path, len);
+	shmcache_slot_t *s;
+	shmcache_pin_t *p;
+	pid_t pid = getpid();
+	uint32_t i;
+
+	shm_lock(&sc->shm);
+	if ((i = shmcache_find(sc, path, len, h)) == SHMCACHE_NONE) {
+		shm_unlock(&sc->shm);
+		return -1;
+	}
+	s = &sc->slot[i];
+	if (!shmcache_match(s, sb)) {
+		/* file changed. Make way for the new one */
+		shmcache_unlink(sc, i);
+		shm_unlock(&sc->shm);
+		return -1;
+	}
+	/* too many processes sending it already. Send it from the file */
+	if (!(p = shmcache_pinner(s, pid))) {
+		shm_unlock(&sc->shm);
+		return -1;
+	}
+	p->pid = pid;
+	p->count++;
+	s->pins++;
+	s->ref = 1;
+	shm_unlock(&sc->shm);
+	iov[0].iov_base = shmcache_data(sc, i) + s->pathlen;
+	iov[0].iov_len = s->headlen;
+	iov[1].iov_base = (char *)iov[0].iov_base + s->headlen;
+	iov[1].iov_len = s->size;
+
+	return (int)i;
+}
+
+void shmcache_release(shmcache_t *sc, int slot)
+{
+	shmcache_slot_t *s = &sc->slot[slot];
+	pid_t pid = getpid();
+
+	shm_lock(&sc->shm);
+	for (int i = 0; i < SHMCACHE_PINNERS; i++) {
+		if (s->pinner[i].pid == pid) {
+			shmcache_unpin(s, &s->pinner[i], 1);
+			break;
+		}
+	}
+	shm_unlock(&sc->shm);
+}
+
+void shmcache_reap(shmcache_t *sc, pid_t pid)
+{
+	shmcache_slot_t *s;
+
+	shm_lock(&sc->shm);
+	for (uint32_t i = 0; i < sc->slots; i++) {
+		s = &sc->slot[i];
+		if (s->state == SHMCACHE_LOADING && s->loader == pid) {
+			s->state = SHMCACHE_FREE;
+			continue;
+		}
+		for (int j = 0; j < SHMCACHE_PINNERS; j++) {
+			if (s->pinner[j].pid == pid)
+				shmcache_unpin(s, &s->pinner[j], s->pinner[j].count);
+		}
+	}
+	shm_unlock(&sc->shm);
+}
+
+int shmcache_fits(size_t pathlen, size_t headlen, size_t size)
+{
+	return (pathlen + headlen + size <= SHMCACHE_SLOT);
+}
+
+int shmcache_add(shmcache_t *sc, const char *path, struct stat *sb,
+		struct iovec *head, int fd)
+{
+	size_t len = strlen(path);
+	uint64_t h = hash_fnv1a64(path, len);
+	shmcache_slot_t *s;
+	char *data, *body;
+	ssize_t byt;
+	uint32_t i;
+
+	if (!shmcache_fits(len, head->iov_len, sb->st_size)) return -1;
+	shm_lock(&sc->shm);
+	if (shmcache_find(sc, path, len, h) != SHMCACHE_NONE
+	|| (i = shmcache_victim(sc)) == SHMCACHE_NONE) {
+		shm_unlock(&sc->shm);
+		return -1;
+	}
+	s = &sc->slot[i];
+	s->state = SHMCACHE_LOADING;
+	s->loader = getpid();	/* so the slot is freed if we die loading it */
+	shm_unlock(&sc->shm);
+
+	/* fill slot outside the lock. Nobody else can see it yet */
+	s->hash = h;
+	s->pins = 0;
+	memset(s->pinner, 0, sizeof s->pinner);
+	s->dev = sb->st_dev;
+	s->ino = sb->st_ino;
+	s->size = sb->st_size;
+	s->mtim = sb->st_mtim;
+	s->pathlen = len;
+	s->headlen = head->iov_len;
+	data = shmcache_data(sc, i);
+	memcpy(data, path, len);
+	memcpy(data + len, head->iov_base, head->iov_len);
+	body = data + len + head->iov_len;
+	for (off_t off = 0; off < sb->st_size; off += byt) {
+		byt = pread(fd, body + off, sb->st_size - off, off);
+		if (byt == -1 && errno == EINTR) byt = 0;
+		else if (byt <= 0) goto err_free;
+	}
+
+	shm_lock(&sc->shm);
+	/* another handler may have added it meanwhile */
+	if (shmcache_find(sc, path, len, h) != SHMCACHE_NONE) {
+		s->state = SHMCACHE_FREE;
+		shm_unlock(&sc->shm);
+		return -1;
+	}
+	s->ref = 1;
+	s->next = sc->bucket[h & (sc->buckets - 1)];
+	sc->bucket[h & (sc->buckets - 1)] = i;
+	s->state = SHMCACHE_READY;
+	shm_unlock(&sc->shm);
+	return 0;
+err_free:
+	shm_lock(&sc->shm);
+	s->state = SHMCACHE_FREE;
+	shm_unlock(&sc->shm);
+	return -1;
+}
+
+size_t shmcache_slots(shmcache_t *sc)
+{
+	return sc->slots;
+}
+
+shmcache_t *shmcache_new(size_t size)
+{
+	shmcache_t *sc;
+	size_t per = SHMCACHE_SLOT + sizeof(shmcache_slot_t) + 2 * sizeof(uint32_t);
+	size_t slots = size / per;
+	size_t buckets;
+	size_t off;
+	char *map;
+
+	if (!slots || slots >= SHMCACHE_NONE / 2) return NULL;
+	for (buckets = 16; buckets < slots * 2; buckets <<= 1);
+
+	/* header, buckets and slots, then page aligned data */
+	off = sizeof(shmcache_t) + buckets * sizeof(uint32_t) + slots * sizeof(shmcache_slot_t);
+	off = (off + SHMCACHE_SLOT - 1) & ~(size_t)(SHMCACHE_SLOT - 1);
+	size = off + slots * SHMCACHE_SLOT;
+	if (!(map = shm_map(&size, SHM_HUGEPAGE))) return NULL;
+
+	sc = (shmcache_t *)map;
+	sc->slots = slots;
+	sc->buckets = buckets;
+	sc->hand = 0;
+	sc->bucket = (uint32_t *)(map + sizeof(shmcache_t));
+	sc->slot = (shmcache_slot_t *)(sc->bucket + buckets);
+	sc->data = map + off;
+	memset(sc->bucket, 0xff, buckets * sizeof(uint32_t)); /* SHMCACHE_NONE */
+
+	return sc;
+}
+
+void shmcache_free(shmcache_t *sc)
+{
+	if (sc) shm_unmap(&sc->shm);
+}
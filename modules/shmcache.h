@@ -0,0 +1,79 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ *
+ * shmcache.h
+ *
+ * this file is part of LIBRESTACK
+ *
+ * Copyright (c) 2012-2020 Brett Sheffield <bacs@librecast.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program (see the file COPYING in the distribution).
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __LSD_SHMCACHE_H
+#define __LSD_SHMCACHE_H 1
+
+#include <stddef.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+/* contents of small static files, with their headers, in memory shared by
+ * all handler processes.
+ *
+ * The controller creates the cache before forking, and handlers inherit the
+ * mapping. It is split into fixed size slots, each holding one file's path,
+ * header block and contents. A slot is found by hashing the path, and checked
+ * against the file's stat, so a changed file is never served stale. When the
+ * cache is full, slots are reused in CLOCK order: a slot used since the hand
+ * last passed gets a second chance. Slots being sent from are pinned, so they
+ * can't be reused under a reader. Pins are kept per process, so those of a
+ * handler that dies can be dropped with shmcache_reap(). The index is guarded
+ * by a robust mutex, so a handler dying while holding it doesn't wedge the
+ * others */
+
+#define SHMCACHE_SLOT 32768	/* bytes per slot: path, headers and contents */
+
+typedef struct shmcache_s shmcache_t;
+
+/* create cache of about size bytes, backed by hugepages if there are any
+ * free. Call before forking */
+shmcache_t *shmcache_new(size_t size);
+
+/* look up path. On a hit, iov[0] is set to the header block and iov[1] to
+ * the contents, both in shared memory, and the slot is pinned until
+ * shmcache_release(). sb must be the file's current stat. Returns slot, or -1
+ * on a miss, or if too many processes have the slot pinned */
+int shmcache_get(shmcache_t *sc, const char *path, struct stat *sb, struct iovec iov[2]);
+
+/* unpin slot */
+void shmcache_release(shmcache_t *sc, int slot);
+
+/* drop every pin held by process pid, which has died, and free any slot it
+ * was loading. Call in the controller as it reaps a handler */
+void shmcache_reap(shmcache_t *sc, pid_t pid);
+
+/* add file, reading its contents from fd. Returns 0 if added, or -1 if it
+ * doesn't fit or there is no slot free */
+int shmcache_add(shmcache_t *sc, const char *path, struct stat *sb,
+		struct iovec *head, int fd);
+
+/* file of this size with path and header block fits in a slot */
+int shmcache_fits(size_t pathlen, size_t headlen, size_t size);
+
+/* number of slots */
+size_t shmcache_slots(shmcache_t *sc);
+
+/* unmap cache. Only in the process that created it is it destroyed */
+void shmcache_free(shmcache_t *sc);
+
+#endif /* __LSD_SHMCACHE_H */
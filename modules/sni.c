@@ -0,0 +1,187 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ *
+ * sni.c
+ *
+ * this file is part of LIBRESTACK
+ *
+ * Copyright (c) 2012-2020 Brett Sheffield <bacs@librecast.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program (see the file COPYING in the distribution).
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "sni.h"
+#include "../src/hash.h"
+#include <ctype.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct sni_s {
+	sni_host_t **	bucket;
+	size_t		buckets;	/* power of two */
+	size_t		count;
+};
+
+/* name in lower case, without any trailing dot, into buf. Returns 0, or -1
+ * if it is empty or too long */
+static int sni_name(char buf[SNI_NAME_MAX + 1], const char *name, size_t len)
+{
+	if (len && name[len - 1] == '.') len--;
+	if (!len || len > SNI_NAME_MAX) return -1;
+	for (size_t i = 0; i < len; i++) buf[i] = tolower((unsigned char)name[i]);
+	buf[len] = '\0';
+	return 0;
+}
+
+static sni_host_t **sni_slot(sni_t *sni, const char *name)
+{
+	sni_host_t **p = &sni->bucket[hash_fnv1a(name, strlen(name)) & (sni->buckets - 1)];
+	while (*p && strcmp((*p)->name, name)) p = &(*p)->next;
+	return p;
+}
+
+static void sni_host_free(sni_host_t *h, void (*ctx_free)(void *ctx))
+{
+	if (h->ctx && ctx_free) ctx_free(h->ctx);
+	free(h->name);
+	free(h->cert);
+	free(h->key);
+	free(h);
+}
+
+/* double the buckets once there are more hosts than buckets */
+static int sni_grow(sni_t *sni)
+{
+	sni_host_t **bucket, *h, *next;
+	size_t buckets = sni->buckets * 2;
+	size_t b;
+
+	if (!(bucket = calloc(buckets, sizeof(sni_host_t *)))) return -1;
+	for (size_t i = 0; i < sni->buckets; i++) {
+		for (h = sni->bucket[i]; h; h = next) {
+			next = h->next;
+			b = hash_fnv1a(h->name, strlen(h->name)) & (buckets - 1);
+			h->next = bucket[b];
+			bucket[b] = h;
+		}
+	}
+	free(sni->bucket);
+	sni->bucket = bucket;
+	sni->buckets = buckets;
+	return 0;
+}
+
+int sni_add(sni_t *sni, const char *line, size_t len)
+{
+	const char *word[3];
+	size_t wlen[3];
+	const char *p = line;
+	const char *end = line + len;
+	char name[SNI_NAME_MAX + 1];
+	sni_host_t *h, **slot;
+	int n = 0;
+
+	/* host cert key, and maybe a comment */
+	while (p < end && *p && n < 3) {
+		while (p < end && isspace((unsigned char)*p)) p++;
+		if (p == end || !*p || *p == '#') break;
+		word[n] = p;
+		while (p < end && *p && !isspace((unsigned char)*p)) p++;
+		wlen[n] = p - word[n];
+		n++;
+	}
+	if (n != 3 || sni_name(name, word[0], wlen[0])) return -1;
+	if (sni->count >= sni->buckets && sni_grow(sni)) return -1;
+
+	if (!(h = calloc(1, sizeof(sni_host_t)))) return -1;
+	h->name = strdup(name);
+	h->cert = strndup(word[1], wlen[1]);
+	h->key = strndup(word[2], wlen[2]);
+	if (!h->name || !h->cert || !h->key) {
+		sni_host_free(h, NULL);
+		return -1;
+	}
+	/* later lines win */
+	slot = sni_slot(sni, h->name);
+	if (*slot) {
+		h->next = (*slot)->next;
+		sni_host_free(*slot, NULL);
+		sni->count--;
+	}
+	*slot = h;
+	sni->count++;
+
+	return 0;
+}
+
+sni_host_t *sni_find(sni_t *sni, const char *name)
+{
+	char buf[SNI_NAME_MAX + 1];
+	sni_host_t *h;
+	char *dot;
+
+	if (sni_name(buf, name, strlen(name))) return NULL;
+	if ((h = *sni_slot(sni, buf))) return h;
+
+	/* replace the first label with a wildcard */
+	if (!(dot = strchr(buf, '.')) || dot == buf) return NULL;
+	buf[0] = '*';
+	memmove(buf + 1, dot, strlen(dot) + 1);
+	return *sni_slot(sni, buf);
+}
+
+int sni_each(sni_t *sni, int (*fn)(sni_host_t *h, void *arg), void *arg)
+{
+	int ret = 0;
+
+	for (size_t i = 0; i < sni->buckets && !ret; i++) {
+		for (sni_host_t *h = sni->bucket[i]; h && !ret; h = h->next)
+			ret = fn(h, arg);
+	}
+	return ret;
+}
+
+size_t sni_count(sni_t *sni)
+{
+	return sni->count;
+}
+
+sni_t *sni_new(void)
+{
+	sni_t *sni;
+
+	if (!(sni = calloc(1, sizeof(sni_t)))) return NULL;
+	sni->buckets = 16;
+	if (!(sni->bucket = calloc(sni->buckets, sizeof(sni_host_t *)))) {
+		free(sni);
+		return NULL;
+	}
+	return sni;
+}
+
+void sni_free(sni_t *sni, void (*ctx_free)(void *ctx))
+{
+	sni_host_t *h, *next;
+
+	if (!sni) return;
+	for (size_t i = 0; i < sni->buckets; i++) {
+		for (h = sni->bucket[i]; h; h = next) {
+			next = h->next;
+			sni_host_free(h, ctx_free);
+		}
+	}
+	free(sni->bucket);
+	free(sni);
+}
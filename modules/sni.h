@@ -0,0 +1,70 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ *
+ * sni.h
+ *
+ * this file is part of LIBRESTACK
+ *
+ * Copyright (c) 2012-2020 Brett Sheffield <bacs@librecast.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program (see the file COPYING in the distribution).
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __LSD_SNI_H
+#define __LSD_SNI_H 1
+
+#include <stddef.h>
+
+/* per host TLS certificates, found by the server name a client asks for.
+ *
+ * Hosts come from "sni host cert key" config lines, and are hashed by name.
+ * A host named "*.example.com" stands in for any single label under
+ * example.com that has no host of its own. Each host has a slot for the TLS
+ * context made from its cert and key, which may be filled in as the table
+ * is built, or when the host is first asked for */
+
+#define SNI_NAME_MAX 253	/* longest dns name */
+
+typedef struct sni_s sni_t;
+
+typedef struct sni_host_s sni_host_t;
+struct sni_host_s {
+	sni_host_t *	next;		/* hash chain */
+	char *		name;		/* lower case */
+	char *		cert;
+	char *		key;
+	void *		ctx;		/* made from cert and key, once needed */
+	int		failed;		/* cert or key wouldn't load */
+};
+
+/* create empty table */
+sni_t *sni_new(void);
+
+/* add host from config line "host cert key", of len bytes. A host already
+ * in the table is replaced. Returns 0, or -1 on a bad line or no memory */
+int sni_add(sni_t *sni, const char *line, size_t len);
+
+/* host for server name, or the wildcard covering it, or NULL */
+sni_host_t *sni_find(sni_t *sni, const char *name);
+
+/* call fn on every host, stopping if it returns nonzero. Returns what fn
+ * last returned */
+int sni_each(sni_t *sni, int (*fn)(sni_host_t *h, void *arg), void *arg);
+
+/* number of hosts */
+size_t sni_count(sni_t *sni);
+
+/* free table, calling ctx_free on every context made */
+void sni_free(sni_t *sni, void (*ctx_free)(void *ctx));
+
+#endif /* __LSD_SNI_H */
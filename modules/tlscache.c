@@ -0,0 +1,235 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ *
+ * tlscache.c
+ *
+ * this file is part of LIBRESTACK
+ *
+ * Copyright (c) 2012-2020 Brett Sheffield <bacs@librecast.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program (see the file COPYING in the distribution).
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+
+#include "tlscache.h"
+#include "shm.h"
+#include "../src/hash.h"
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/random.h>
+
+typedef struct tlscache_slot_s tlscache_slot_t;
+struct tlscache_slot_s {
+	time_t		expires;	/* free once past this */
+	uint64_t	host;		/* server name it was made for */
+	uint16_t	idlen;
+	uint16_t	len;
+	unsigned char	id[TLSCACHE_ID];
+	unsigned char	data[TLSCACHE_DATA];
+};
+
+/* nothing is left half done under the lock that matters more than one lost
+ * session, so a handler dying while holding it is harmless */
+struct tlscache_s {
+	shm_t		shm;
+	size_t		sets;		/* of TLSCACHE_WAYS slots each */
+	time_t		timeout;
+	time_t		keylife;
+	time_t		keytime;	/* when key[0] was made */
+	tlscache_key_t	key[2];		/* current, and the one before */
+	int		keys;		/* of key[] in use */
+	tlscache_slot_t	slot[];
+};
+
+static time_t tlscache_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+	return ts.tv_sec;
+}
+
+/* first slot of id's set */
+static tlscache_slot_t *tlscache_set(tlscache_t *tc, const unsigned char *id, size_t idlen)
+{
+	return &tc->slot[(hash_fnv1a64(id, idlen) % tc->sets) * TLSCACHE_WAYS];
+}
+
+/* slot in set holding id, or NULL. Call with lock held */
+static tlscache_slot_t *tlscache_find(tlscache_slot_t *set, const unsigned char *id,
+		size_t idlen, time_t now)
+{
+	for (int i = 0; i < TLSCACHE_WAYS; i++) {
+		if (set[i].expires > now && set[i].idlen == idlen
+		&& !memcmp(set[i].id, id, idlen))
+			return &set[i];
+	}
+	return NULL;
+}
+
+int tlscache_add(tlscache_t *tc, const unsigned char *id, size_t idlen, uint64_t host,
+		const void *data, size_t len)
+{
+	tlscache_slot_t *set = tlscache_set(tc, id, idlen);
+	tlscache_slot_t *s;
+	time_t now = tlscache_now();
+
+	if (!idlen || idlen > TLSCACHE_ID || len > TLSCACHE_DATA) return -1;
+	shm_lock(&tc->shm);
+	/* the same id again replaces what it had, otherwise whatever expires
+	 * soonest makes way */
+	if (!(s = tlscache_find(set, id, idlen, now))) {
+		s = set;
+		for (int i = 1; i < TLSCACHE_WAYS; i++) {
+			if (set[i].expires < s->expires) s = &set[i];
+		}
+	}
+	s->expires = now + tc->timeout;
+	s->host = host;
+	s->idlen = idlen;
+	s->len = len;
+	memcpy(s->id, id, idlen);
+	memcpy(s->data, data, len);
+	shm_unlock(&tc->shm);
+
+	return 0;
+}
+
+size_t tlscache_get(tlscache_t *tc, const unsigned char *id, size_t idlen, uint64_t host,
+		void *data, size_t size)
+{
+	tlscache_slot_t *s;
+	size_t len = 0;
+
+	if (!idlen || idlen > TLSCACHE_ID) return 0;
+	shm_lock(&tc->shm);
+	s = tlscache_find(tlscache_set(tc, id, idlen), id, idlen, tlscache_now());
+	if (s && s->host == host && s->len <= size) {
+		len = s->len;
+		memcpy(data, s->data, len);
+	}
+	shm_unlock(&tc->shm);
+
+	return len;
+}
+
+void tlscache_remove(tlscache_t *tc, const unsigned char *id, size_t idlen)
+{
+	tlscache_slot_t *s;
+
+	if (!idlen || idlen > TLSCACHE_ID) return;
+	shm_lock(&tc->shm);
+	s = tlscache_find(tlscache_set(tc, id, idlen), id, idlen, tlscache_now());
+	if (s) s->expires = 0;
+	shm_unlock(&tc->shm);
+}
+
+static int tlscache_random(void *buf, size_t len)
+{
+	ssize_t byt;
+
+	for (char *p = buf; len; p += byt, len -= byt) {
+		if ((byt = getrandom(p, len, 0)) == -1) {
+			if (errno != EINTR) return -1;
+			byt = 0;
+		}
+	}
+	return 0;
+}
+
+/* make a new current key, keeping the old one as the one before. Call with
+ * lock held */
+static int tlscache_key_new(tlscache_t *tc, time_t now)
+{
+	tlscache_key_t key;
+
+	if (tlscache_random(&key, sizeof key)) return -1;
+	tc->key[1] = tc->key[0];
+	tc->key[0] = key;
+	if (tc->keys < 2) tc->keys++;
+	tc->keytime = now;
+	explicit_bzero(&key, sizeof key);
+	return 0;
+}
+
+int tlscache_key_current(tlscache_t *tc, tlscache_key_t *key)
+{
+	time_t now = tlscache_now();
+	int ret = 0;
+
+	shm_lock(&tc->shm);
+	if (!tc->keys || now - tc->keytime >= tc->keylife) {
+		/* no new key is no reason to stop using the old one */
+		if (tlscache_key_new(tc, now) && !tc->keys) ret = -1;
+	}
+	if (!ret) *key = tc->key[0];
+	shm_unlock(&tc->shm);
+
+	return ret;
+}
+
+int tlscache_key_find(tlscache_t *tc, const unsigned char *name, tlscache_key_t *key)
+{
+	int ret = -1;
+
+	shm_lock(&tc->shm);
+	for (int i = 0; i < tc->keys; i++) {
+		if (!memcmp(tc->key[i].name, name, TLSCACHE_KEY_NAME)) {
+			*key = tc->key[i];
+			ret = i;
+			break;
+		}
+	}
+	shm_unlock(&tc->shm);
+
+	return ret;
+}
+
+size_t tlscache_sessions(tlscache_t *tc)
+{
+	return tc->sets * TLSCACHE_WAYS;
+}
+
+tlscache_t *tlscache_new(size_t sessions, time_t timeout, time_t keylife)
+{
+	tlscache_t *tc;
+	size_t sets = (sessions + TLSCACHE_WAYS - 1) / TLSCACHE_WAYS;
+	size_t size;
+
+	if (!sets || sets > (SIZE_MAX - sizeof(tlscache_t))
+			/ (TLSCACHE_WAYS * sizeof(tlscache_slot_t)))
+		return NULL;
+	size = sizeof(tlscache_t) + sets * TLSCACHE_WAYS * sizeof(tlscache_slot_t);
+	if (!(tc = shm_map(&size, 0))) return NULL;
+
+	/* the mapping comes zeroed: every slot expired, no keys */
+	tc->sets = sets;
+	tc->timeout = timeout;
+	tc->keylife = keylife;
+	if (tlscache_key_new(tc, tlscache_now())) {
+		shm_unmap(&tc->shm);
+		return NULL;
+	}
+
+	return tc;
+}
+
+void tlscache_free(tlscache_t *tc)
+{
+	if (!tc) return;
+	/* wipe the keys once, as the cache is done with */
+	if (shm_owner(&tc->shm)) explicit_bzero(tc->key, sizeof tc->key);
+	shm_unmap(&tc->shm);
+}
@@ -0,0 +1,92 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ *
+ * tlscache.h
+ *
+ * this file is part of LIBRESTACK
+ *
+ * Copyright (c) 2012-2020 Brett Sheffield <bacs@librecast.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program (see the file COPYING in the distribution).
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __LSD_TLSCACHE_H
+#define __LSD_TLSCACHE_H 1
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+/* TLS sessions and session ticket keys, in memory shared by all handler
+ * processes, so a returning client can resume whichever handler it lands on.
+ *
+ * Made by the controller before forking, in memory from shm_map() that
+ * handlers inherit. Sessions are kept as the TLS library serialized them,
+ * keyed by session id. An id hashes to a set of TLSCACHE_WAYS slots, and a
+ * new session takes the slot in its set that expires first. The first ticket key
+ * is made along with the cache. When it has been in use for its lifetime,
+ * whichever handler next asks for it makes the next one. Tickets under the
+ * key before are still taken, so no ticket is refused until it is between
+ * one and two lifetimes old */
+
+#define TLSCACHE_WAYS 4		/* slots an id may be kept in */
+#define TLSCACHE_ID 32		/* longest session id */
+#define TLSCACHE_DATA 2048	/* most bytes of serialized session */
+#define TLSCACHE_TIMEOUT 300	/* seconds a session can be resumed for */
+#define TLSCACHE_KEY_LIFETIME 3600 /* seconds before a new ticket key */
+#define TLSCACHE_KEY_NAME 16
+#define TLSCACHE_KEY 32
+
+typedef struct tlscache_s tlscache_t;
+
+typedef struct tlscache_key_s tlscache_key_t;
+struct tlscache_key_s {
+	unsigned char	name[TLSCACHE_KEY_NAME];	/* sent with each ticket */
+	unsigned char	key[TLSCACHE_KEY];
+};
+
+/* create cache of at least sessions slots, which keeps each session for
+ * timeout seconds and changes ticket key every keylife seconds. Call before
+ * forking */
+tlscache_t *tlscache_new(size_t sessions, time_t timeout, time_t keylife);
+
+/* keep session data of len bytes under id, made for server name hashed to
+ * host. Returns 0, or -1 if it is too big */
+int tlscache_add(tlscache_t *tc, const unsigned char *id, size_t idlen, uint64_t host,
+		const void *data, size_t len);
+
+/* copy session kept under id into data, of size bytes. A session made for
+ * another host is a miss, as it mustn't be resumed under this one's name.
+ * Returns its length, or 0 on a miss */
+size_t tlscache_get(tlscache_t *tc, const unsigned char *id, size_t idlen, uint64_t host,
+		void *data, size_t size);
+
+/* forget session kept under id */
+void tlscache_remove(tlscache_t *tc, const unsigned char *id, size_t idlen);
+
+/* copy key to make new tickets with into key, making a new one if it is
+ * due. Returns 0, or -1 if no key could be made */
+int tlscache_key_current(tlscache_t *tc, tlscache_key_t *key);
+
+/* copy key called name into key. Returns 0 for the current key, 1 for the
+ * one before, whose tickets should be replaced, or -1 if there is no such
+ * key */
+int tlscache_key_find(tlscache_t *tc, const unsigned char *name, tlscache_key_t *key);
+
+/* number of session slots */
+size_t tlscache_sessions(tlscache_t *tc);
+
+/* unmap cache. The process that made it also wipes the ticket keys */
+void tlscache_free(tlscache_t *tc);
+
+#endif /* __LSD_TLSCACHE_H */
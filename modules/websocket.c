@@ -34,7 +34,7 @@
 #include <string.h>
 #include <unistd.h>
 
-int ws_proto = WS_PROTOCOL_INVALID;
+__thread int ws_proto = WS_PROTOCOL_INVALID;
 
 typedef struct ws_frame_header_t {
 	uint8_t f1;
@@ -85,7 +85,7 @@ typedef enum {
 #define WS_OPCODE_DESC(code, type, desc, f) case code: return desc;
 #define WS_OPCODE_FUN(code, type, desc, fun) case code: err = fun(c, f); break;
 
-extern int ws_proto;
+extern __thread int ws_proto;
 
 /* handle client close request */
 int ws_do_close(conn_t *c, ws_frame_t *f);
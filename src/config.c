@@ -26,11 +26,12 @@
 #include "err.h"
 #include "lsd.h"
 #include "log.h"
+#include "module.h"
 #include <assert.h>
 #include <ctype.h>
-#include <dlfcn.h>
 #include <fcntl.h>
 #include <limits.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <string.h>
 #include <sys/mman.h>
@@ -39,13 +40,10 @@
 #include <unistd.h>
 
 int debug;
-static int mods_loaded;
-module_t *mods;	/* dlopen handles for modules */
 int run;
-char yield; /* need to do cleanup call to config_yield() */
+__thread char yield; /* need to do cleanup call to config_yield() */
 int handlers;
 int pid;
-int semid;
 int *socks;
 char *dbdir;
 
@@ -226,98 +224,10 @@ int config_int_set(char *klong, int *key, char *val)
 	return 1;
 }
 
-/* find module handle by name
- * TODO: if not loaded, load it */
-module_t *config_module(char *name, size_t len)
-{
-	module_t *mod = mods;
-	TRACE("%s()", __func__);
-	DEBUG("seaching %i modules for '%.*s'", mods_loaded, (int)len, name);
-	for (int i = 0; i < mods_loaded; i++) {
-		if (!mod) break;
-		DEBUG("trying '%s'=='%.*s'", mod->name, (int)len, name);
-		if (!strncmp(mod->name, name, len)) {
-			DEBUG("found '%.*s'", (int)len, name);
-			return mod;
-		}
-		mod++;
-	}
-	return NULL;
-}
-
-/* load a single module */
-static int config_load_module(module_t *mod, char *name, size_t len)
-{
-	int err = 0;
-	char modpath[] = "../modules:/usr/local/lib:/usr/lib:/usr/local/sbin"; /* TODO - configurable */
-	char *module = NULL;
-	char *path;
-	size_t size;
-
-	TRACE("%s()", __func__);
-	path = strtok(modpath, ":");
-	while (path) {
-		DEBUG("searching modpath: '%s'", path);
-		size = snprintf(NULL, 0, "%s/%.*s.so", path, (int)len, name);
-		module = malloc(size + 1);
-		snprintf(module, size + 1, "%s/%.*s.so", path, (int)len, name);
-		DEBUG("trying '%s'", module);
-		/* first, check if we have it loaded already */
-		if (config_module(name, len)) {
-			free(module);
-			return 0;
-		}
-		/* TODO: allocate memory dynamically */
-		if (!mods) {
-			mods = calloc(32, sizeof(module_t));
-		}
-		mod = mods;
-		for (int i = 0; i < mods_loaded; i++) { mod++; } /* find last */
-		mod->ptr = dlopen(module, RTLD_LAZY);
-		if (mod->ptr) {
-			mod->name = strndup(name, len);
-			DEBUG("module '%s' loaded successfully", mod->name);
-			int (* init)(char *); int (* conf)();
-			if ((*(void **)(&init) = dlsym(mod->ptr, "init")))
-				if ((err = init(dbdir))) goto err_load;
-			if ((*(void **)(&conf) = dlsym(mod->ptr, "conf")))
-				if ((err = conf())) goto err_load;
-			mods_loaded++;
-			break;
-		}
-		else {
-			DEBUG("dlopen: %s", dlerror());
-		}
-		free(module); module = NULL;
-		path = strtok(NULL, ":");
-	}
-	if (module) free(module);
-	else FAILMSG(LSD_ERROR_LOAD_MODULE, "Failed to load module: %.*s", (int)len, name);
-
-	return err;
-err_load:
-	ERROR("%s", dlerror());
-	dlclose(mod->ptr);
-	free(module);
-	return err;
-}
-
 void config_unload_modules(void)
 {
 	TRACE("%s()", __func__);
-	if (mods) {
-		module_t *mod = mods;
-		while (mods_loaded--) {
-			DEBUG("freeing module [%i] %s", mods_loaded, mod->name);
-			int (* finit)();
-			if ((*(void **)(&finit) = dlsym(mod->ptr, "finit")))
-				finit();
-			dlclose(mod->ptr);
-			free(mod->name);
-			mod++;
-		}
-		free(mods);
-	}
+	module_unload();
 }
 
 int config_load_modules(void)
@@ -346,15 +256,13 @@ int config_load_modules(void)
 		goto cur_close;
 	if ((err = mdb_cursor_count(cur, &size)))
 		goto cur_close;
-	/* TODO: check size */
 	DEBUG("loading %zu modules", size);
-	mods = calloc(size, sizeof(module_t));
-	module_t *mod = mods;
 	do {
-		if ((err = config_load_module(mod, ((proto_t *)(val.mv_data))->module,
-					    strlen(((proto_t *)(val.mv_data))->module))))
-			break;
-		mod++;
+		proto_t *p = (proto_t *)val.mv_data;
+		if (!module_load(p->module, strlen(p->module))) {
+			err = LSD_ERROR_LOAD_MODULE;
+			goto cur_close;
+		}
 	}
 	while (!(err = mdb_cursor_get(cur, &key, &val, MDB_NEXT)));
 	if (err != MDB_NOTFOUND) goto config_load_modules_err;
@@ -517,24 +425,48 @@ static int config_process_uri(char *line, size_t len, MDB_txn *txn, MDB_dbi dbi)
 	DEBUG("uri proto: %.*s", (int)len, line);
 
 	/* find or load module for this uri */
-	if (!(mod = config_module(line, len)))
-		if (!(config_load_module(mod, line, len)))
-			if (!(mod = config_module(line, len)))
-				return LSD_ERROR_LOAD_MODULE;
-
-	if (mod) {
-		int (* load_uri)(char *, MDB_txn *);
-		*(void **)(&load_uri) = dlsym(mod->ptr, "load_uri");
-		if (!dlerror()) err = load_uri(line, txn);
-	}
-	else {
+	if (!(mod = module_load(line, len))) {
 		DEBUG("unable to find module");
 		return LSD_ERROR_LOAD_MODULE;
 	}
+	if (mod->ops->load_uri) err = mod->ops->load_uri(line, txn);
 
 	return err;
 }
 
+/* per host TLS certificate: host cert key. Kept whole, in order, like uris,
+ * for the https module to load */
+static int config_process_sni(char *line, size_t len, MDB_txn *txn, MDB_dbi dbi)
+{
+	static size_t snis = 0;
+	MDB_val k, v;
+	char *p = line;
+	char *end;
+	int words = 0;
+
+	TRACE("%s()", __func__);
+	len = strnlen(line, len); /* len counts the word before, too */
+	end = line + len;
+	while (p < end) {
+		while (p < end && isspace(*p)) p++;
+		if (p == end || *p == '#') break;
+		words++;
+		while (p < end && !isspace(*p)) p++;
+	}
+	if (words != 3) {
+		ERROR("sni needs host, cert and key");
+		return LSD_ERROR_CONFIG_INVALID;
+	}
+	k.mv_size = sizeof(size_t);
+	k.mv_data = &snis;
+	v.mv_size = len;
+	v.mv_data = line;
+	config_set(NULL, &k, &v, txn, dbi, 0);
+	snis++;
+
+	return 0;
+}
+
 void config_close(void)
 {
 	TRACE("%s()", __func__);
@@ -649,6 +581,41 @@ int config_get_s(const char *db, char *key, char **val, MDB_txn *txn, MDB_dbi db
 
 }
 
+/* fetch integer value. val is left untouched if key is not found */
+int config_get_int(const char *db, char *key, int *val, MDB_txn *txn, MDB_dbi dbi)
+{
+	int err = 0;
+	char txn_close = 0;
+	MDB_val k;
+	MDB_val v;
+
+	TRACE("%s()", __func__);
+	k.mv_size = strlen(key) + 1;
+	k.mv_data = key;
+
+	/* create new transaction and dbi handle if none */
+	if (!txn) {
+		if ((err = mdb_txn_begin(env, NULL, MDB_RDONLY, &txn)) != 0)
+			FAILMSG(err, "%s(): %s", __func__, mdb_strerror(err));
+		txn_close = 1;
+	}
+	if (!dbi) {
+		if ((err = mdb_dbi_open(txn, db, 0, &dbi)) != 0) {
+			ERROR("%s(): %s", __func__, mdb_strerror(err));
+			goto config_get_int_done;
+		}
+	}
+	err = mdb_get(txn, dbi, &k, &v);
+	if (!err && v.mv_size == sizeof(int))
+		memcpy(val, v.mv_data, sizeof(int));
+	else if (err && err != MDB_NOTFOUND)
+		ERROR("%s(): %s", __func__, mdb_strerror(err));
+config_get_int_done:
+	if (txn_close) mdb_txn_abort(txn);
+
+	return err;
+}
+
 int config_del(const char *db, char *key, char *val, MDB_txn *txn, MDB_dbi dbi)
 {
 	char commit = 0;
@@ -789,61 +756,82 @@ int config_set_int(const char *db, char *key, int val, MDB_txn *txn, MDB_dbi dbi
 }
 
 #define FAILMDB FAILMSG(LSD_ERROR_DB, "%s()[%i]: %s", __func__, __LINE__, mdb_strerror(err))
-#define EDB(f) if ((err = f) != 0) FAILMDB
-int config_yield(const char *dbname, MDB_val *key, MDB_val *val)
+static pthread_mutex_t dbi_mtx = PTHREAD_MUTEX_INITIALIZER;
+
+int config_iter_open(config_iter_t *it, const char *dbname)
 {
-	static config_state_t state = CONFIG_INIT;
-	static MDB_txn *txn;
-	static MDB_dbi dbi;
-	static MDB_cursor *cur;
-	static MDB_cursor_op op = MDB_FIRST;
 	int err = 0;
 
-	TRACE("%s()", __func__);
-	DEBUG("dbdir: '%s'", dbdir);
-	DEBUG("dbname: '%s'", dbname);
-	if (key) DEBUG("searching for key: '%s'", (char *)key->mv_data);
-	if (!dbname)
-		state = CONFIG_FINAL;
-	switch (state) {
-	case CONFIG_INIT:
-		yield = 1;
-		assert(env);
-		EDB(mdb_txn_begin(env, NULL, MDB_RDONLY, &txn));
-		EDB(mdb_dbi_open(txn, dbname, MDB_INTEGERKEY, &dbi));
-		EDB(mdb_cursor_open(txn, dbi, &cur));
-		state = CONFIG_NEXT;
-		break;
-	case CONFIG_NEXT:
-		op = MDB_NEXT;
-		break;
-	case CONFIG_FINAL:
-		state = CONFIG_INIT;
-		op = MDB_FIRST;
-		mdb_cursor_close(cur);
-		mdb_txn_abort(txn);
-		return 0;
-	}
-	if (state != CONFIG_FINAL) {
-		err = mdb_cursor_get(cur, key, val, op);
+	TRACE("%s(%s)", __func__, dbname);
+	assert(env);
+	memset(it, 0, sizeof *it);
+	if ((err = mdb_txn_begin(env, NULL, MDB_RDONLY, &it->txn))) {
+		it->txn = NULL;
+		FAILMDB;
 	}
+	/* lmdb allows only one dbi open at a time per env */
+	pthread_mutex_lock(&dbi_mtx);
+	err = mdb_dbi_open(it->txn, dbname, MDB_INTEGERKEY, &it->dbi);
+	pthread_mutex_unlock(&dbi_mtx);
+	if (!err) err = mdb_cursor_open(it->txn, it->dbi, &it->cur);
 	if (err) {
-		if (err == MDB_NOTFOUND) {
-			state = CONFIG_FINAL;
-			return state;
-		}
+		mdb_txn_abort(it->txn);
+		it->txn = NULL;
 		FAILMDB;
 	}
-	return state;
+	it->op = MDB_FIRST;
+	it->state = CONFIG_INIT;
+
+	return 0;
+}
+
+int config_iter_next(config_iter_t *it, MDB_val *key, MDB_val *val)
+{
+	int err;
+
+	if (it->state == CONFIG_FINAL) return CONFIG_FINAL;
+	if ((err = mdb_cursor_get(it->cur, key, val, it->op))) {
+		if (err == MDB_NOTFOUND) return it->state = CONFIG_FINAL;
+		FAILMDB;
+	}
+	it->op = MDB_NEXT;
+
+	return it->state = CONFIG_NEXT;
+}
+
+void config_iter_close(config_iter_t *it)
+{
+	if (!it->txn) return;
+	mdb_cursor_close(it->cur);
+	mdb_txn_abort(it->txn);
+	memset(it, 0, sizeof *it);
+}
+
+/* one iteration per thread, kept for callers that don't need their own */
+int config_yield(const char *dbname, MDB_val *key, MDB_val *val)
+{
+	static __thread config_iter_t it;
+	int err;
+
+	TRACE("%s()", __func__);
+	if (!dbname) {
+		config_iter_close(&it);
+		return 0;
+	}
+	if (!yield) {
+		DEBUG("dbname: '%s'", dbname);
+		if ((err = config_iter_open(&it, dbname))) return err;
+		yield = 1;
+	}
+	return config_iter_next(&it, key, val);
 }
-#undef EDB
 #undef FAILMDB
 
 /* return one value at a time. Call with key == NULL to skip to final state clean up */
 int config_yield_s(char db, char *key, MDB_val *val)
 {
-	static MDB_val k;
-	static char dbname[2];
+	static __thread MDB_val k;
+	static __thread char dbname[2];
 
 	TRACE("%s()", __func__);
 	config_db(db, dbname);
@@ -873,7 +861,7 @@ void config_init_db(char *dbpath)
 	if (!dbdir) dbdir = strdup(dbpath);
 	if (env) return;
 	if (mdb_env_create(&env)) DIE ("mdb_env_create() failed");
-	if (mdb_env_set_maxreaders(env, HANDLER_MAX + 1)) DIE("mdb_env_set_maxreaders failed");
+	if (mdb_env_set_maxreaders(env, DB_READERS)) DIE("mdb_env_set_maxreaders failed");
 	/* TODO: how big a map do we need? */
 	if (mdb_env_set_mapsize(env, 10485760)) DIE("mdb_env_set_mapsize failed");
 	if (mdb_env_set_maxdbs(env, DB_MAX)) DIE("mdb_env_set_maxdbs failed");
@@ -982,6 +970,15 @@ static int config_dump(FILE *fd, MDB_txn *txn, MDB_dbi dbi[])
 	}
 	mdb_cursor_close(cur);
 
+	for (int i = 0; i < 80; i++) { fputc('#', fd); }
+	fprintf(fd, "\n## sni\n");
+	err = mdb_cursor_open(txn, dbi[DB_SNI], &cur);
+	if (err) goto config_dump_err;
+	for (op = MDB_FIRST; (err = mdb_cursor_get(cur, &key, &data, op)) == 0; op = MDB_NEXT) {
+		fprintf(fd, "sni\t%.*s\n", (int)data.mv_size, (char *)data.mv_data);
+	}
+	mdb_cursor_close(cur);
+
 	return err;
 config_dump_err:
 	ERROR("%s(): %s", __func__, mdb_strerror(err));
@@ -1002,7 +999,7 @@ static void config_drop(MDB_txn *txn, MDB_dbi dbi[])
 		ERROR("%s(): %s", __func__, mdb_strerror(err));
 		DIE("Failed to reopen tansaction");
 	}
-	for (int i = 0; i <= DB_URI; i++) {
+	for (int i = 0; i <= DB_SNI; i++) {
 		flags = 0;
 		if (i > 0) flags |= MDB_INTEGERKEY;
 		config_db(i, db);;
@@ -1137,6 +1134,9 @@ static int config_process_line(char *line, size_t len, MDB_txn *txn, MDB_dbi dbi
 	else if (!strcmp(word, "uri")) {
 		err = config_process_uri(line, len, txn, dbi[DB_URI]);
 	}
+	else if (!strcmp(word, "sni")) {
+		err = config_process_sni(line, len, txn, dbi[DB_SNI]);
+	}
 	else
 		return LSD_ERROR_CONFIG_READ;
 
@@ -1152,7 +1152,7 @@ static int config_create_dbs(MDB_txn *txn, MDB_dbi *dbi)
 	TRACE("%s()", __func__);
 
 	/* try to open database, else create it */
-	for (int i = 0; i <= DB_URI; i++) {
+	for (int i = 0; i <= DB_SNI; i++) {
 		if (i == 1) flags |= MDB_INTEGERKEY;
 		config_db(i, db);
 		while ((err = mdb_dbi_open(txn, db, flags, &dbi[i]))) {
@@ -1217,7 +1217,7 @@ int config_init(int argc, char **argv)
 	char *filename = NULL;
 	FILE *fd = NULL;
 	MDB_txn *txn = NULL;
-	MDB_dbi dbi[sizeof(config_db_idx_t)];
+	MDB_dbi dbi[DB_SNI + 1];
 	MDB_val val;
 
 	TRACE("%s()", __func__);
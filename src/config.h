@@ -24,6 +24,7 @@
 #ifndef __LSD_CONFIG
 #define __LSD_CONFIG
 
+#include <wolfssl/options.h> /* features the library was built with */
 #define WC_NO_HARDEN /* FIXME: stop wolfssl warning */
 #define WOLFSSL_TLS13 /* enable TLS 1.3 */
 #include <wolfssl/ssl.h>
@@ -62,25 +63,65 @@ typedef enum {
 	X("cert",	"--cert",	"-c", NULL, \
 	  "path to TLS certificate") \
 	X("key",	"--key",	"-k", NULL, \
-	  "path to TLS key")
+	  "path to TLS key") \
+	X("compressdir", "--compressdir", "-Z", NULL, \
+	  "directory to keep compressed copies of static files in")
 #define CONFIG_BOOLEANS(X) \
 	X("daemon",	"--daemon",	"-d", 0, \
-	  "daemonize? 1=yes, 0=no")
+	  "daemonize? 1=yes, 0=no") \
+	X("reuseport",	"--reuseport",	"-r", 0, \
+	  "each handler listens on its own SO_REUSEPORT sockets") \
+	X("cpuaffinity", "--cpuaffinity", "-a", 0, \
+	  "pin handlers to cpus and keep flows on the receiving cpu (needs reuseport)") \
+	X("ktls",	"--ktls",	"-K", 0, \
+	  "hand TLS records to the kernel after the handshake (needs USE_KTLS)")
 #define CONFIG_INTEGERS(X) \
 	X("loglevel",	"--loglevel",	"-l", LOG_LOGLEVEL_DEFAULT, \
-	  "logging level")
+	  "logging level") \
+	X("maxconn",	"--maxconn",	"-m", 0, \
+	  "connections a handler serves before it is recycled (0=unlimited)") \
+	X("minhandlers", "--minhandlers", "-n", HANDLER_MIN, \
+	  "minimum number of handlers to keep ready") \
+	X("maxhandlers", "--maxhandlers", "-N", HANDLER_MAX, \
+	  "maximum number of handler processes") \
+	X("spawnrate",	"--spawnrate",	"-s", HANDLER_SPAWN_RATE, \
+	  "most handlers to start at once when the pool runs short") \
+	X("idletimeout", "--idletimeout", "-i", HANDLER_IDLE_TIMEOUT, \
+	  "seconds before surplus idle handlers exit (0=never)") \
+	X("backlog",	"--backlog",	"-b", BACKLOG, \
+	  "listen() backlog") \
+	X("threads",	"--threads",	"-t", 1, \
+	  "worker threads per handler process") \
+	X("filecache",	"--filecache",	"-f", FILECACHE_SIZE, \
+	  "static files each handler keeps open (0=none)") \
+	X("shmcache",	"--shmcache",	"-S", 0, \
+	  "MiB of memory shared by handlers for small static files (0=none)") \
+	X("compressmin", "--compressmin", "-z", COMPRESS_MIN, \
+	  "smallest static file to keep a compressed copy of (0=never)") \
+	X("compressbody", "--compressbody", "-y", COMPRESS_BODY_MIN, \
+	  "smallest response() body to compress on every request (0=never)") \
+	X("tlscache",	"--tlscache",	"-T", TLSCACHE_SIZE, \
+	  "TLS sessions shared by handlers for resumption (0=none)")
 
 /* lower and upper bounds on numeric config types */
 #define CONFIG_LIMITS(X) \
 	X("loglevel", 0, 127) \
+	X("maxconn", 0, INT_MAX) \
+	X("minhandlers", 0, HANDLER_LIMIT) \
+	X("maxhandlers", 1, HANDLER_LIMIT) \
+	X("spawnrate", 1, HANDLER_LIMIT) \
+	X("idletimeout", 0, INT_MAX) \
+	X("backlog", 1, INT_MAX) \
+	X("threads", 1, HANDLER_THREADS_MAX) \
+	X("filecache", 0, INT_MAX) \
+	X("shmcache", 0, 65536) \
+	X("compressmin", 0, INT_MAX) \
+	X("compressbody", 0, INT_MAX) \
+	X("tlscache", 0, INT_MAX) \
 	X("port", 1, 65535)
 #undef X
 
-typedef struct module_s module_t;
-struct module_s {
-	char *		name;
-	void *		ptr;
-};
+typedef struct module_s module_t;	/* see module.h */
 
 typedef struct proto_s proto_t;
 struct proto_s {
@@ -96,6 +137,18 @@ struct conn_s {
 	char		addr[INET6_ADDRSTRLEN];
 	int		sock;
 	WOLFSSL		*ssl;
+	int		ktls;	/* KTLS_TX | KTLS_RX: records done by the kernel */
+};
+
+/* iterator over a config db in a read txn of its own, so any number of
+ * iterations can be live at once */
+typedef struct config_iter_s config_iter_t;
+struct config_iter_s {
+	MDB_txn		*txn;
+	MDB_dbi		dbi;
+	MDB_cursor	*cur;
+	MDB_cursor_op	op;
+	config_state_t	state;
 };
 
 typedef struct uri_s uri_t;
@@ -115,10 +168,8 @@ struct uri_s {
 	config_set_int(db, k, deflt, txn, dbi);
 
 extern int debug;
-extern char yield;
-extern module_t *mods;
+extern __thread char yield;
 extern int run;
-extern int semid;
 extern int *socks;
 extern int pid;
 extern int handlers;
@@ -130,12 +181,15 @@ char *	config_dbpath(int argc, char **argv);
 int	config_get(char *key, MDB_val *val, MDB_txn *txn, MDB_dbi dbi);
 int	config_get_copy(const char *db, char *key, MDB_val *val, MDB_txn *txn, MDB_dbi dbi);
 int	config_get_s(const char *db, char *key, char **val, MDB_txn *txn, MDB_dbi dbi);
+int	config_get_int(const char *db, char *key, int *val, MDB_txn *txn, MDB_dbi dbi);
 int	config_del(const char *db, char *key, char *val, MDB_txn *txn, MDB_dbi dbi);
 int	config_init(int argc, char **argv);
+int	config_iter_open(config_iter_t *it, const char *dbname);
+int	config_iter_next(config_iter_t *it, MDB_val *key, MDB_val *val);
+void	config_iter_close(config_iter_t *it);
 void	config_init_db(char *dbpath);
 int	config_int_set(char *klong, int *key, char *val);
 int	config_mime_load();
-module_t *config_module(char *name, size_t len);
 int	config_set(const char *db, MDB_val *key, MDB_val *val, MDB_txn *txn, MDB_dbi dbi, int flags);
 int	config_set_s(const char *db, char *key, char *val, MDB_txn *txn, MDB_dbi dbi);
 int	config_set_int(const char *db, char *key, int val, MDB_txn *txn, MDB_dbi dbi);
@@ -32,6 +32,7 @@ typedef enum {
 	DB_GLOBAL,
 	DB_PROTO,
 	DB_URI,
+	DB_SNI,
 } config_db_idx_t;
 
 extern MDB_env *env;
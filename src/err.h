@@ -43,6 +43,7 @@
 	X(LSD_ERROR_TLS_READ,		"TLS read error") \
 	X(LSD_ERROR_TLS_WRITE,		"TLS write error") \
 	X(LSD_ERROR_NOT_IMPLEMENTED,               "Not implemented") \
+	X(LSD_ERROR_NOMEM,                         "Out of memory") \
 	X(HANDLER_UPGRADE_INVALID_METHOD,	   "Invalid method for client upgrade") \
 	X(HANDLER_UPGRADE_INVALID_HTTP_VERSION,    "Upgrade unsupported in HTTP version") \
 	X(HANDLER_UPGRADE_NO_HOST_HEADER,	   "Host header required for client upgrade") \
@@ -21,33 +21,53 @@
  * If not, see <http://www.gnu.org/licenses/>.
  */
 
+#define _GNU_SOURCE
+
 #include "config.h"
 #include "err.h"
 #include "handler.h"
 #include "log.h"
 #include "lsd.h"
+#include "module.h"
+#include "scoreboard.h"
+#include "server.h"
+#include <arpa/inet.h>
 #include <assert.h>
-#include <dlfcn.h>
 #include <errno.h>
 #include <error.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include <signal.h>
+#include <stdatomic.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/ipc.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <sys/types.h>
-#include <sys/sem.h>
 #include <sys/socket.h>
+#include <sys/select.h>
 #include <sys/wait.h>
 #include <netdb.h>
+#include <time.h>
 #include <unistd.h>
 
+static _Atomic int workers;	/* worker threads still running */
+static int nsocks;		/* listening sockets */
+
 void handler_close(void)
 {
+	if (sb && sb_slot >= 0) scoreboard_state(SLOT_STOPPING, -1);
+	if (atomic_load(&workers)) {
+		/* interrupted with threads still running modules, which we
+		 * mustn't unload under them */
+		DEBUG("handler exiting");
+		_exit(0);
+	}
 	if (yield) config_yield_free();
+	server_close(nsocks);
 	config_unload_modules();
-	free(socks);
 	config_close();
 	DEBUG("handler exiting");
 	_exit(0);
@@ -63,13 +83,13 @@ static void *get_in_addr(struct sockaddr *sa)
 
 static int handle_connection(int idx, int sock)
 {
-	MDB_val val = { 0, NULL };
+	dispatch_t *d = &dispatch[idx];
 	conn_t c = {0};
-	module_t *mod;
-	int err = 0;
 	struct sockaddr sa = {0};
 	socklen_t slen = sizeof(struct sockaddr_in6);
 
+	if (!d->conn) FAIL(LSD_ERROR_NOHANDLER);
+
 	/* get IP address of peer */
 	if (!getpeername(sock, &sa, &slen))
 		inet_ntop(sa.sa_family, get_in_addr((struct sockaddr *)&sa),
@@ -77,112 +97,298 @@ static int handle_connection(int idx, int sock)
 
 	DEBUG("connection received on socket %i", idx);
 	c.sock = sock;
-	for (int i = 0; config_yield_s(DB_PROTO, "proto", &val) == CONFIG_NEXT; i++) {
-		if (idx == i) break;
-	}
-	if (val.mv_size > 0) {
-		/* call handler module */
-		c.proto = (proto_t *)val.mv_data;
-		mod = (module_t *)config_module(c.proto->module, strlen(c.proto->module));
-		if (!mod) goto handle_connection_err;
-		int (* conn)(conn_t*);
-		*(void **)(&conn) = dlsym(mod->ptr, "conn");
-		if (conn) {
-			err = conn(&c);
-			goto handle_connection_exit;
+	c.proto = d->proto;
+
+	return d->conn(&c);
+}
+
+/* accept a connection on listening socket idx, returning new socket or -1 */
+static int handler_accept(int idx)
+{
+	int sock;
+	int flags = 0;
+
+	/* modules that cope with nonblocking sockets get one straight away */
+	if (dispatch[idx].flags & LSD_MODULE_NONBLOCK) flags |= SOCK_NONBLOCK;
+	if ((sock = accept4(socks[idx], NULL, NULL, flags)) == -1) {
+		switch (errno) {
+		case EAGAIN:
+#if EAGAIN != EWOULDBLOCK
+		case EWOULDBLOCK:
+#endif
+		case EINTR:
+		case ECONNABORTED:
+			/* another handler got there first, or client went away */
+			break;
+		case EMFILE:
+		case ENFILE:
+			/* out of descriptors. The listening socket stays readable,
+			 * so rather than spin, give our connections time to close */
+			DEBUG("accept(): %s", strerror(errno));
+			nanosleep(&(struct timespec){ .tv_nsec = HANDLER_FD_BACKOFF * 1000000L }, NULL);
+			break;
+		case EBADF:
+			DEBUG("accept(): BADF");
+			break;
+		case EINVAL:
+			DEBUG("accept(): EINVAL");
+			break;
+		case ENOTSOCK:
+			DEBUG("accept(): ENOTSOCK");
+			break;
+		case EOPNOTSUPP:
+			/* TODO: not SOCK_STREAM */
+			DEBUG("accept(): not SOCK_STREAM");
+			break;
+		default:
+			perror("accept()");
 		}
-		else goto handle_connection_err;
 	}
-	config_yield_free();
-	FAIL(LSD_ERROR_NOHANDLER);
-handle_connection_exit:
-	config_yield_free();
-	return err;
-
-handle_connection_err:
-	config_yield_free();
-	ERRMSG(LSD_ERROR_NOHANDLER);
-	FAILMSG(LSD_ERROR_NOHANDLER, "%s", dlerror());
+	return sock;
 }
 
-static int handler_get_socket(int n, fd_set fds[], int *sock)
+static int maxconn;		/* connections before recycling, 0=unlimited */
+static int batchmax;		/* connections each thread accepts per wakeup */
+static _Atomic int conns;	/* connections accepted by all threads */
+static int stopfd = -1;		/* eventfd, wakes every thread to exit */
+static int reuseport;		/* listening sockets are ours alone */
+
+void handler_stop(void)
 {
+	run = 0;
+	if (stopfd != -1) eventfd_write(stopfd, 1);
+}
+
+/* reserve one of our maxconn connections, returning 0 if none left */
+static int handler_reserve(void)
+{
+	if (atomic_fetch_add(&conns, 1) < maxconn || !maxconn) return 1;
+	atomic_fetch_sub(&conns, 1);
+	return 0;
+}
+
+#ifdef USE_SELECT
+static int nfds;
+
+static int handler_poll_init(int n)
+{
+	nfds = stopfd;
 	for (int i = 0; i < n; i++) {
-		for (int j = 0; j < 3; j++) {
-			if (FD_ISSET(socks[i], &fds[j])) {
-				*sock = accept(socks[i], NULL, NULL);
-				if (*sock == -1) {
-					switch (errno) {
-					case EBADF:
-						DEBUG("accept(): BADF");
-						break;
-					case EINVAL:
-						DEBUG("accept(): EINVAL");
-						break;
-					case ENOTSOCK:
-						DEBUG("accept(): ENOTSOCK");
-						break;
-					case EOPNOTSUPP:
-						/* TODO: not SOCK_STREAM */
-						DEBUG("accept(): not SOCK_STREAM");
-						break;
-					default:
-						perror("accept()");
-					}
-				}
-				else {
-					return i;
+		if (socks[i] > nfds) nfds = socks[i];
+	}
+	nfds++; /* highest socket number + 1 */
+	return 0;
+}
+
+/* wait for listening sockets, returning count of indexes written to ready */
+static int handler_poll(int pfd, int n, int ready[], int max)
+{
+	fd_set fds;
+	int ret, r = 0;
+
+	(void) pfd;
+	/* select() modifies fds, so rebuild each time around */
+	FD_ZERO(&fds);
+	FD_SET(stopfd, &fds);
+	for (int i = 0; i < n; i++) { FD_SET(socks[i], &fds); }
+	if ((ret = select(nfds, &fds, NULL, NULL, NULL)) == -1) return -1;
+	for (int i = 0; i < n && r < ret && r < max; i++) {
+		if (FD_ISSET(socks[i], &fds)) ready[r++] = i;
+	}
+	return r;
+}
+
+static void handler_poll_free(int pfd)
+{
+	(void) pfd;
+}
+#else
+#ifndef EPOLLEXCLUSIVE
+#define EPOLLEXCLUSIVE 0 /* kernel headers too old, accept the herd */
+#endif
+#define HANDLER_STOPFD UINT32_MAX
+
+/* create epoll instance for one thread, returning its fd */
+static int handler_poll_init(int n)
+{
+	struct epoll_event ev = {0};
+	int pfd;
+
+	if ((pfd = epoll_create1(EPOLL_CLOEXEC)) == -1)
+		DIE("epoll_create1() error: %s", strerror(errno));
+
+	/* each thread has its own epoll instance on the shared listening
+	 * sockets. EPOLLEXCLUSIVE wakes one waiter per connection, instead of
+	 * every thread of every handler */
+	ev.events = EPOLLIN | EPOLLEXCLUSIVE;
+	for (int i = 0; i < n; i++) {
+		ev.data.u32 = i;
+		if (epoll_ctl(pfd, EPOLL_CTL_ADD, socks[i], &ev) == -1)
+			DIE("epoll_ctl() error: %s", strerror(errno));
+	}
+	/* not exclusive: stopping must wake everyone */
+	ev.events = EPOLLIN;
+	ev.data.u32 = HANDLER_STOPFD;
+	if (epoll_ctl(pfd, EPOLL_CTL_ADD, stopfd, &ev) == -1)
+		DIE("epoll_ctl() error: %s", strerror(errno));
+
+	return pfd;
+}
+
+/* wait for listening sockets, returning count of indexes written to ready */
+static int handler_poll(int pfd, int n, int ready[], int max)
+{
+	struct epoll_event ev[HANDLER_ACCEPT_BATCH];
+	int ret, r = 0;
+
+	(void) n;
+	if (max > HANDLER_ACCEPT_BATCH) max = HANDLER_ACCEPT_BATCH;
+	if ((ret = epoll_wait(pfd, ev, max, -1)) == -1) return -1;
+	for (int i = 0; i < ret; i++) {
+		if (ev[i].data.u32 != HANDLER_STOPFD) ready[r++] = ev[i].data.u32;
+	}
+	return r;
+}
+
+static void handler_poll_free(int pfd)
+{
+	close(pfd);
+}
+#endif
+
+/* worker thread loop. Every thread, including the handler's main thread,
+ * waits on the listening sockets and serves the connections it accepts.
+ * arg is the thread's poll fd from handler_poll_init() */
+static void *handler_worker(void *arg)
+{
+	int ret;
+	int pfd = (int)(intptr_t)arg;
+	int batch;
+	int ready[HANDLER_ACCEPT_BATCH];
+	int idx[HANDLER_ACCEPT_BATCH];
+	int sock[HANDLER_ACCEPT_BATCH];
+
+	while (run) {
+		if ((ret = handler_poll(pfd, nsocks, ready, batchmax)) == -1) {
+			if (errno == EINTR) continue;
+			perror("handler_poll()");
+			break;
+		}
+
+		/* accept as many waiting connections as we're allowed */
+		batch = 0;
+		for (int i = 0; i < ret && batch < batchmax; i++) {
+			while (batch < batchmax && handler_reserve()) {
+				if ((sock[batch] = handler_accept(ready[i])) == -1) {
+					atomic_fetch_sub(&conns, 1);
+					break;
 				}
+				idx[batch++] = ready[i];
 			}
 		}
+		/* the controller can't see our queues, so tell it what we leave
+		 * waiting while we serve this batch */
+		if (reuseport) scoreboard_queued(server_backlog(nsocks));
+		if (!batch) {
+			if (maxconn && atomic_load(&conns) >= maxconn) break;
+			continue;
+		}
+
+		for (int i = 0; i < batch; i++) {
+			scoreboard_busy(idx[i]);
+			handle_connection(idx[i], sock[i]);
+			close(sock[i]);
+			scoreboard_idle();
+		}
+
+		if (maxconn && atomic_load(&conns) >= maxconn) {
+			DEBUG("handler served %i connections, recycling", maxconn);
+			handler_stop();
+		}
 	}
-	return -1;
-}
+	if (yield) config_yield_free();
+	handler_poll_free(pfd);
 
-/* swap ready for busy semaphore so controller knows we're occupied */
-static inline void handler_semaphore_release(void)
-{
-	struct sembuf sop[2];
-	sop[0].sem_num = HANDLER_RDY;
-	sop[0].sem_op = 1;
-	sop[0].sem_flg = 0;
-	sop[1].sem_num = HANDLER_BSY;
-	sop[1].sem_op = 1;
-	sop[1].sem_flg = SEM_UNDO; /* release semaphore on exit */
-	semop(semid, sop, 2);
+	return NULL;
 }
 
 /* handler child process starting */
 void handler_start(int n)
 {
-	int nfds = 0;
-	int ret;
-	int sock = 0;
-	fd_set fds[3];
+	pthread_t *tid;
+	int *pfd;
+	sigset_t set, oldset;
+	int cpuaffinity = 0;
+	int threads = 1;
+	char db[2];
 
 	/* handler needs own database env */
 	mdb_env_close(env); env = NULL;
 	config_init_db(dbdir);
+	config_db(DB_GLOBAL, db);
+	config_get_int(db, "maxconn", &maxconn, NULL, 0);
+	config_get_int(db, "reuseport", &reuseport, NULL, 0);
+	config_get_int(db, "cpuaffinity", &cpuaffinity, NULL, 0);
+	config_get_int(db, "threads", &threads, NULL, 0);
 
-	/* prepare file descriptors for select() */
-	for (int i = 0; i < 3; i++) { FD_ZERO(&fds[i]); }
-	for (int i = 0; i < n; i++) {
-		for (int j = 0; j < 3; j++) {
-			FD_SET(socks[i], &fds[j]);
+	/* open our own SO_REUSEPORT sockets, so the kernel spreads
+	 * connections across handlers without any shared accept queue */
+	if (reuseport) {
+		if (!(n = server_listen(SERVER_REUSEPORT | SERVER_HANDLER)))
+			handler_close();
+		if (cpuaffinity) server_cpu_affinity(n, sb_slot);
+	}
+	nsocks = n;
+
+	/* run one thread unless every module we dispatch to can take more */
+	for (int i = 0; threads > 1 && i < n; i++) {
+		if (dispatch[i].conn && !(dispatch[i].flags & LSD_MODULE_THREADSAFE)) {
+			DEBUG("module '%s' not thread safe, running one thread",
+					dispatch[i].proto->module);
+			threads = 1;
 		}
-		if (socks[i] > nfds) nfds = socks[i];
 	}
-	nfds++; /* highest socket number + 1 */
-	ret = select(nfds, &fds[0], &fds[1], &fds[2], NULL);
-	if (ret == -1)
-		perror("select()");
-	else if (ret) {
-		ret = handler_get_socket(n, fds, &sock);
-		if (ret != -1 && sock > 0) {
-			handler_semaphore_release();
-			handle_connection(ret, sock);
-			close(sock);
+
+	if ((stopfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1)
+		DIE("eventfd() error: %s", strerror(errno));
+
+	/* a thread accepting a batch leaves its siblings idle, so split the
+	 * batch between threads */
+	if ((batchmax = HANDLER_ACCEPT_BATCH / threads) < 1) batchmax = 1;
+
+	/* workers block our signals, leaving them to the main thread, which
+	 * wakes the others through stopfd */
+	tid = calloc(threads, sizeof(pthread_t));
+	pfd = calloc(threads, sizeof(int));
+	if (!tid || !pfd) DIE("out of memory");
+	for (int i = 0; i < threads; i++) { pfd[i] = handler_poll_init(n); }
+	sigemptyset(&set);
+	sigaddset(&set, SIGHUP);
+	sigaddset(&set, SIGINT);
+	pthread_sigmask(SIG_BLOCK, &set, &oldset);
+	for (int i = 1; i < threads; i++) {
+		if ((errno = pthread_create(&tid[i], NULL, handler_worker,
+						(void *)(intptr_t)pfd[i])))
+		{
+			ERROR("pthread_create() error: %s", strerror(errno));
+			while (i < threads) handler_poll_free(pfd[--threads]);
+			break;
 		}
+		atomic_fetch_add(&workers, 1);
+	}
+	pthread_sigmask(SIG_SETMASK, &oldset, NULL);
+	DEBUG("handler running %i threads", threads);
+
+	scoreboard_threads(threads);
+	scoreboard_state(SLOT_READY, -1);
+	handler_worker((void *)(intptr_t)pfd[0]);
+
+	handler_stop();
+	for (int i = 1; i < threads; i++) {
+		pthread_join(tid[i], NULL);
+		atomic_fetch_sub(&workers, 1);
 	}
+	free(pfd);
+	free(tid);
 	handler_close();
 }
@@ -25,6 +25,11 @@
 #define __HANDLER_H 1
 
 void handler_close();
+
+/* stop accepting and exit once connections in hand are done.
+ * Safe to call from a signal handler */
+void handler_stop(void);
+
 void handler_start(int n);
 
 #endif /* __HANDLER_H */
@@ -0,0 +1,44 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ *
+ * hash.h
+ *
+ * this file is part of LIBRESTACK
+ *
+ * Copyright (c) 2012-2020 Brett Sheffield <bacs@librecast.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program (see the file COPYING in the distribution).
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __HASH_H
+#define __HASH_H 1
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* FNV-1a hash of len bytes */
+uint32_t hash_fnv1a32(const void *data, size_t len);
+uint64_t hash_fnv1a64(const void *data, size_t len);
+
+/* as wide as size_t, for indexing tables */
+static inline size_t hash_fnv1a(const void *data, size_t len)
+{
+#if SIZE_MAX > UINT32_MAX
+	return (size_t)hash_fnv1a64(data, len);
+#else
+	return (size_t)hash_fnv1a32(data, len);
+#endif
+}
+
+#endif /* __HASH_H */
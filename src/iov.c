@@ -21,34 +21,179 @@
  * If not, see <http://www.gnu.org/licenses/>.
  */
 
+#define _GNU_SOURCE
+
 #include "iov.h"
 #include "log.h"
+#include <ctype.h>
 #include <errno.h>
-#include <fnmatch.h>
 #include <stdarg.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
-int iovmatch(struct iovec *pattern, struct iovec *string, int flags)
+#define GLOB_CLASSES(X) \
+	X("alnum", isalnum) X("alpha", isalpha) X("blank", isblank) \
+	X("cntrl", iscntrl) X("digit", isdigit) X("graph", isgraph) \
+	X("lower", islower) X("print", isprint) X("punct", ispunct) \
+	X("space", isspace) X("upper", isupper) X("xdigit", isxdigit)
+#define GLOB_CLASS(name, fn) \
+	if (len == sizeof name - 1 && !memcmp(p, name, len)) return fn(c) != 0;
+
+static int glob_class(const char *p, size_t len, int c)
 {
-	char *p = strndup(pattern->iov_base, pattern->iov_len);
-	char *s = strndup(string->iov_base, string->iov_len);
-	int ret = fnmatch(p, s, flags);
-	free(s);
-	free(p);
-	return ret;
+	GLOB_CLASSES(GLOB_CLASS)
+	return -1;
 }
 
-/* return length of matching iovecs */
-size_t iov_matchlen(struct iovec *path, struct iovec *pattern)
+static int glob_fold(int c, int flags)
 {
-	size_t i;
-	for (i = 0; i < pattern->iov_len; i++) {
-		if (((char *)pattern->iov_base)[i] != ((char *)path->iov_base)[i])
-			break;
+	return (flags & FNM_CASEFOLD) ? tolower(c) : c;
+}
+
+/* match c against bracket expression at p[0] == '[', setting match and
+ * returning length of expression, or 0 if unterminated ('[' is literal) */
+static size_t glob_bracket(const char *p, size_t len, int c, int flags, int *match)
+{
+	size_t i = 1, first;
+	int negate = 0, found = 0;
+	int lo, hi, ret;
+	const char *end;
+
+	if (i < len && (p[i] == '!' || p[i] == '^')) { negate = 1; i++; }
+	for (first = i; i < len; i++) {
+		if (p[i] == ']' && i > first) {
+			*match = found != negate;
+			return i + 1;
+		}
+		if (p[i] == '[' && i + 1 < len && p[i + 1] == ':'
+		&& (end = memmem(p + i + 2, len - i - 2, ":]", 2)))
+		{
+			if ((ret = glob_class(p + i + 2, end - p - i - 2, c)) == -1)
+				return 0; /* unknown class */
+			if (ret) found = 1;
+			i = end - p + 1;
+			continue;
+		}
+		if (p[i] == '\\' && !(flags & FNM_NOESCAPE) && i + 1 < len) i++;
+		lo = hi = (unsigned char)p[i];
+		if (i + 2 < len && p[i + 1] == '-' && p[i + 2] != ']') {
+			i += 2;
+			if (p[i] == '\\' && !(flags & FNM_NOESCAPE) && i + 1 < len) i++;
+			hi = (unsigned char)p[i];
+		}
+		if (glob_fold(c, flags) >= glob_fold(lo, flags)
+		&&  glob_fold(c, flags) <= glob_fold(hi, flags))
+			found = 1;
+	}
+	return 0;
+}
+
+/* is s[i] a period that only a literal period may match? */
+static int glob_leading(const char *s, size_t i, int flags)
+{
+	if (!(flags & FNM_PERIOD) || s[i] != '.') return 0;
+	return (i == 0 || ((flags & FNM_PATHNAME) && s[i - 1] == '/'));
+}
+
+int iovglob(struct iovec *pattern, struct iovec *string, int flags, size_t *matchlen)
+{
+	const char *p = pattern->iov_base;
+	const char *s = string->iov_base;
+	const size_t plen = pattern->iov_len;
+	const size_t slen = string->iov_len;
+	size_t pi = 0, si = 0;
+	size_t star = SIZE_MAX, stars = 0;	/* where to resume after '*' */
+	size_t prefix = SIZE_MAX;		/* bytes before first wildcard */
+	size_t n;
+	int c, match;
+
+	while (si < slen) {
+		c = (unsigned char)s[si];
+		if (pi < plen) {
+			switch (p[pi]) {
+			case '*':
+				if (prefix == SIZE_MAX) prefix = si;
+				if (glob_leading(s, si, flags)) return FNM_NOMATCH;
+				while (pi < plen && p[pi] == '*') pi++;
+				star = pi;
+				stars = si;
+				continue;
+			case '?':
+				if (prefix == SIZE_MAX) prefix = si;
+				if ((flags & FNM_PATHNAME) && c == '/') break;
+				if (glob_leading(s, si, flags)) break;
+				pi++; si++;
+				continue;
+			case '[':
+				if (!(n = glob_bracket(p + pi, plen - pi, c, flags, &match)))
+					goto literal; /* unterminated, so not a bracket */
+				if (prefix == SIZE_MAX) prefix = si;
+				if ((flags & FNM_PATHNAME) && c == '/') break;
+				if (glob_leading(s, si, flags) || !match) break;
+				pi += n; si++;
+				continue;
+			case '\\':
+				if (!(flags & FNM_NOESCAPE)) {
+					/* a trailing escape escapes nothing, so matches nothing */
+					if (++pi == plen) return FNM_NOMATCH;
+				}
+				/* fall through */
+			default:
+literal:
+				if (glob_fold(p[pi], flags) != glob_fold(c, flags)) break;
+				pi++; si++;
+				continue;
+			}
+		}
+		/* mismatch, let the last '*' take one more byte and try again */
+		if (star == SIZE_MAX) return FNM_NOMATCH;
+		if ((flags & FNM_PATHNAME) && s[stars] == '/') return FNM_NOMATCH;
+		pi = star;
+		si = ++stars;
+	}
+	/* string used up, whatever is left of pattern must match nothing */
+	for (; pi < plen && p[pi] == '*'; pi++) {
+		if (prefix == SIZE_MAX) prefix = si;
+	}
+	if (pi < plen) return FNM_NOMATCH;
+	if (matchlen) *matchlen = (prefix == SIZE_MAX) ? slen : prefix;
+
+	return 0;
+}
+
+void iovglob_compile(iovglob_t *g, struct iovec *pattern, int flags)
+{
+	const char *p = pattern->iov_base;
+	const char *meta = (flags & FNM_NOESCAPE) ? "*?[" : "*?[\\";
+
+	g->pattern = *pattern;
+	g->flags = flags;
+	for (g->prefix = 0; g->prefix < pattern->iov_len; g->prefix++) {
+		if (strchr(meta, p[g->prefix])) break;
 	}
-	return i;
+	g->literal = (g->prefix == pattern->iov_len);
+}
+
+int iovglob_match(iovglob_t *g, struct iovec *string, size_t *matchlen)
+{
+	/* the literal part decides most mismatches without the matcher */
+	if (g->literal && g->pattern.iov_len != string->iov_len) return FNM_NOMATCH;
+	if (g->prefix > string->iov_len) return FNM_NOMATCH;
+	if (!(g->flags & FNM_CASEFOLD)
+	&& memcmp(g->pattern.iov_base, string->iov_base, g->prefix))
+		return FNM_NOMATCH;
+	if (g->literal && !(g->flags & FNM_CASEFOLD)) {
+		if (matchlen) *matchlen = string->iov_len;
+		return 0;
+	}
+	return iovglob(&g->pattern, string, g->flags, matchlen);
+}
+
+int iovmatch(struct iovec *pattern, struct iovec *string, int flags)
+{
+	return iovglob(pattern, string, flags, NULL);
 }
 
 int iovcmp(struct iovec *c1, struct iovec *c2)
@@ -87,7 +232,9 @@ int iovstrtokmatch(struct iovec *c1, char *c2, const char *delim)
 
 int iovstrcmp(struct iovec *k, void *ptr)
 {
-	return memcmp(k->iov_base, ptr, k->iov_len);
+	size_t len = strlen(ptr);
+	if (k->iov_len != len) return (k->iov_len < len) ? -1 : 1;
+	return (len) ? memcmp(k->iov_base, ptr, len) : 0;
 }
 
 int iovstrncmp(struct iovec *k, void *ptr, size_t len)
@@ -24,8 +24,13 @@
 #ifndef __IOV_H
 #define __IOV_H 1
 
+#include <fnmatch.h>
 #include <sys/uio.h>
 
+#ifndef FNM_CASEFOLD
+#define FNM_CASEFOLD (1 << 4) /* GNU extension, as glibc */
+#endif
+
 typedef struct iovstack_s iovstack_t;
 struct iovstack_s {
 	struct iovec *iov;		/* iovec array */
@@ -34,8 +39,26 @@ struct iovstack_s {
 	size_t nmemb;			/* min amount to extend stack by each time */
 };
 
+/* glob pattern, compiled by iovglob_compile() */
+typedef struct iovglob_s iovglob_t;
+struct iovglob_s {
+	struct iovec pattern;
+	size_t prefix;			/* length of literal prefix */
+	int flags;			/* FNM_* */
+	char literal;			/* no wildcards at all */
+};
+
+/* match string against glob pattern, as fnmatch() with FNM_NOESCAPE,
+ * FNM_PATHNAME, FNM_PERIOD and FNM_CASEFOLD, but on iovecs and without
+ * allocating. Returns 0 on match, else FNM_NOMATCH. If matchlen is not NULL,
+ * it is set to the length of string matched before the first wildcard */
+int iovglob(struct iovec *pattern, struct iovec *string, int flags, size_t *matchlen);
+
+/* compile pattern for iovglob_match(). pattern must outlive g */
+void iovglob_compile(iovglob_t *g, struct iovec *pattern, int flags);
+int iovglob_match(iovglob_t *g, struct iovec *string, size_t *matchlen);
+
 int iovmatch(struct iovec *pattern, struct iovec *string, int flags);
-size_t iov_matchlen(struct iovec *path, struct iovec *pattern);
 int iovcmp(struct iovec *c1, struct iovec *c2);
 int iovstrcmp(struct iovec *k, void *ptr);
 int iovstrncmp(struct iovec *k, void *ptr, size_t len);
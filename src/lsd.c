@@ -26,132 +26,272 @@
 #include "handler.h"
 #include "log.h"
 #include "lsd.h"
+#include "module.h"
+#include "scoreboard.h"
+#include "server.h"
 #include <arpa/inet.h>
 #include <assert.h>
 #include <dlfcn.h>
 #include <errno.h>
-#include <error.h>
 #include <fcntl.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/ipc.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
 #include <sys/types.h>
-#include <sys/sem.h>
 #include <sys/socket.h>
 #include <sys/wait.h>
+#include <netinet/in.h>
 #include <netdb.h>
 #include <unistd.h>
 
-static int server_listen(void)
+#define CONTROLLER_TICK 1000 /* ms between pool checks when nothing happens */
+#define CONTROLLER_TICK_GROW 50 /* ms between pool checks while growing */
+
+static int sfd = -1;	/* signalfd */
+static int cfd = -1;	/* controller epoll fd */
+static int nsocks;	/* listening sockets held by controller */
+static sigset_t oldmask;
+
+/* pool sizing, from config */
+static struct {
+	int min;		/* handlers to keep ready */
+	int max;		/* most handler processes */
+	int spawnrate;		/* most handlers to fork per check */
+	int idletimeout;	/* seconds before surplus idle handlers exit */
+	int rate;		/* current spawn rate, doubles while short */
+} pool;
+
+/* handlers only. The controller takes its signals through signalfd */
+static void sighup_handler(int __attribute__((unused)) signo)
 {
-	struct addrinfo hints = {0};
-	struct addrinfo *a = NULL;
-	struct addrinfo *ai = NULL;
-	char cport[6];
-	int n = 0;
-	int sock = -1;
-	int yes = 1;
-	proto_t *p;
-	MDB_val val;
+	TRACE("%s()", __func__);
+	/* finish any connections in hand, then exit so the controller
+	 * can replace us with a handler running the new config */
+	DEBUG("HUP received by handler");
+	handler_stop();
+}
 
+static void sigint_handler(int __attribute__((unused)) signo)
+{
 	TRACE("%s()", __func__);
+	DEBUG("INT received by handler");
+	handler_close();
+}
 
-	/* allocate an array for sockets */
-	while (config_yield_s(DB_PROTO, "proto", &val) == CONFIG_NEXT) { n++; }
-	config_yield_free();
-	DEBUG("n = %i", n);
-
-	if (!n) return 0;
-	socks = calloc(n, sizeof(int));
-	n = 0;
-
-	/* listen on all ports and protocols listed in config */
-	hints.ai_family = AF_UNSPEC;
-	hints.ai_flags = AI_PASSIVE;
-	while (config_yield_s(DB_PROTO, "proto", &val) == CONFIG_NEXT) {
-		p = val.mv_data;
-		hints.ai_socktype = p->socktype;
-		hints.ai_protocol = p->protocol; /* optional */
-		sprintf(cport, "%u", p->port);
-		for (int e = getaddrinfo(p->addr, cport, &hints, &a); a; a = a->ai_next) {
-			if (e) FAILMSG(LSD_ERROR_GETADDRINFO, strerror(e));
-			if (!ai) ai = a;
-			if ((sock = socket(a->ai_family, a->ai_socktype, a->ai_protocol)) == -1)
-				continue;
-			if ((setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(int))) == -1)
-				continue;
-			if ((bind(sock, a->ai_addr, a->ai_addrlen)) == -1)
-				continue;
-			break;
-		}
-		freeaddrinfo(ai); ai = NULL;
-		if (sock != -1) {
-			if (p->socktype == SOCK_STREAM) {
-				(socks)[n] = sock;
-				INFO("Listening on [%s]:%s", p->addr, cport);
-				if ((listen((sock), BACKLOG)) == -1)
-					DIE("listen() error: %s", strerror(errno));
-			}
-			n++;
-		}
+/* send signo to every live handler */
+static void controller_signal(int signo)
+{
+	pid_t hpid;
+	for (int i = 0; i < sb->max; i++) {
+		if ((hpid = atomic_load(&sb->slot[i].pid)) > 0) kill(hpid, signo);
 	}
-	config_yield_free();
+}
+
+static void controller_spawn(int n)
+{
+	int slot;
 
-	return n;
+	if ((slot = scoreboard_claim()) == -1) return;
+	DEBUG("forking new handler");
+	if ((pid = fork()) == -1) {
+		ERROR("fork failed: %s", strerror(errno));
+		atomic_store(&sb->slot[slot].state, SLOT_FREE);
+		return;
+	}
+	if (pid == 0) { /* child handler process */
+		sb_slot = slot;
+		atomic_store(&sb->slot[slot].pid, getpid());
+		close(cfd); close(sfd);
+		signal(SIGHUP, sighup_handler);
+		signal(SIGINT, sigint_handler);
+		sigprocmask(SIG_SETMASK, &oldmask, NULL);
+		DEBUG("handler %i started", slot);
+		handler_start(n);
+	}
+	atomic_store(&sb->slot[slot].pid, pid);
+	handlers++;
 }
 
-static void sigchld_handler(int __attribute__((unused)) signo)
+/* reap exited handlers, freeing their slots */
+static void controller_reap(void)
 {
-	struct sembuf sop;
+	pid_t hpid;
+	int slot;
 
-	TRACE("%s()", __func__);
-	while (waitpid(-1, NULL, WNOHANG) > 0) --handlers; /* reap children */
-
-	/* check handler count, in case any were killed */
-	if (handlers < HANDLER_MIN) {
-		int n = HANDLER_MIN - handlers;
-		DEBUG("handler(s) killed, creating %i handlers", n);
-		sop.sem_num = HANDLER_RDY;
-		sop.sem_op = n;
-		sop.sem_flg = 0;
-		semop(semid, &sop, 1);
+	while ((hpid = waitpid(-1, NULL, WNOHANG)) > 0) {
+		if ((slot = scoreboard_release(hpid)) == -1) continue;
+		DEBUG("handler %i (pid %i) exited", slot, hpid);
+		module_reap(hpid);
+		handlers--;
 	}
 }
 
-static void sighup_handler(int __attribute__((unused)) signo)
+/* (re)read pool sizing from config */
+static void controller_config(void)
 {
-	TRACE("%s()", __func__);
-	if (pid > 0) {
-		DEBUG("HUP received by controller");
-		/* reload config */
-		DEBUG("reloading config");
-		config_init(0, NULL);
+	char db[2];
+
+	pool.min = HANDLER_MIN;
+	pool.max = HANDLER_MAX;
+	pool.spawnrate = HANDLER_SPAWN_RATE;
+	pool.idletimeout = HANDLER_IDLE_TIMEOUT;
+	config_db(DB_GLOBAL, db);
+	config_get_int(db, "minhandlers", &pool.min, NULL, 0);
+	config_get_int(db, "maxhandlers", &pool.max, NULL, 0);
+	config_get_int(db, "spawnrate", &pool.spawnrate, NULL, 0);
+	config_get_int(db, "idletimeout", &pool.idletimeout, NULL, 0);
+	if (pool.max < 1 || pool.max > HANDLER_LIMIT) pool.max = HANDLER_LIMIT;
+	if (pool.min < 0) pool.min = 0;
+	if (pool.min > pool.max) pool.min = pool.max;
+	if (pool.spawnrate < 1) pool.spawnrate = 1;
+	if (pool.idletimeout < 0) pool.idletimeout = 0;
+	pool.rate = 1;
+	if (sb) sb->min = pool.min;
+	DEBUG("pool: min=%i max=%i spawnrate=%i idletimeout=%i",
+		pool.min, pool.max, pool.spawnrate, pool.idletimeout);
+}
+
+/* ask the handler that has been idle longest past idletimeout to exit */
+static void controller_shrink(void)
+{
+	slot_t *slot;
+	slot_t *idle = NULL;
+	time_t now = time(NULL);
+	time_t since;
+	int state = SLOT_READY;
+
+	for (int i = 0; i < sb->max; i++) {
+		slot = &sb->slot[i];
+		if (atomic_load(&slot->state) != SLOT_READY) continue;
+		if (atomic_load(&slot->busy)) continue; /* threads still working */
+		since = atomic_load(&slot->since);
+		if (now - since < pool.idletimeout) continue;
+		if (!idle || since < atomic_load(&idle->since)) idle = slot;
 	}
-	else {
-		DEBUG("HUP received by handler");
+	if (!idle) return;
+	if (!atomic_compare_exchange_strong(&idle->state, &state, SLOT_STOPPING))
+		return; /* it just got busy */
+	atomic_fetch_sub(&sb->ready, 1);
+	DEBUG("stopping idle handler (pid %i)", atomic_load(&idle->pid));
+	kill(atomic_load(&idle->pid), SIGHUP);
+}
+
+/* size the pool to the load: grow fast while short of ready handlers or
+ * connections are queueing, shrink slowly once handlers sit idle.
+ * Returns number of handlers started */
+static int controller_pool(int n)
+{
+	int ready = scoreboard_count(SLOT_READY);
+	int starting = scoreboard_count(SLOT_STARTING);
+	int want, spawned;
+
+	/* resync the hint handlers use to decide when to wake us */
+	atomic_store(&sb->ready, ready);
+
+	want = pool.min - ready;
+	if (!ready) want += server_backlog(nsocks); /* connections are queueing */
+	/* a reuseport handler's queue is its own, and waits on that handler
+	 * however many others are ready */
+	want += scoreboard_backlog();
+	want -= starting;
+	if (want > pool.rate) want = pool.rate;
+	if (want > pool.max - handlers) want = pool.max - handlers;
+	if (want <= 0) {
+		pool.rate = 1;
+		if (pool.idletimeout && ready > pool.min) controller_shrink();
+		return 0;
 	}
+	for (spawned = 0; run && spawned < want; spawned++) controller_spawn(n);
+	if ((pool.rate *= 2) > pool.spawnrate) pool.rate = pool.spawnrate;
+	DEBUG("pool: %i ready, %i started, %i handlers", ready, spawned, handlers);
+
+	return spawned;
 }
 
-static void sigint_handler(int __attribute__((unused)) signo)
+/* handle signals delivered to the controller */
+static void controller_signalfd(void)
 {
-	TRACE("%s()", __func__);
-	if (pid > 0) {
-		DEBUG("INT received by controller");
-		run = 0;
+	struct signalfd_siginfo si;
+
+	while (read(sfd, &si, sizeof si) == sizeof si) {
+		switch (si.ssi_signo) {
+		case SIGCHLD:
+			controller_reap();
+			break;
+		case SIGHUP:
+			DEBUG("HUP received by controller");
+			DEBUG("reloading config");
+			config_init(0, NULL);
+			module_conf();
+			controller_config();
+			server_dispatch(nsocks);
+			/* recycle handlers so they pick up the new config */
+			controller_signal(SIGHUP);
+			break;
+		case SIGINT:
+		case SIGTERM:
+			DEBUG("%s received by controller", strsignal(si.ssi_signo));
+			run = 0;
+			controller_signal(SIGINT);
+			break;
+		}
 	}
-	else {
-		DEBUG("INT received by handler");
-		handler_close();
+}
+
+static int controller_init(void)
+{
+	struct epoll_event ev = {0};
+	sigset_t mask;
+
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGCHLD);
+	sigaddset(&mask, SIGHUP);
+	sigaddset(&mask, SIGINT);
+	sigaddset(&mask, SIGTERM);
+	if (sigprocmask(SIG_BLOCK, &mask, &oldmask) == -1) return -1;
+	if ((sfd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC)) == -1) return -1;
+	if ((cfd = epoll_create1(EPOLL_CLOEXEC)) == -1) return -1;
+	ev.events = EPOLLIN;
+	ev.data.fd = sfd;
+	if (epoll_ctl(cfd, EPOLL_CTL_ADD, sfd, &ev) == -1) return -1;
+	ev.data.fd = sb->efd;
+	if (epoll_ctl(cfd, EPOLL_CTL_ADD, sb->efd, &ev) == -1) return -1;
+	return 0;
+}
+
+static void controller_loop(int n)
+{
+	struct epoll_event ev[2];
+	eventfd_t val;
+	int ret;
+	int tick;
+
+	while (run) {
+		tick = (controller_pool(n)) ? CONTROLLER_TICK_GROW : CONTROLLER_TICK;
+		if ((ret = epoll_wait(cfd, ev, 2, tick)) == -1) {
+			if (errno == EINTR) continue;
+			ERROR("epoll_wait(): %s", strerror(errno));
+			break;
+		}
+		for (int i = 0; i < ret; i++) {
+			if (ev[i].data.fd == sfd)
+				controller_signalfd();
+			else
+				eventfd_read(sb->efd, &val); /* handlers running short */
+		}
 	}
 }
 
 int main(int argc, char **argv)
 {
-	int busy;
 	int err;
-	struct sembuf sop[2];
+	int n = 0;
+	int reuseport = 0;
+	char db[2];
 
 	/* process args and config */
 	if ((err = config_init(argc, argv)) != 0) return err;
@@ -162,60 +302,42 @@ int main(int argc, char **argv)
 	INFO("Starting up...");
 
 	config_load_modules();
+	module_conf();
 
 	/* listen on sockets */
-	if (!(run = server_listen())) {
+	config_db(DB_GLOBAL, db);
+	config_get_int(db, "reuseport", &reuseport, NULL, 0);
+	if (!(run = n = server_listen((reuseport) ? SERVER_REUSEPORT : 0))) {
 		INFO("No protocols configured");
 		goto exit_controller;
 	}
+	/* with reuseport, each handler binds its own sockets. We only listened
+	 * to check we could, and any socket we held would steal connections */
+	if (reuseport) {
+		server_close(n);
+		n = 0;
+	}
 
 	/* TODO: drop privs */
 
 	/* TODO: daemonize? fork */
 
-	/* initialize semaphores */
-	semid = semget(IPC_PRIVATE, 2, IPC_CREAT | IPC_EXCL | S_IRUSR | S_IWUSR);
-	if (semid == -1) DIE("Unable to create semaphore");
-	if ((err = semctl(semid, HANDLER_RDY, SETVAL, HANDLER_MIN)) == -1)
-			error_at_line(1, errno, __FILE__, __LINE__-1, "semctl %i", errno);
-	if ((err = semctl(semid, HANDLER_BSY, SETVAL, 0)) == -1)
-			error_at_line(1, errno, __FILE__, __LINE__-1, "semctl %i", errno);
-	sop[0].sem_num = HANDLER_RDY;
-	sop[0].sem_op = -1; /* decrement */
-	sop[0].sem_flg = 0;
-
-	/* set signal handlers */
-	signal(SIGCHLD, sigchld_handler);
-	signal(SIGHUP, sighup_handler);
-	signal(SIGINT, sigint_handler);
+	/* let modules build anything handlers should share before we fork */
+	if ((err = module_warmup()))
+		ERROR("module warmup failed: %s", err_msg(err));
 
-	while (run) {
-		/* get HANDLER_RDY semaphore before continuing */
-		if ((err = semop(semid, sop, 1)) == -1) {
-			if (errno == EINTR) continue;
-			break;
-		}
-		if (handlers >= HANDLER_MAX) continue;
-		if ((busy = semctl(semid, HANDLER_BSY, GETVAL)) == -1)
-			CONTINUE(LOG_ERROR, "unable to read busy semaphore");
-		if ((handlers - busy) >= HANDLER_MIN) continue;
-		DEBUG("forking new handler");
-		if ((pid = fork()) == -1) {
-			ERROR("fork failed");
-			sop[0].sem_op = 1; /* increment */
-			semop(semid, sop, 1);
-			sop[0].sem_op = -1;
-			continue;
-		}
-		handlers++;
-		if (pid == 0) { /* child handler process */
-			DEBUG("handler %i started", handlers);
-			handler_start(run);
-		}
-	}
+	nsocks = n;
+	controller_config();
+	if (!scoreboard_init(pool.min, HANDLER_LIMIT))
+		DIE("Unable to create scoreboard");
+	if (controller_init() == -1)
+		DIE("Unable to set up controller: %s", strerror(errno));
+
+	controller_loop(run);
+
+	scoreboard_free();
 exit_controller:
-	while (handlers) close(socks[handlers--]);
-	free(socks);
+	server_close(n);
 	config_unload_modules();
 	config_close();
 	INFO("Controller exiting");
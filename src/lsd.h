@@ -31,11 +31,21 @@ typedef struct LSD_val {
 	void    *data;
 } LSD_val;
 
-#define BACKLOG 100
-#define HANDLER_MAX 100	/* maximum number of handler processes */
-#define HANDLER_MIN 5   /* minimum number of handlers to keep ready */
-#define HANDLER_RDY 0   /* semapahore to track ready handlers */
-#define HANDLER_BSY 1   /* semapahore to track busy handlers */
+#define BACKLOG 100	/* default listen() backlog */
+#define HANDLER_LIMIT 1024	/* hard limit on handler processes (scoreboard slots) */
+#define HANDLER_MAX 100	/* default maximum number of handler processes */
+#define HANDLER_MIN 5   /* default minimum number of handlers to keep ready */
+#define HANDLER_SPAWN_RATE 32	/* default most handlers to fork per pool check */
+#define HANDLER_IDLE_TIMEOUT 60	/* default seconds before surplus idle handlers exit */
+#define HANDLER_ACCEPT_BATCH 8 /* max connections accepted per wakeup */
+#define HANDLER_THREADS_MAX 256	/* hard limit on worker threads per handler */
+#define HANDLER_FD_BACKOFF 10	/* ms to stop accepting when out of file descriptors */
+#define FILECACHE_SIZE 1024	/* default static files each handler keeps open */
+#define FILECACHE_FD_RESERVE 64	/* descriptors the file cache leaves for everything else */
+#define COMPRESS_MIN 1024	/* default smallest static file worth a compressed copy */
+#define COMPRESS_BODY_MIN 4096	/* default smallest body worth compressing per request */
+#define TLSCACHE_SIZE 1024	/* default TLS sessions kept for resumption */
+#define DB_READERS (HANDLER_LIMIT * 16) /* lmdb reader slots, one per open read txn */
 #define PROGRAM_NAME "lsd"
 
 #endif /* __LSD_H */
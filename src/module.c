@@ -0,0 +1,226 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ *
+ * module.c
+ *
+ * this file is part of LIBRESTACK
+ *
+ * Copyright (c) 2012-2020 Brett Sheffield <bacs@librecast.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program (see the file COPYING in the distribution).
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include "err.h"
+#include "hash.h"
+#include "log.h"
+#include "module.h"
+#include <dlfcn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MODULE_BUCKETS 16 /* initial size of registry, doubles as it fills */
+
+static module_t **bucket;	/* hash of loaded modules */
+static size_t buckets;
+static module_t **order;	/* modules in load order */
+static size_t loaded;
+static size_t ordersz;
+
+static int module_insert(module_t *mod)
+{
+	module_t **tmp;
+	size_t h;
+
+	/* grow registry, keeping chains short */
+	if (loaded >= buckets) {
+		size_t n = (buckets) ? buckets * 2 : MODULE_BUCKETS;
+		if (!(tmp = calloc(n, sizeof(module_t *)))) return -1;
+		for (size_t i = 0; i < loaded; i++) {
+			h = hash_fnv1a(order[i]->name, strlen(order[i]->name)) & (n - 1);
+			order[i]->next = tmp[h];
+			tmp[h] = order[i];
+		}
+		free(bucket);
+		bucket = tmp;
+		buckets = n;
+	}
+	if (loaded == ordersz) {
+		size_t n = (ordersz) ? ordersz * 2 : MODULE_BUCKETS;
+		if (!(tmp = realloc(order, n * sizeof(module_t *)))) return -1;
+		order = tmp;
+		ordersz = n;
+	}
+	h = hash_fnv1a(mod->name, strlen(mod->name)) & (buckets - 1);
+	mod->next = bucket[h];
+	bucket[h] = mod;
+	order[loaded++] = mod;
+
+	return 0;
+}
+
+module_t *module_find(const char *name, size_t len)
+{
+	module_t *mod;
+
+	if (!buckets) return NULL;
+	for (mod = bucket[hash_fnv1a(name, len) & (buckets - 1)]; mod; mod = mod->next) {
+		if (!strncmp(mod->name, name, len) && mod->name[len] == '\0')
+			return mod;
+	}
+	return NULL;
+}
+
+/* collect loose symbols of a module without an ops table */
+static lsd_module_ops_t *module_legacy(module_t *mod)
+{
+	lsd_module_ops_t *ops = &mod->legacy;
+
+	ops->name = mod->name;
+	*(void **)(&ops->init) = dlsym(mod->ptr, "init");
+	*(void **)(&ops->conf) = dlsym(mod->ptr, "conf");
+	*(void **)(&ops->conn) = dlsym(mod->ptr, "conn");
+	*(void **)(&ops->load_uri) = dlsym(mod->ptr, "load_uri");
+	*(void **)(&ops->finit) = dlsym(mod->ptr, "finit");
+
+	return ops;
+}
+
+static void module_free(module_t *mod)
+{
+	if (mod->ops && mod->ops->finit) mod->ops->finit();
+	dlclose(mod->ptr);
+	free(mod->name);
+	free(mod);
+}
+
+module_t *module_load(const char *name, size_t len)
+{
+	char modpath[] = "../modules:/usr/local/lib:/usr/lib:/usr/local/sbin"; /* TODO - configurable */
+	char *saveptr = NULL;
+	char *module;
+	char *path;
+	module_t *mod;
+	size_t size;
+	int err;
+
+	TRACE("%s()", __func__);
+	if ((mod = module_find(name, len))) return mod;
+	if (!(mod = calloc(1, sizeof(module_t)))) return NULL;
+	for (path = strtok_r(modpath, ":", &saveptr); path; path = strtok_r(NULL, ":", &saveptr)) {
+		DEBUG("searching modpath: '%s'", path);
+		size = snprintf(NULL, 0, "%s/%.*s.so", path, (int)len, name);
+		if (!(module = malloc(size + 1))) break;
+		snprintf(module, size + 1, "%s/%.*s.so", path, (int)len, name);
+		DEBUG("trying '%s'", module);
+		mod->ptr = dlopen(module, RTLD_LAZY);
+		free(module);
+		if (mod->ptr) break;
+		DEBUG("dlopen: %s", dlerror());
+	}
+	if (!mod->ptr) {
+		ERROR("Failed to load module: %.*s", (int)len, name);
+		free(mod);
+		return NULL;
+	}
+	mod->name = strndup(name, len);
+	if (!(mod->ops = dlsym(mod->ptr, LSD_MODULE_SYMBOL))) {
+		DEBUG("module '%s' has no ops table, using legacy symbols", mod->name);
+		mod->ops = module_legacy(mod);
+	}
+	else if (mod->ops->version != LSD_MODULE_ABI_VERSION) {
+		ERROR("module '%s' ABI version %u, expected %u", mod->name,
+				mod->ops->version, LSD_MODULE_ABI_VERSION);
+		goto err_load;
+	}
+	DEBUG("module '%s' loaded successfully (flags 0x%x)", mod->name, mod->ops->flags);
+	if (mod->ops->init && (err = mod->ops->init(dbdir))) {
+		ERROR("module '%s' init: %s", mod->name, err_msg(err));
+		goto err_load;
+	}
+	if (module_insert(mod)) goto err_load;
+
+	return mod;
+err_load:
+	mod->ops = NULL; /* no finit() */
+	module_free(mod);
+	return NULL;
+}
+
+int module_conf(void)
+{
+	int err = 0;
+
+	for (size_t i = 0; i < loaded; i++) {
+		lsd_module_ops_t *ops = order[i]->ops;
+		if (!ops->conf) continue;
+		/* one shared object may be loaded under several names */
+		for (size_t j = 0; j < i; j++) {
+			if (order[j]->ops->conf == ops->conf) goto next;
+		}
+		if ((err = ops->conf())) {
+			ERROR("module '%s' conf: %s", order[i]->name, err_msg(err));
+			break;
+		}
+next:		;
+	}
+	return err;
+}
+
+int module_warmup(void)
+{
+	int err;
+
+	for (size_t i = 0; i < loaded; i++) {
+		lsd_module_ops_t *ops = order[i]->ops;
+		if (!(ops->flags & LSD_MODULE_WARMUP) || !ops->warmup) continue;
+		DEBUG("warming up module '%s'", order[i]->name);
+		if ((err = ops->warmup())) return err;
+	}
+	return 0;
+}
+
+void module_reap(pid_t pid)
+{
+	for (size_t i = 0; i < loaded; i++) {
+		lsd_module_ops_t *ops = order[i]->ops;
+		if (!ops->reap) continue;
+		/* one shared object may be loaded under several names */
+		for (size_t j = 0; j < i; j++) {
+			if (order[j]->ops->reap == ops->reap) goto next;
+		}
+		ops->reap(pid);
+next:		;
+	}
+}
+
+void module_unload(void)
+{
+	TRACE("%s()", __func__);
+	while (loaded--) {
+		DEBUG("freeing module [%zu] %s", loaded, order[loaded]->name);
+		module_free(order[loaded]);
+	}
+	loaded = 0;
+	free(order);
+	free(bucket);
+	order = bucket = NULL;
+	ordersz = buckets = 0;
+}
+
+size_t module_count(void)
+{
+	return loaded;
+}
@@ -0,0 +1,86 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ *
+ * module.h
+ *
+ * this file is part of LIBRESTACK
+ *
+ * Copyright (c) 2012-2020 Brett Sheffield <bacs@librecast.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program (see the file COPYING in the distribution).
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __LSD_MODULE_H
+#define __LSD_MODULE_H 1
+
+#include "config.h"
+#include <stdint.h>
+#include <sys/types.h>
+
+/* modules export their entry points as a single versioned ops table named
+ * LSD_MODULE_SYMBOL. Modules without one still load, with their loose
+ * init/conf/conn/load_uri/finit symbols collected into a table for them */
+#define LSD_MODULE_ABI_VERSION 2
+#define LSD_MODULE_SYMBOL "lsd_module"
+
+/* module capability flags */
+#define LSD_MODULE_NONBLOCK	0x1	/* conn() copes with a nonblocking socket */
+#define LSD_MODULE_THREADSAFE	0x2	/* conn() may run in several threads at once */
+#define LSD_MODULE_WARMUP	0x4	/* call warmup() in controller before forking */
+
+typedef struct lsd_module_ops_s lsd_module_ops_t;
+struct lsd_module_ops_s {
+	uint32_t	version;			/* LSD_MODULE_ABI_VERSION */
+	uint32_t	flags;				/* LSD_MODULE_* */
+	const char *	name;
+	int		(*init)(char *dbdir);		/* after loading */
+	int		(*conf)(void);			/* config loaded or reloaded */
+	int		(*warmup)(void);		/* prefork, if LSD_MODULE_WARMUP */
+	int		(*conn)(conn_t *c);		/* handle connection */
+	int		(*load_uri)(char *uri, MDB_txn *txn);	/* process uri config line */
+	void		(*finit)(void);			/* before unloading */
+	void		(*reap)(pid_t pid);		/* handler exited, in controller */
+};
+
+struct module_s {
+	char *		name;		/* name module was loaded as */
+	void *		ptr;		/* dlopen handle */
+	lsd_module_ops_t *ops;		/* exported ops, or legacy below */
+	lsd_module_ops_t legacy;	/* ops built from loose symbols */
+	module_t *	next;		/* next in hash bucket */
+};
+
+/* find loaded module by name */
+module_t *module_find(const char *name, size_t len);
+
+/* find module by name, loading it if need be */
+module_t *module_load(const char *name, size_t len);
+
+/* tell modules the config has been (re)loaded, once all config lines,
+ * including their uri lines, have been processed */
+int module_conf(void);
+
+/* call every loaded module's warmup(), if it asked for one */
+int module_warmup(void);
+
+/* tell modules handler pid has exited, so they can drop what it held */
+void module_reap(pid_t pid);
+
+/* finalize and unload all modules */
+void module_unload(void);
+
+/* number of modules loaded */
+size_t module_count(void);
+
+#endif /* __LSD_MODULE_H */
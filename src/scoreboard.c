@@ -0,0 +1,167 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ *
+ * scoreboard.c
+ *
+ * this file is part of LIBRESTACK
+ *
+ * Copyright (c) 2012-2020 Brett Sheffield <bacs@librecast.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program (see the file COPYING in the distribution).
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "log.h"
+#include "scoreboard.h"
+#include <errno.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+scoreboard_t *sb;
+int sb_slot = -1;
+
+static size_t scoreboard_size(int max)
+{
+	return sizeof(scoreboard_t) + max * sizeof(slot_t);
+}
+
+scoreboard_t *scoreboard_init(int min, int max)
+{
+	sb = mmap(NULL, scoreboard_size(max), PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (sb == MAP_FAILED) {
+		ERROR("%s(): mmap: %s", __func__, strerror(errno));
+		return sb = NULL;
+	}
+	if ((sb->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1) {
+		ERROR("%s(): eventfd: %s", __func__, strerror(errno));
+		scoreboard_free();
+		return NULL;
+	}
+	sb->min = min;
+	sb->max = max;
+	for (int i = 0; i < max; i++) {
+		atomic_init(&sb->slot[i].state, SLOT_FREE);
+		atomic_init(&sb->slot[i].conn, -1);
+	}
+	return sb;
+}
+
+void scoreboard_free(void)
+{
+	if (!sb) return;
+	if (sb->efd > 0) close(sb->efd);
+	munmap(sb, scoreboard_size(sb->max));
+	sb = NULL;
+}
+
+int scoreboard_claim(void)
+{
+	for (int i = 0; i < sb->max; i++) {
+		if (atomic_load(&sb->slot[i].state) != SLOT_FREE) continue;
+		atomic_store(&sb->slot[i].pid, 0);
+		atomic_store(&sb->slot[i].conn, -1);
+		atomic_store(&sb->slot[i].conns, 0);
+		atomic_store(&sb->slot[i].since, time(NULL));
+		atomic_store(&sb->slot[i].threads, 1);
+		atomic_store(&sb->slot[i].busy, 0);
+		atomic_store(&sb->slot[i].queued, 0);
+		atomic_store(&sb->slot[i].state, SLOT_STARTING);
+		return i;
+	}
+	return -1;
+}
+
+int scoreboard_release(pid_t pid)
+{
+	for (int i = 0; i < sb->max; i++) {
+		if (atomic_load(&sb->slot[i].pid) != pid) continue;
+		if (atomic_exchange(&sb->slot[i].state, SLOT_FREE) == SLOT_READY)
+			atomic_fetch_sub(&sb->ready, 1); /* died while ready */
+		atomic_store(&sb->slot[i].pid, 0);
+		atomic_store(&sb->slot[i].conn, -1);
+		atomic_store(&sb->slot[i].queued, 0); /* its queue went with it */
+		return i;
+	}
+	return -1;
+}
+
+void scoreboard_state(slot_state_t state, int conn)
+{
+	slot_t *s = &sb->slot[sb_slot];
+	slot_state_t old = atomic_exchange(&s->state, state);
+
+	atomic_store(&s->conn, conn);
+	atomic_store(&s->since, time(NULL));
+	if (old == state) return;
+	if (state == SLOT_READY) {
+		atomic_fetch_add(&sb->ready, 1);
+	}
+	else if (old == SLOT_READY) {
+		/* only syscall when the pool is running short */
+		if (atomic_fetch_sub(&sb->ready, 1) - 1 < sb->min)
+			eventfd_write(sb->efd, 1);
+	}
+}
+
+void scoreboard_threads(int threads)
+{
+	atomic_store(&sb->slot[sb_slot].threads, threads);
+}
+
+void scoreboard_busy(int conn)
+{
+	slot_t *s = &sb->slot[sb_slot];
+
+	atomic_fetch_add(&s->conns, 1);
+	if (atomic_fetch_add(&s->busy, 1) + 1 < atomic_load(&s->threads)) {
+		atomic_store(&s->conn, conn);
+		atomic_store(&s->since, time(NULL));
+	}
+	else scoreboard_state(SLOT_BUSY, conn);
+}
+
+void scoreboard_idle(void)
+{
+	slot_t *s = &sb->slot[sb_slot];
+
+	if (atomic_fetch_sub(&s->busy, 1) < atomic_load(&s->threads))
+		atomic_store(&s->since, time(NULL));
+	else scoreboard_state(SLOT_READY, -1);
+}
+
+void scoreboard_queued(int queued)
+{
+	atomic_store(&sb->slot[sb_slot].queued, queued);
+}
+
+int scoreboard_backlog(void)
+{
+	int n = 0;
+	for (int i = 0; i < sb->max; i++) {
+		if (atomic_load(&sb->slot[i].state) == SLOT_FREE) continue;
+		n += atomic_load(&sb->slot[i].queued);
+	}
+	return n;
+}
+
+int scoreboard_count(slot_state_t state)
+{
+	int n = 0;
+	for (int i = 0; i < sb->max; i++) {
+		if (atomic_load(&sb->slot[i].state) == (int)state) n++;
+	}
+	return n;
+}
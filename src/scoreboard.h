@@ -0,0 +1,103 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ *
+ * scoreboard.h
+ *
+ * this file is part of LIBRESTACK
+ *
+ * Copyright (c) 2012-2020 Brett Sheffield <bacs@librecast.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program (see the file COPYING in the distribution).
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __LSD_SCOREBOARD_H
+#define __LSD_SCOREBOARD_H 1
+
+#include <stdatomic.h>
+#include <sys/types.h>
+#include <time.h>
+
+/* handler pool state, shared between controller and handlers. Handlers
+ * update their own slot with plain atomics, and only make a syscall to wake
+ * the controller when the ready count falls below the minimum */
+
+typedef enum {
+	SLOT_FREE,		/* no handler */
+	SLOT_STARTING,		/* forked, not yet accepting */
+	SLOT_READY,		/* has a thread waiting for connections */
+	SLOT_BUSY,		/* every thread serving a connection */
+	SLOT_STOPPING,		/* finishing up, will exit */
+} slot_state_t;
+
+typedef struct slot_s slot_t;
+struct slot_s {
+	_Atomic int		state;		/* slot_state_t */
+	_Atomic pid_t		pid;		/* handler pid */
+	_Atomic int		conn;		/* socket index last served, or -1 */
+	_Atomic unsigned long	conns;		/* connections served */
+	_Atomic time_t		since;		/* time of last state change */
+	_Atomic int		threads;	/* worker threads in handler */
+	_Atomic int		busy;		/* threads serving a connection */
+	_Atomic int		queued;		/* waiting in own accept queues (reuseport) */
+} __attribute__((aligned(64)));	/* one cache line each */
+
+typedef struct scoreboard_s scoreboard_t;
+struct scoreboard_s {
+	_Atomic int	ready;		/* handlers in SLOT_READY (a hint only) */
+	int		min;		/* wake controller below this many ready */
+	int		max;		/* number of slots */
+	int		efd;		/* eventfd to wake controller */
+	slot_t		slot[];
+};
+
+extern scoreboard_t *sb;
+extern int sb_slot;	/* slot of this handler, -1 in controller */
+
+/* create scoreboard in shared memory, before forking handlers */
+scoreboard_t *scoreboard_init(int min, int max);
+
+/* unmap scoreboard */
+void scoreboard_free(void);
+
+/* claim a free slot for a new handler, returning index or -1 if full */
+int scoreboard_claim(void);
+
+/* release slot of handler pid after it has exited, returning index or -1 */
+int scoreboard_release(pid_t pid);
+
+/* set state of this handler's slot, waking controller if short of ready handlers */
+void scoreboard_state(slot_state_t state, int conn);
+
+/* set number of worker threads sharing this handler's slot */
+void scoreboard_threads(int threads);
+
+/* a worker thread took a connection on socket index conn. The slot goes
+ * BUSY once every thread is busy */
+void scoreboard_busy(int conn);
+
+/* a worker thread finished its connection. The slot is READY again as
+ * soon as any thread is free */
+void scoreboard_idle(void);
+
+/* record connections waiting in this handler's own accept queues. Only
+ * reuseport handlers have queues of their own */
+void scoreboard_queued(int queued);
+
+/* connections waiting in the accept queues of all handlers */
+int scoreboard_backlog(void);
+
+/* count slots in state */
+int scoreboard_count(slot_state_t state);
+
+#endif /* __LSD_SCOREBOARD_H */
@@ -0,0 +1,199 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ *
+ * server.c
+ *
+ * this file is part of LIBRESTACK
+ *
+ * Copyright (c) 2012-2020 Brett Sheffield <bacs@librecast.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program (see the file COPYING in the distribution).
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+
+#include "config.h"
+#include "err.h"
+#include "log.h"
+#include "lsd.h"
+#include "module.h"
+#include "server.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <unistd.h>
+
+dispatch_t *dispatch;
+
+int server_cpu_affinity(int n, int cpu)
+{
+	cpu_set_t set;
+	long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+
+	if (ncpu < 1) ncpu = 1;
+	cpu %= ncpu;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	if (sched_setaffinity(0, sizeof set, &set) == -1) {
+		ERROR("sched_setaffinity(): %s", strerror(errno));
+		return -1;
+	}
+	/* the kernel hands a connection to the group member whose incoming
+	 * cpu matches the one it arrived on, whatever order handlers joined
+	 * the group in, and hashes across the group if none does */
+	for (int i = 0; i < n; i++) {
+#ifdef SO_INCOMING_CPU
+		if (setsockopt(socks[i], SOL_SOCKET, SO_INCOMING_CPU, &cpu, sizeof cpu) == -1)
+			ERROR("SO_INCOMING_CPU: %s", strerror(errno));
+#endif
+	}
+	DEBUG("handler pinned to cpu %i", cpu);
+	return 0;
+}
+
+int server_listen(int flags)
+{
+	struct addrinfo hints = {0};
+	struct addrinfo *a = NULL;
+	struct addrinfo *ai = NULL;
+	char cport[6];
+	int n = 0;
+	int sock = -1;
+	int yes = 1;
+	int backlog = BACKLOG;
+	char db[2];
+	unsigned int lvl = (flags & SERVER_HANDLER) ? LOG_DEBUG : LOG_INFO;
+	proto_t *p;
+	MDB_val val;
+
+	TRACE("%s()", __func__);
+
+	/* allocate an array for sockets */
+	while (config_yield_s(DB_PROTO, "proto", &val) == CONFIG_NEXT) { n++; }
+	config_yield_free();
+	DEBUG("n = %i", n);
+
+	if (!n) return 0;
+	socks = calloc(n, sizeof(int));
+	dispatch = calloc(n, sizeof(dispatch_t));
+	if (!socks || !dispatch) DIE("out of memory");
+	config_db(DB_GLOBAL, db);
+	config_get_int(db, "backlog", &backlog, NULL, 0);
+	n = 0;
+
+	/* listen on all ports and protocols listed in config */
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_flags = AI_PASSIVE;
+	while (config_yield_s(DB_PROTO, "proto", &val) == CONFIG_NEXT) {
+		p = val.mv_data;
+		hints.ai_socktype = p->socktype;
+		hints.ai_protocol = p->protocol; /* optional */
+		sprintf(cport, "%u", p->port);
+		sock = -1;
+		for (int e = getaddrinfo(p->addr, cport, &hints, &a); a; a = a->ai_next) {
+			if (e) FAILMSG(LSD_ERROR_GETADDRINFO, strerror(e));
+			if (!ai) ai = a;
+			if ((sock = socket(a->ai_family, a->ai_socktype, a->ai_protocol)) == -1)
+				continue;
+			if ((setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(int))) == -1)
+				goto next_addr;
+			if ((flags & SERVER_REUSEPORT)
+			&& (setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &yes, sizeof(int))) == -1)
+				goto next_addr;
+			if ((bind(sock, a->ai_addr, a->ai_addrlen)) == -1)
+				goto next_addr;
+			break;
+next_addr:
+			close(sock);
+			sock = -1;
+		}
+		freeaddrinfo(ai); ai = NULL;
+		if (sock != -1) {
+			if (p->socktype == SOCK_STREAM) {
+				(socks)[n] = sock;
+				/* handlers loop on accept(), so they must never block in it */
+				if (fcntl(sock, F_SETFL, O_NONBLOCK) == -1)
+					DIE("fcntl() error: %s", strerror(errno));
+				LOG(lvl, "Listening on [%s]:%s", p->addr, cport);
+				if ((listen((sock), backlog)) == -1)
+					DIE("listen() error: %s", strerror(errno));
+			}
+			/* keep our own copy, the txn is about to go away */
+			if (!(dispatch[n].proto = malloc(val.mv_size))) DIE("out of memory");
+			memcpy(dispatch[n].proto, p, val.mv_size);
+			n++;
+		}
+	}
+	config_yield_free();
+	server_dispatch(n);
+
+	return n;
+}
+
+int server_dispatch(int n)
+{
+	dispatch_t *d;
+	int ok = 0;
+
+	for (int i = 0; i < n; i++) {
+		d = &dispatch[i];
+		d->conn = NULL;
+		if (!(d->mod = module_find(d->proto->module, strlen(d->proto->module)))) {
+			ERROR("no module '%s' for socket %i", d->proto->module, i);
+			continue;
+		}
+		if (!(d->conn = d->mod->ops->conn)) {
+			ERROR("module '%s' has no conn()", d->proto->module);
+			continue;
+		}
+		d->flags = d->mod->ops->flags;
+		ok++;
+	}
+	return ok;
+}
+
+int server_backlog(int n)
+{
+	struct tcp_info ti;
+	socklen_t len;
+	int queued = 0;
+
+	for (int i = 0; i < n; i++) {
+		len = sizeof ti;
+		/* for a listening socket, tcpi_unacked is the accept queue length */
+		if (!getsockopt(socks[i], IPPROTO_TCP, TCP_INFO, &ti, &len))
+			queued += ti.tcpi_unacked;
+	}
+	return queued;
+}
+
+void server_close(int n)
+{
+	while (n--) {
+		close(socks[n]);
+		free(dispatch[n].proto);
+	}
+	free(socks);
+	free(dispatch);
+	socks = NULL;
+	dispatch = NULL;
+}
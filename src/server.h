@@ -0,0 +1,63 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ *
+ * server.h
+ *
+ * this file is part of LIBRESTACK
+ *
+ * Copyright (c) 2012-2020 Brett Sheffield <bacs@librecast.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program (see the file COPYING in the distribution).
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __LSD_SERVER_H
+#define __LSD_SERVER_H 1
+
+#include "config.h"
+#include <stdint.h>
+
+/* server_listen() flags */
+#define SERVER_REUSEPORT	0x1	/* SO_REUSEPORT, so each handler can bind its own */
+#define SERVER_HANDLER		0x2	/* called from handler process */
+
+/* what to call for a connection on each listening socket, indexed like
+ * socks, so dispatch needs no config or symbol lookups */
+typedef struct dispatch_s dispatch_t;
+struct dispatch_s {
+	proto_t		*proto;			/* copy of proto config */
+	module_t	*mod;			/* module handling proto */
+	int		(*conn)(conn_t *);	/* module's connection handler */
+	uint32_t	flags;			/* module's LSD_MODULE_* flags */
+};
+
+extern dispatch_t *dispatch;
+
+/* listen on all configured protocols, allocating socks and dispatch.
+ * returns number of sockets */
+int server_listen(int flags);
+
+/* (re)resolve module and conn() for the first n sockets.
+ * returns number of sockets with a handler */
+int server_dispatch(int n);
+
+/* connections waiting in the accept queues of the first n sockets */
+int server_backlog(int n);
+
+/* close listening sockets and free socks and dispatch */
+void server_close(int n);
+
+/* pin calling process to cpu and prefer connections received there */
+int server_cpu_affinity(int n, int cpu);
+
+#endif /* __LSD_SERVER_H */
@@ -0,0 +1,52 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/* Copyright (c) 2020 Brett Sheffield <bacs@librecast.net> */
+
+#include "test.h"
+#include "../src/config.h"
+
+static int count_protos(config_iter_t *it)
+{
+	MDB_val val;
+	int n = 0;
+	while (config_iter_next(it, NULL, &val) == CONFIG_NEXT) n++;
+	return n;
+}
+
+int main()
+{
+	char *argv[] = { "0000-0007", "--config", "./0000-0007.conf", NULL };
+	int argc = sizeof argv / sizeof argv[0] - 1;
+	config_iter_t a = {0}, b = {0};
+	MDB_val val;
+	char db[2];
+
+	test_name("config_iter_open() / config_iter_next() / config_iter_close()");
+	config_init(argc, argv);
+	config_db(DB_PROTO, db);
+
+	test_assert(config_iter_open(&a, db) == 0, "open iterator");
+	test_assert(count_protos(&a) == 2, "iterate protos");
+	test_assert(config_iter_next(&a, NULL, &val) == CONFIG_FINAL, "stays final");
+	config_iter_close(&a);
+
+	/* two iterations live at once */
+	test_assert(config_iter_open(&a, db) == 0, "open first iterator");
+	test_assert(config_iter_open(&b, db) == 0, "open second iterator");
+	test_assert(config_iter_next(&b, NULL, &val) == CONFIG_NEXT, "first proto from b");
+	test_assert(count_protos(&a) == 2, "a unaffected by b");
+	test_assert(count_protos(&b) == 1, "b unaffected by a");
+
+	config_iter_close(&a);
+	config_iter_close(&b);
+	config_iter_close(&b); /* closing twice is harmless */
+
+	/* config_yield_s() wraps a per thread iterator */
+	int n = 0;
+	while (config_yield_s(DB_PROTO, "proto", &val) == CONFIG_NEXT) n++;
+	config_yield_free();
+	test_assert(n == 2, "config_yield_s() iterates protos");
+
+	config_close();
+
+	return fails;
+}
@@ -0,0 +1,38 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/* Copyright (c) 2020 Brett Sheffield <bacs@librecast.net> */
+
+#include "test.h"
+#include "../src/config.h"
+#include "../src/module.h"
+
+int main()
+{
+	char *argv[] = { "0000-0008", "--config", "./0000-0007.conf", NULL };
+	int argc = sizeof argv / sizeof argv[0] - 1;
+	module_t *http, *https;
+
+	test_name("module_load() / module_find() / lsd_module_ops");
+	config_init(argc, argv);
+	config_load_modules();
+
+	test_assert(module_count() == 2, "two modules loaded");
+	http = module_find("http", 4);
+	https = module_find("https", 5);
+	test_assert(http != NULL, "find http");
+	test_assert(https != NULL, "find https");
+	test_assert(http != https, "http is not a prefix match for https");
+	test_assert(module_find("htt", 3) == NULL, "no prefix match");
+	test_assert(module_find("httpsx", 6) == NULL, "no match on longer name");
+	test_assert(module_load("http", 4) == http, "already loaded");
+	test_assert(http->ops->version == LSD_MODULE_ABI_VERSION, "ops version");
+	test_assert(http->ops->flags & LSD_MODULE_THREADSAFE, "http is thread safe");
+	test_assert(http->ops->conn != NULL, "ops has conn()");
+	test_assert(module_load("nosuchmodule", 12) == NULL, "missing module");
+
+	config_unload_modules();
+	test_assert(module_count() == 0, "modules unloaded");
+	test_assert(module_find("http", 4) == NULL, "registry empty");
+	config_close();
+
+	return fails;
+}
@@ -0,0 +1,86 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/* Copyright (c) 2020 Brett Sheffield <bacs@librecast.net> */
+
+#include "test.h"
+#include "../modules/route.h"
+#include <string.h>
+
+/* method, domain, host, path */
+static char *lines[][4] = {
+	{ "GET",	"",		"",			"/index.html" },
+	{ "GET",	"",		"",			"/static/*" },
+	{ "GET",	"example.com",	"example.com:8080",	"/static/special/*" },
+	{ "GET",	"",		"",			"/static/special/x" },
+	{ "POST",	"",		"",			"/api/*" },
+	{ "GET",	"",		"",			"/*.css" },
+	{ "GET",	"example.com",	"example.com",		"/" },
+	{ "PROPFIND",	"",		"",			"/dav/*" },
+	{ "GET",	"",		"",			"/a[bc]d" },
+	{ "GET",	"",		"",			"/st" },
+	{ "GET",	"",		"",			"/st" },
+	{ "GET",	"other.org",	"other.org",		"/*" },
+	{ "GET",	"",		"",			"/*" },
+	{ "GET",	"",		"",			"/static/\\*" },
+};
+static char *methods[] = { "GET", "POST", "HEAD", "PROPFIND", "PUT", "" };
+static char *hosts[] = { "", "example.com", "example.com:8080", "other.org", "nowhere" };
+static char *paths[] = { "/", "/index.html", "/index.htm", "/static/", "/static/a.css",
+	"/static/special/x", "/static/special/y", "/api/v1", "/api", "/dav/a",
+	"/abd", "/acd", "/aed", "/st", "/sta", "/style.css", "/static/*", "" };
+
+#define ROUTES (sizeof lines / sizeof lines[0])
+#define COUNT(a) (sizeof a / sizeof a[0])
+
+/* first match by linear scan, as http_request_handle() did */
+static int route_linear(struct iovec uri[][HTTP_PARTS], struct iovec *method,
+		struct iovec *host, struct iovec *path)
+{
+	for (size_t i = 0; i < ROUTES; i++) {
+		if (iovcmp(method, &uri[i][HTTP_METHOD])) continue;
+		if (uri[i][HTTP_DOMAIN].iov_len
+		&& iovcmp(host, &uri[i][HTTP_DOMAIN]) && iovcmp(host, &uri[i][HTTP_HOST]))
+			continue;
+		if (!iovmatch(&uri[i][HTTP_PATH], path, 0)) return i;
+	}
+	return -1;
+}
+
+int main()
+{
+	struct iovec uri[ROUTES][HTTP_PARTS] = {0};
+	char action[ROUTES][8];
+	struct iovec method, host, path, *match;
+	route_table_t *t;
+	int want, got;
+
+	test_name("route_add() / route_match()");
+
+	test_assert((t = route_table_new()) != NULL, "route_table_new()");
+	for (size_t i = 0; i < ROUTES; i++) {
+		snprintf(action[i], sizeof action[i], "%zu", i);
+		iovsetstr(&uri[i][HTTP_METHOD], lines[i][0]);
+		iovsetstr(&uri[i][HTTP_ACTION], action[i]);
+		iovsetstr(&uri[i][HTTP_DOMAIN], lines[i][1]);
+		iovsetstr(&uri[i][HTTP_HOST], lines[i][2]);
+		iovsetstr(&uri[i][HTTP_PATH], lines[i][3]);
+		test_assert(route_add(t, uri[i]) == 0, "route_add() %zu", i);
+	}
+	test_assert(route_count(t) == ROUTES, "route_count()");
+
+	for (size_t m = 0; m < COUNT(methods); m++)
+	for (size_t h = 0; h < COUNT(hosts); h++)
+	for (size_t p = 0; p < COUNT(paths); p++) {
+		iovsetstr(&method, methods[m]);
+		iovsetstr(&host, hosts[h]);
+		iovsetstr(&path, paths[p]);
+		want = route_linear(uri, &method, &host, &path);
+		match = route_match(t, &method, &host, &path);
+		got = (match) ? atoi(match[HTTP_ACTION].iov_base) : -1;
+		test_assert(want == got, "%s %s%s => %i (expected %i)",
+				methods[m], hosts[h], paths[p], got, want);
+	}
+
+	route_table_free(t);
+
+	return fails;
+}
@@ -0,0 +1,83 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/* Copyright (c) 2020 Brett Sheffield <bacs@librecast.net> */
+
+#define _GNU_SOURCE
+#include "test.h"
+#include "../src/iov.h"
+#include <fnmatch.h>
+#include <string.h>
+
+static char *patterns[] = {
+	"", "*", "**", "?", "a", "abc", "a*", "*c", "a*c", "a?c", "*.css", "/static/*",
+	"/static/*.css", "/*/*", "/a/**/b", "[abc]", "[!abc]", "[^abc]", "[a-c]x",
+	"[]]", "[]a]", "[!]]", "[a-]", "[[:digit:]]*", "[[:alpha:][:digit:]]",
+	"[[:bogus:]]", "[", "a[", "[a", "\\*", "\\?x", "\\[a]", "[\\]]",
+	"*a*b*c*", "*/", ".*", "*.*", "/.*", "/*", "A*", "[A-Z]*", "*\\.css",
+};
+static char *strings[] = {
+	"", "a", "b", "c", "x", "abc", "aXc", "abbc", "ac", "a/c", "style.css",
+	"/static/", "/static/a.css", "/static/a/b.css", "/a/b", "/a/x/b", "]", "-",
+	"1abc", "Z", "*", "?x", "a\\", "[a]", "[", "a[", ".hidden", "/.hidden",
+	"a.b", "xaxbxc", "/", "ABC", "Abc", "\\",
+};
+static int flags[] = {
+	0, FNM_NOESCAPE, FNM_PATHNAME, FNM_PERIOD, FNM_PATHNAME | FNM_PERIOD,
+	FNM_CASEFOLD, FNM_NOESCAPE | FNM_PATHNAME | FNM_CASEFOLD,
+};
+
+#define COUNT(a) (sizeof a / sizeof a[0])
+
+int main()
+{
+	struct iovec pattern, string;
+	iovglob_t g;
+	size_t len;
+	int want, got;
+
+	test_name("iovglob() / iovglob_match()");
+
+	for (size_t p = 0; p < COUNT(patterns); p++)
+	for (size_t s = 0; s < COUNT(strings); s++)
+	for (size_t f = 0; f < COUNT(flags); f++) {
+		iovsetstr(&pattern, patterns[p]);
+		iovsetstr(&string, strings[s]);
+		want = !fnmatch(patterns[p], strings[s], flags[f]);
+		got = !iovglob(&pattern, &string, flags[f], NULL);
+		test_assert(want == got, "iovglob('%s', '%s', 0x%x) == %i",
+				patterns[p], strings[s], flags[f], got);
+		iovglob_compile(&g, &pattern, flags[f]);
+		got = !iovglob_match(&g, &string, NULL);
+		test_assert(want == got, "iovglob_match('%s', '%s', 0x%x) == %i",
+				patterns[p], strings[s], flags[f], got);
+	}
+
+	/* no terminating nul needed */
+	iovset(&pattern, "a*cXXX", 3);
+	iovset(&string, "abcXXX", 3);
+	test_assert(!iovglob(&pattern, &string, 0, NULL), "unterminated iovecs");
+
+	/* a trailing escape is malformed. glibc's handling depends on flags,
+	 * so it's not in the table above */
+	iovsetstr(&pattern, "a\\");
+	iovsetstr(&string, "a\\");
+	test_assert(iovglob(&pattern, &string, 0, NULL), "trailing escape");
+	test_assert(!iovglob(&pattern, &string, FNM_NOESCAPE, NULL), "trailing backslash");
+
+	/* matched prefix, for mapping the rest of a path onto a directory */
+	iovsetstr(&pattern, "/static/*");
+	iovsetstr(&string, "/static/a/b.css");
+	test_assert(!iovglob(&pattern, &string, 0, &len), "match");
+	test_assert(len == 8, "prefix before wildcard (%zu)", len);
+	iovsetstr(&pattern, "/static/a.css");
+	iovsetstr(&string, "/static/a.css");
+	iovglob_compile(&g, &pattern, 0);
+	test_assert(g.literal, "literal pattern");
+	test_assert(!iovglob_match(&g, &string, &len), "literal match");
+	test_assert(len == string.iov_len, "literal prefix is whole string");
+	iovsetstr(&pattern, "/st\\*/[ab]/*");
+	iovsetstr(&string, "/st*/a/x");
+	test_assert(!iovglob(&pattern, &string, 0, &len), "escaped match");
+	test_assert(len == 5, "escape is literal (%zu)", len);
+
+	return fails;
+}
@@ -0,0 +1,65 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/* Copyright (c) 2020 Brett Sheffield <bacs@librecast.net> */
+
+#include "test.h"
+#include "../modules/http.h"
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
+
+#define HEADER_NAME(id, name, field) { id, name },
+static struct { http_header_t id; char *name; } known[] = {
+	HTTP_HEADERS(HEADER_NAME)
+};
+static char *unknown[] = { "", "H", "Hos", "Hosts", "Accept-", "X-Host",
+	"Content-Type", "Cookie", "Origin", "Sec-WebSocket-Keys", "Upgrade-",
+	"User_Agent", "Referrers", "Connectio", "Ho\0t" };
+
+#define COUNT(a) (sizeof a / sizeof a[0])
+
+static char *mixcase(char *dst, const char *src, int odd)
+{
+	for (int i = 0; (dst[i] = src[i]); i++) {
+		if (i % 2 == odd) dst[i] = toupper(dst[i]);
+		else dst[i] = tolower(dst[i]);
+	}
+	return dst;
+}
+
+int main()
+{
+	struct iovec name;
+	char tmp[64];
+
+	test_name("http_header_id()");
+
+	test_assert(!http_header_init(), "header hash has no collisions");
+	test_assert(COUNT(known) == HTTP_HEADER_UNKNOWN, "header count");
+
+	for (size_t i = 0; i < COUNT(known); i++) {
+		iovset(&name, known[i].name, strlen(known[i].name));
+		test_assert(http_header_id(&name) == known[i].id, "%s", known[i].name);
+		for (int odd = 0; odd < 2; odd++) {
+			iovsetstr(&name, mixcase(tmp, known[i].name, odd));
+			test_assert(http_header_id(&name) == known[i].id, "%s", tmp);
+		}
+		/* not terminated where the name ends */
+		snprintf(tmp, sizeof tmp, "%s: value", known[i].name);
+		iovset(&name, tmp, strlen(known[i].name));
+		test_assert(http_header_id(&name) == known[i].id, "%s (iovec)", known[i].name);
+	}
+	for (size_t i = 0; i < COUNT(unknown); i++) {
+		iovsetstr(&name, unknown[i]);
+		test_assert(http_header_id(&name) == HTTP_HEADER_UNKNOWN, "'%s' unknown", unknown[i]);
+	}
+	iovset(&name, "Ho\0t", 4);
+	test_assert(http_header_id(&name) == HTTP_HEADER_UNKNOWN, "embedded NUL");
+
+	/* iovstrcmp() compares lengths too */
+	iovsetstr(&name, "Host");
+	test_assert(!iovstrcmp(&name, "Host"), "iovstrcmp() equal");
+	test_assert(iovstrcmp(&name, "Hostname"), "iovstrcmp() longer string");
+	test_assert(iovstrcmp(&name, "Hos"), "iovstrcmp() shorter string");
+
+	return fails;
+}
@@ -0,0 +1,112 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/* Copyright (c) 2020 Brett Sheffield <bacs@librecast.net> */
+
+#include "test.h"
+#include "../modules/http.h"
+#include <string.h>
+
+static char pipelined[] =
+	"GET /index.html HTTP/1.1\r\n"
+	"Host: example.com\r\n"
+	"user-agent:  test/1.0 \r\n"
+	"\r\n"
+	"\r\n" /* stray CRLF between requests is allowed */
+	"HEAD /a HTTP/1.1\n"
+	"HOST:other.org\n"
+	"X-Unknown: ignored\n"
+	"\n"
+	"GET /b HTTP/1.0\r\n"
+	"Connection: keep-alive\r\n"
+	"\r\n"
+	"GET /c HTTP/1.0\r\n"
+	"\r\n"
+	"GET /d HTTP/1.1\r\n"
+	"Connection: Close\r\n"
+	"\r\n";
+
+static struct { char *method, *uri, *host, *ua; char close; } want[] = {
+	{ "GET",	"/index.html",	"example.com",	"test/1.0",	0 },
+	{ "HEAD",	"/a",		"other.org",	"",		0 },
+	{ "GET",	"/b",		"",		"",		0 },
+	{ "GET",	"/c",		"",		"",		1 },
+	{ "GET",	"/d",		"",		"",		1 },
+};
+
+static struct { char *req; int code; } bad[] = {
+	{ "GET /\r\n\r\n", HTTP_BAD_REQUEST },
+	{ "GET / HTTP/2.0\r\n\r\n", HTTP_VERSION_NOT_SUPPORTED },
+	{ "GET / FTP/1.1\r\n\r\n", HTTP_BAD_REQUEST },
+	{ "GETTINGLONG / HTTP/1.1\r\n\r\n", HTTP_BAD_REQUEST },
+	{ "GET  HTTP/1.1\r\n\r\n", HTTP_BAD_REQUEST },
+	{ "GET / HTTP/1.1\r\nHost example.com\r\n\r\n", HTTP_BAD_REQUEST },
+	{ "GET / HTTP/1.1\r\nHost : example.com\r\n\r\n", HTTP_BAD_REQUEST },
+	{ "GET / HTTP/1.1\r\nHost: a\r\n folded\r\n\r\n", HTTP_BAD_REQUEST },
+};
+
+#define COUNT(a) (sizeof a / sizeof a[0])
+
+static void check(http_request_t *req, size_t i)
+{
+	test_assert(!iovstrcmp(&req->method, want[i].method), "%zu: method", i);
+	test_assert(!iovstrcmp(&req->uri, want[i].uri), "%zu: uri", i);
+	test_assert(!iovstrcmp(&req->host, want[i].host), "%zu: host", i);
+	test_assert(!iovstrcmp(&req->useragent, want[i].ua), "%zu: user agent", i);
+	test_assert(req->close == want[i].close, "%zu: close", i);
+}
+
+int main()
+{
+	http_parser_t p;
+	http_request_t req;
+	size_t len = strlen(pipelined);
+	size_t off, i;
+	int err = 0;
+
+	test_name("http_request_parse()");
+	http_header_init();
+
+	/* all requests in one read, parsed back to back */
+	for (off = 0, i = 0; off < len && i < COUNT(want); i++) {
+		memset(&p, 0, sizeof p);
+		memset(&req, 0, sizeof req);
+		err = http_request_parse(&p, &req, pipelined + off, len - off);
+		test_assert(err == 0, "%zu: parsed from one buffer", i);
+		if (err) break;
+		check(&req, i);
+		off += req.len;
+	}
+	test_assert(off == len, "consumed all requests");
+	test_assert(i == COUNT(want), "found all requests");
+
+	/* one byte at a time, resuming each time */
+	for (off = 0, i = 0; off < len && i < COUNT(want); i++) {
+		memset(&p, 0, sizeof p);
+		memset(&req, 0, sizeof req);
+		for (size_t n = 1; off + n <= len; n++) {
+			err = http_request_parse(&p, &req, pipelined + off, n);
+			if (err != HTTP_PARSE_MORE) break;
+			test_assert(p.scan == n, "%zu: scanned each byte once", i);
+		}
+		test_assert(err == 0, "%zu: parsed byte by byte", i);
+		if (err) break;
+		check(&req, i);
+		test_assert(req.head.iov_base == req.method.iov_base, "%zu: head", i);
+		off += req.len;
+	}
+	test_assert(off == len, "consumed all requests, byte by byte");
+
+	for (i = 0; i < COUNT(bad); i++) {
+		memset(&p, 0, sizeof p);
+		memset(&req, 0, sizeof req);
+		err = http_request_parse(&p, &req, bad[i].req, strlen(bad[i].req));
+		test_assert(err == bad[i].code, "bad request %zu: %i == %i", i, err, bad[i].code);
+	}
+
+	/* incomplete */
+	memset(&p, 0, sizeof p);
+	memset(&req, 0, sizeof req);
+	err = http_request_parse(&p, &req, "GET / HTTP/1.1\r\nHost: x\r\n", 25);
+	test_assert(err == HTTP_PARSE_MORE, "incomplete request");
+
+	return fails;
+}
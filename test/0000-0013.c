@@ -0,0 +1,114 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/* Copyright (c) 2020 Brett Sheffield <bacs@librecast.net> */
+
+#include "test.h"
+#include "../modules/http.h"
+#include <string.h>
+
+static char chunked[] =
+	"5\r\nHello\r\n"
+	"1;ext=ignored\r\n,\r\n"
+	"7\n world!\n"
+	"0\r\n"
+	"Trailer: ignored\r\n"
+	"\r\n"
+	"GET /next HTTP/1.1\r\n\r\n";
+
+static struct { char *req; int code; http_body_state_t state; size_t left; } hdrs[] = {
+	{ "GET / HTTP/1.1\r\n\r\n", 0, HTTP_BODY_DONE, 0 },
+	{ "PUT / HTTP/1.1\r\nContent-Length: 42\r\n\r\n", 0, HTTP_BODY_LENGTH, 42 },
+	{ "PUT / HTTP/1.1\r\nContent-Length: 0\r\n\r\n", 0, HTTP_BODY_DONE, 0 },
+	{ "PUT / HTTP/1.1\r\ncontent-length: 5\r\nContent-Length: 5\r\n\r\n", 0, HTTP_BODY_LENGTH, 5 },
+	{ "PUT / HTTP/1.1\r\nContent-Length: 5\r\nContent-Length: 6\r\n\r\n", HTTP_BAD_REQUEST, 0, 0 },
+	{ "PUT / HTTP/1.1\r\nContent-Length: -1\r\n\r\n", HTTP_BAD_REQUEST, 0, 0 },
+	{ "PUT / HTTP/1.1\r\nContent-Length: 1 2\r\n\r\n", HTTP_BAD_REQUEST, 0, 0 },
+	{ "PUT / HTTP/1.1\r\nContent-Length: 99999999999999999999999\r\n\r\n", HTTP_BAD_REQUEST, 0, 0 },
+	{ "PUT / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n", 0, HTTP_BODY_CHUNK_SIZE, 0 },
+	{ "PUT / HTTP/1.1\r\nTransfer-Encoding: Chunked\r\n\r\n", 0, HTTP_BODY_CHUNK_SIZE, 0 },
+	{ "PUT / HTTP/1.1\r\nTransfer-Encoding: gzip\r\n\r\n", HTTP_NOT_IMPLEMENTED, 0, 0 },
+	{ "PUT / HTTP/1.1\r\nTransfer-Encoding: chunked\r\nContent-Length: 5\r\n\r\n", HTTP_BAD_REQUEST, 0, 0 },
+	{ "PUT / HTTP/1.1\r\nExpect: 100-continue\r\nContent-Length: 5\r\n\r\n", 0, HTTP_BODY_LENGTH, 5 },
+	{ "PUT / HTTP/1.1\r\nExpect: coffee\r\n\r\n", HTTP_EXPECTATION_FAILED, 0, 0 },
+};
+
+static char *badchunks[] = {
+	"x\r\n", "\r\n", "5\r\nHelloX\r\n", "5 x\r\n", "fffffffffffffffffffff\r\n",
+};
+
+#define COUNT(a) (sizeof a / sizeof a[0])
+
+/* decode body from data, len bytes at a time. Returns body length, or -1 */
+static ssize_t decode(char *data, size_t datalen, size_t step, char *out, size_t *used)
+{
+	http_body_t b = { HTTP_BODY_CHUNK_SIZE, 0 };
+	struct iovec chunk;
+	size_t off = 0, end = 0, outlen = 0;
+	ssize_t n;
+
+	while (b.state != HTTP_BODY_DONE) {
+		n = http_body_parse(&b, data + off, end - off, &chunk);
+		if (n == -1) return -1;
+		if (chunk.iov_len) {
+			memcpy(out + outlen, chunk.iov_base, chunk.iov_len);
+			outlen += chunk.iov_len;
+		}
+		off += n;
+		if (!n) {
+			if (end == datalen) return -1;
+			end = (end + step < datalen) ? end + step : datalen;
+		}
+	}
+	*used = off;
+	return outlen;
+}
+
+int main()
+{
+	http_parser_t p;
+	http_request_t req;
+	http_body_t b;
+	struct iovec chunk;
+	char out[sizeof chunked];
+	size_t used;
+	ssize_t len;
+	int err;
+
+	test_name("http_body_parse()");
+	http_header_init();
+
+	for (size_t i = 0; i < COUNT(hdrs); i++) {
+		memset(&p, 0, sizeof p);
+		memset(&req, 0, sizeof req);
+		err = http_request_parse(&p, &req, hdrs[i].req, strlen(hdrs[i].req));
+		test_assert(err == hdrs[i].code, "headers %zu: %i == %i", i, err, hdrs[i].code);
+		if (err) continue;
+		test_assert(req.body.state == hdrs[i].state, "headers %zu: body state", i);
+		test_assert(req.body.left == hdrs[i].left, "headers %zu: body length", i);
+	}
+
+	/* chunked, split every way up to whole */
+	for (size_t step = 1; step <= sizeof chunked; step++) {
+		memset(out, 0, sizeof out);
+		len = decode(chunked, strlen(chunked), step, out, &used);
+		test_assert(len == 13, "step %zu: body length %zi", step, len);
+		test_assert(!memcmp(out, "Hello, world!", 13), "step %zu: body '%s'", step, out);
+		test_assert(!strcmp(chunked + used, "GET /next HTTP/1.1\r\n\r\n"),
+				"step %zu: stops at end of body", step);
+	}
+
+	for (size_t i = 0; i < COUNT(badchunks); i++) {
+		len = decode(badchunks[i], strlen(badchunks[i]), 64, out, &used);
+		test_assert(len == -1, "bad chunk %zu", i);
+	}
+
+	/* Content-Length, in two reads, then stops */
+	b.state = HTTP_BODY_LENGTH;
+	b.left = 8;
+	test_assert(http_body_parse(&b, "abcde", 5, &chunk) == 5, "length: first read");
+	test_assert(chunk.iov_len == 5 && b.left == 3, "length: first chunk");
+	test_assert(http_body_parse(&b, "fghGET", 6, &chunk) == 3, "length: second read");
+	test_assert(chunk.iov_len == 3 && b.state == HTTP_BODY_DONE, "length: done");
+	test_assert(http_body_parse(&b, "GET", 3, &chunk) == 0, "length: nothing after done");
+
+	return fails;
+}
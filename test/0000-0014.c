@@ -0,0 +1,111 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/* Copyright (c) 2020 Brett Sheffield <bacs@librecast.net> */
+
+#include "test.h"
+#include "../modules/filecache.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static int renders;
+
+static int render(filecache_entry_t *e)
+{
+	renders++;
+	if (!(e->head = malloc(32))) return -1;
+	e->headlen = snprintf(e->head, 32, "Content-Length: %zu\r\n", (size_t)e->sb.st_size);
+	return 0;
+}
+
+static void writefile(char *path, char *data)
+{
+	FILE *f = fopen(path, "w");
+	fputs(data, f);
+	fclose(f);
+}
+
+int main()
+{
+	filecache_t *fc;
+	filecache_entry_t *e, *e2;
+	char dir[] = "/tmp/lsd-filecache-XXXXXX";
+	char path[3][64];
+	char missing[64];
+
+	test_name("filecache_get() / filecache_put()");
+
+	test_assert(mkdtemp(dir) != NULL, "mkdtemp()");
+	for (int i = 0; i < 3; i++) {
+		snprintf(path[i], sizeof path[i], "%s/%i", dir, i);
+		writefile(path[i], "hello");
+	}
+	snprintf(missing, sizeof missing, "%s/missing", dir);
+
+	fc = filecache_new(2, 60, render);
+
+	/* miss, then hit without reopening */
+	e = filecache_get(fc, path[0]);
+	test_assert(e && e->fd != -1, "opened");
+	test_assert(e->sb.st_size == 5, "size");
+	test_assert(!strcmp(e->head, "Content-Length: 5\r\n"), "header rendered");
+	filecache_put(fc, e);
+	e2 = filecache_get(fc, path[0]);
+	test_assert(e2 == e, "hit");
+	test_assert(renders == 1, "rendered once");
+	filecache_put(fc, e2);
+
+	/* negative entry */
+	e = filecache_get(fc, missing);
+	test_assert(e && e->fd == -1 && e->err == ENOENT, "missing file");
+	filecache_put(fc, e);
+	test_assert(filecache_get(fc, missing) == e, "negative entry cached");
+	filecache_put(fc, e);
+	e = filecache_get(fc, dir);
+	test_assert(e && e->fd == -1 && e->err == EISDIR, "directory");
+	filecache_put(fc, e);
+
+	/* least recently used is dropped. An entry in use outlives it */
+	test_assert(filecache_count(fc) == 2, "full");
+	e = filecache_get(fc, path[1]);
+	e2 = filecache_get(fc, path[2]);
+	test_assert(filecache_count(fc) == 2, "still full");
+	test_assert(e->fd != -1 && e2->fd != -1, "both open");
+	filecache_put(fc, e);
+	filecache_put(fc, e2);
+
+	/* changes are noticed once the ttl is up */
+	filecache_free(fc);
+	fc = filecache_new(16, 0, render);
+	e = filecache_get(fc, path[0]);
+	filecache_put(fc, e);
+	test_assert(filecache_get(fc, path[0]) == e, "unchanged after ttl");
+	filecache_put(fc, e);
+	writefile(path[0], "hello, world");
+	e2 = filecache_get(fc, path[0]);
+	test_assert(e2 != e && e2->sb.st_size == 12, "reopened when changed");
+	filecache_put(fc, e2);
+	e = filecache_get(fc, missing);
+	filecache_put(fc, e);
+	writefile(missing, "found");
+	e = filecache_get(fc, missing);
+	test_assert(e->fd != -1 && e->sb.st_size == 5, "negative entry replaced");
+	filecache_put(fc, e);
+	filecache_free(fc);
+
+	/* no cache */
+	fc = filecache_new(0, 60, render);
+	e = filecache_get(fc, path[1]);
+	test_assert(e && e->fd != -1, "uncached open");
+	filecache_put(fc, e);
+	test_assert(filecache_count(fc) == 0, "nothing cached");
+	filecache_free(fc);
+
+	for (int i = 0; i < 3; i++) unlink(path[i]);
+	unlink(missing);
+	rmdir(dir);
+
+	return fails;
+}
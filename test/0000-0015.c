@@ -0,0 +1,159 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/* Copyright (c) 2020 Brett Sheffield <bacs@librecast.net> */
+
+#include "test.h"
+#include "../modules/shmcache.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+static int die_loading;	/* exit part way through shmcache_add() */
+
+/* shmcache_add() fills a slot with pread(), so a handler can be made to die
+ * while the slot is loading */
+ssize_t pread(int fd, void *buf, size_t count, off_t offset)
+{
+	if (die_loading) _exit(0);
+	return syscall(SYS_pread64, fd, buf, count, offset);
+}
+
+static void writefile(char *path, char *data)
+{
+	FILE *f = fopen(path, "w");
+	fputs(data, f);
+	fclose(f);
+}
+
+static int add(shmcache_t *sc, char *path)
+{
+	struct iovec head = { "Content-Length: 5\r\n", 19 };
+	struct stat sb;
+	int fd, ret;
+
+	fd = open(path, O_RDONLY);
+	fstat(fd, &sb);
+	ret = shmcache_add(sc, path, &sb, &head, fd);
+	close(fd);
+	return ret;
+}
+
+static int get(shmcache_t *sc, char *path, struct iovec iov[2])
+{
+	struct stat sb;
+	stat(path, &sb);
+	return shmcache_get(sc, path, &sb, iov);
+}
+
+int main()
+{
+	shmcache_t *sc;
+	struct iovec iov[2];
+	char dir[] = "/tmp/lsd-shmcache-XXXXXX";
+	char path[4][64];
+	char big[SHMCACHE_SLOT + 1];
+	int slot, pinned, status;
+	pid_t pid;
+
+	test_name("shmcache_get() / shmcache_add()");
+
+	test_assert(mkdtemp(dir) != NULL, "mkdtemp()");
+	for (int i = 0; i < 4; i++) {
+		snprintf(path[i], sizeof path[i], "%s/%i", dir, i);
+		writefile(path[i], "hello");
+	}
+
+	/* two slots */
+	sc = shmcache_new(SHMCACHE_SLOT * 2 + 1024);
+	test_assert(sc != NULL, "shmcache_new()");
+	test_assert(shmcache_slots(sc) == 2, "slots");
+
+	test_assert(get(sc, path[0], iov) == -1, "miss");
+	test_assert(add(sc, path[0]) == 0, "added");
+	test_assert(add(sc, path[0]) == -1, "not added twice");
+	slot = get(sc, path[0], iov);
+	test_assert(slot != -1, "hit");
+	test_assert(iov[0].iov_len == 19 && !memcmp(iov[0].iov_base, "Content-Length: 5\r\n", 19),
+			"header block");
+	test_assert(iov[1].iov_len == 5 && !memcmp(iov[1].iov_base, "hello", 5), "contents");
+
+	/* handlers see what the controller and each other cached */
+	if (!(pid = fork())) {
+		if (get(sc, path[0], iov) == -1) _exit(1);
+		if (add(sc, path[1])) _exit(2);
+		_exit(0);
+	}
+	waitpid(pid, &status, 0);
+	test_assert(WIFEXITED(status) && WEXITSTATUS(status) == 0, "child shares cache");
+	pinned = get(sc, path[1], iov);
+	test_assert(pinned != -1, "child's entry seen by parent");
+	shmcache_release(sc, pinned);
+	shmcache_release(sc, slot);
+	shmcache_reap(sc, pid);			/* child exited holding its pin */
+
+	/* full. path[0] is pinned, so path[1] makes way */
+	slot = get(sc, path[0], iov);
+	test_assert(add(sc, path[2]) == 0, "added when full");
+	test_assert(get(sc, path[1], iov) == -1, "unpinned slot reused");
+	test_assert(get(sc, path[0], iov) == slot, "pinned slot kept");
+	shmcache_release(sc, slot);
+
+	/* nothing to evict while every slot is pinned */
+	pinned = get(sc, path[2], iov);
+	test_assert(add(sc, path[3]) == -1, "all pinned");
+	shmcache_release(sc, pinned);
+	shmcache_release(sc, slot);
+
+	/* changed file is a miss, and can be added again */
+	slot = get(sc, path[2], iov);
+	writefile(path[2], "hello, world");
+	test_assert(get(sc, path[2], iov) == -1, "changed file missed");
+	test_assert(!memcmp(iov[1].iov_base, "hello", 5), "stale slot still readable");
+	shmcache_release(sc, slot);
+	test_assert(add(sc, path[2]) == 0, "changed file added");
+	slot = get(sc, path[2], iov);
+	test_assert(slot != -1 && iov[1].iov_len == 12, "new contents");
+	shmcache_release(sc, slot);
+
+	/* too big for a slot */
+	memset(big, 'x', sizeof big - 1);
+	big[sizeof big - 1] = 0;
+	writefile(path[3], big);
+	test_assert(add(sc, path[3]) == -1, "too big");
+	test_assert(!shmcache_fits(10, 100, SHMCACHE_SLOT), "doesn't fit");
+	test_assert(shmcache_fits(10, 100, 1000), "fits");
+
+	shmcache_free(sc);
+
+	/* one slot. A handler dying with it pinned holds it until reaped */
+	sc = shmcache_new(SHMCACHE_SLOT + 1024);
+	test_assert(sc && shmcache_slots(sc) == 1, "one slot");
+	test_assert(add(sc, path[0]) == 0, "added");
+	if (!(pid = fork())) _exit(get(sc, path[0], iov) == -1);
+	waitpid(pid, &status, 0);
+	test_assert(WIFEXITED(status) && WEXITSTATUS(status) == 0, "child pinned slot");
+	test_assert(add(sc, path[1]) == -1, "dead child's pin held");
+	shmcache_reap(sc, pid);
+	test_assert(add(sc, path[1]) == 0, "pin dropped when reaped");
+
+	/* nor is a slot lost when a handler dies loading it */
+	test_assert(add(sc, path[2]) == 0, "added");
+	if (!(pid = fork())) {
+		die_loading = 1;
+		_exit(add(sc, path[1]) + 2); /* shouldn't return */
+	}
+	waitpid(pid, &status, 0);
+	test_assert(WIFEXITED(status) && WEXITSTATUS(status) == 0, "child died loading");
+	test_assert(add(sc, path[1]) == -1, "dead child's slot still loading");
+	shmcache_reap(sc, pid);
+	test_assert(add(sc, path[1]) == 0, "loading slot freed when reaped");
+	shmcache_free(sc);
+
+	for (int i = 0; i < 4; i++) unlink(path[i]);
+	rmdir(dir);
+
+	return fails;
+}
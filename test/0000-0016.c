@@ -0,0 +1,47 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/* Copyright (c) 2020 Brett Sheffield <bacs@librecast.net> */
+
+#include "test.h"
+#include "../modules/http.h"
+#include <string.h>
+
+static struct { char *header; char *coding; int q; } cases[] = {
+	{ "",				"gzip",	0 },
+	{ "gzip",			"gzip",	1000 },
+	{ "GZip",			"gzip",	1000 },
+	{ "x-gzip",			"gzip",	1000 },
+	{ "x-gzip",			"br",	0 },
+	{ "gzip, deflate, br",		"br",	1000 },
+	{ "gzip, deflate",		"br",	0 },
+	{ "gzip;q=0.5, br;q=0.25",	"gzip",	500 },
+	{ "gzip;q=0.5, br;q=0.25",	"br",	250 },
+	{ "gzip ; q=0.125",		"gzip",	125 },
+	{ "gzip;Q=1.000",		"gzip",	1000 },
+	{ "gzip;q=0",			"gzip",	0 },
+	{ "gzip;q=0.0005",		"gzip",	0 },
+	{ "gzip;q=",			"gzip",	0 },
+	{ "gzip;level=1;q=0.5",		"gzip",	500 },
+	{ "*",				"br",	1000 },
+	{ "*;q=0.1, br;q=0",		"br",	0 },
+	{ "br;q=0, *;q=0.1",		"br",	0 },
+	{ "*;q=0.1, gzip",		"br",	100 },
+	{ "brotli, gz",			"br",	0 },
+	{ "gzip",			"gz",	0 },
+	{ ",, br ,",			"br",	1000 },
+	{ "identity",			"gzip",	0 },
+};
+
+int main()
+{
+	struct iovec ae;
+
+	test_name("http_accept_encoding()");
+
+	for (size_t i = 0; i < sizeof cases / sizeof cases[0]; i++) {
+		iovset(&ae, cases[i].header, strlen(cases[i].header));
+		test_assert(http_accept_encoding(&ae, cases[i].coding) == cases[i].q,
+				"'%s' gives %s %i", cases[i].header, cases[i].coding, cases[i].q);
+	}
+
+	return fails;
+}
@@ -0,0 +1,118 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/* Copyright (c) 2020 Brett Sheffield <bacs@librecast.net> */
+
+#include "test.h"
+#include "../modules/compress.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#define BIGSIZE (COMPRESS_BUFSIZ * 5 + 123)
+
+typedef struct { char *data; size_t len; size_t size; size_t calls; } sink_t;
+
+static int sink(void *arg, const void *data, size_t len)
+{
+	sink_t *s = arg;
+	if (s->len + len > s->size || len > COMPRESS_BUFSIZ) return -1;
+	memcpy(s->data + s->len, data, len);
+	s->len += len;
+	s->calls++;
+	return 0;
+}
+
+/* inflate gzip or zlib data, returning length */
+static size_t inflated(char *in, size_t len, char *out, size_t size, int gzip)
+{
+	z_stream zs = {0};
+	size_t n;
+
+	inflateInit2(&zs, (gzip) ? 15 + 16 : 15);
+	zs.next_in = (unsigned char *)in;
+	zs.avail_in = len;
+	zs.next_out = (unsigned char *)out;
+	zs.avail_out = size;
+	n = (inflate(&zs, Z_FINISH) == Z_STREAM_END) ? size - zs.avail_out : 0;
+	inflateEnd(&zs);
+	return n;
+}
+
+int main()
+{
+	http_encoding_t enc[] = { HTTP_ENCODING_GZIP, HTTP_ENCODING_DEFLATE };
+	char *plain, *out, *back;
+	char in[] = "/tmp/lsd-compress-in-XXXXXX";
+	char zf[] = "/tmp/lsd-compress-out-XXXXXX";
+	compress_t *z;
+	sink_t s;
+	int fdin, fdout;
+	ssize_t len;
+
+	test_name("compress_write() / compress_file()");
+
+	plain = malloc(BIGSIZE);
+	out = malloc(BIGSIZE * 2);
+	back = malloc(BIGSIZE);
+	for (size_t i = 0; i < BIGSIZE; i++) plain[i] = "lorem ipsum dolor sit amet\n"[i % 27] + (i % 251 == 0);
+
+	test_assert(compress_supported(HTTP_ENCODING_GZIP), "gzip");
+	test_assert(compress_supported(HTTP_ENCODING_DEFLATE), "deflate");
+	test_assert(!compress_supported(HTTP_ENCODING_NONE), "identity");
+	test_assert(compress_new(HTTP_ENCODING_NONE) == NULL, "no compressor for identity");
+#ifndef USE_BROTLI
+	test_assert(!compress_supported(HTTP_ENCODING_BR), "no br without USE_BROTLI");
+#endif
+
+	for (int i = 0; i < 2; i++) {
+		int gzip = (enc[i] == HTTP_ENCODING_GZIP);
+
+		/* one piece */
+		memset(&s, 0, sizeof s);
+		s.data = out;
+		s.size = BIGSIZE * 2;
+		z = compress_new(enc[i]);
+		test_assert(z != NULL, "compress_new(%i)", enc[i]);
+		test_assert(!compress_write(z, plain, 1000, 1, sink, &s), "compress_write(%i)", enc[i]);
+		compress_free(z);
+		test_assert(s.len > 0 && s.len < 1000, "smaller");
+		test_assert(!gzip || ((unsigned char)out[0] == 0x1f && (unsigned char)out[1] == 0x8b), "gzip magic");
+		test_assert(gzip || out[0] == 0x78, "zlib header");
+		test_assert(inflated(out, s.len, back, BIGSIZE, gzip) == 1000 && !memcmp(back, plain, 1000),
+				"round trip (%i)", enc[i]);
+
+		/* streamed in odd pieces, bigger than the buffer */
+		memset(&s, 0, sizeof s);
+		s.data = out;
+		s.size = BIGSIZE * 2;
+		z = compress_new(enc[i]);
+		for (size_t off = 0, n; off < BIGSIZE; off += n) {
+			n = (BIGSIZE - off < 77777) ? BIGSIZE - off : 77777;
+			if (compress_write(z, plain + off, n, 0, sink, &s)) break;
+		}
+		test_assert(!compress_write(z, NULL, 0, 1, sink, &s), "finished");
+		compress_free(z);
+		test_assert(inflated(out, s.len, back, BIGSIZE, gzip) == BIGSIZE
+				&& !memcmp(back, plain, BIGSIZE), "streamed round trip (%i)", enc[i]);
+	}
+
+	/* file to file */
+	fdin = mkstemp(in);
+	fdout = mkstemp(zf);
+	test_assert(write(fdin, plain, BIGSIZE) == BIGSIZE, "write()");
+	test_assert(!compress_file(HTTP_ENCODING_GZIP, fdin, fdout), "compress_file()");
+	len = pread(fdout, out, BIGSIZE * 2, 0);
+	test_assert(len > 0 && inflated(out, len, back, BIGSIZE, 1) == BIGSIZE
+			&& !memcmp(back, plain, BIGSIZE), "file round trip");
+	test_assert(compress_file(HTTP_ENCODING_GZIP, -1, fdout) == -1, "bad fd");
+	close(fdin);
+	close(fdout);
+	unlink(in);
+	unlink(zf);
+	free(plain);
+	free(out);
+	free(back);
+
+	return fails;
+}
@@ -0,0 +1,64 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/* Copyright (c) 2020 Brett Sheffield <bacs@librecast.net> */
+
+#include "test.h"
+#include "../modules/http.h"
+#include <stdio.h>
+#include <string.h>
+
+static struct {
+	char *header;
+	int n;				/* ranges, 0 unsatisfiable, -1 ignored */
+	off_t off[3];
+	off_t len[3];
+} cases[] = {
+	{ "bytes=0-499",		1, { 0 },		{ 500 } },
+	{ "bytes=500-999",		1, { 500 },		{ 500 } },
+	{ "bytes=500-",			1, { 500 },		{ 500 } },
+	{ "bytes=-200",			1, { 800 },		{ 200 } },
+	{ "bytes=-5000",		1, { 0 },		{ 1000 } },
+	{ "bytes=900-5000",		1, { 900 },		{ 100 } },
+	{ "bytes=999-999",		1, { 999 },		{ 1 } },
+	{ "Bytes=0-0",			1, { 0 },		{ 1 } },
+	{ "bytes=0-0, -1",		2, { 0, 999 },		{ 1, 1 } },
+	{ "bytes=0-9,20-29 , 40-",	3, { 0, 20, 40 },	{ 10, 10, 960 } },
+	{ "bytes=,0-9,,",		1, { 0 },		{ 10 } },
+	{ "bytes=2000-,0-9",		1, { 0 },		{ 10 } },
+	{ "bytes=99999999999999999999999-",	0, { 0 }, { 0 } },
+	{ "bytes=0-99999999999999999999999",	1, { 0 },	{ 1000 } },
+	{ "bytes=1000-",		0, { 0 }, { 0 } },
+	{ "bytes=-0",			0, { 0 }, { 0 } },
+	{ "bytes=5-4",			-1, { 0 }, { 0 } },
+	{ "bytes=",			-1, { 0 }, { 0 } },
+	{ "bytes=-",			-1, { 0 }, { 0 } },
+	{ "bytes=a-b",			-1, { 0 }, { 0 } },
+	{ "bytes=0-1;2-3",		-1, { 0 }, { 0 } },
+	{ "bytes 0-1",			-1, { 0 }, { 0 } },
+	{ "items=0-1",			-1, { 0 }, { 0 } },
+	{ "",				-1, { 0 }, { 0 } },
+	{ "bytes=0-0,1-1,2-2,3-3,4-4,5-5,6-6,7-7,8-8,9-9,10-10,11-11,12-12,13-13,14-14,15-15", 16, { 0, 1, 2 }, { 1, 1, 1 } },
+	{ "bytes=0-0,1-1,2-2,3-3,4-4,5-5,6-6,7-7,8-8,9-9,10-10,11-11,12-12,13-13,14-14,15-15,16-16", -1, { 0 }, { 0 } },
+};
+
+int main()
+{
+	http_range_t r[HTTP_RANGES_MAX];
+	struct iovec hdr;
+	int n;
+
+	test_name("http_range_parse()");
+
+	for (size_t i = 0; i < sizeof cases / sizeof cases[0]; i++) {
+		iovset(&hdr, cases[i].header, strlen(cases[i].header));
+		n = http_range_parse(&hdr, 1000, r);
+		test_assert(n == cases[i].n, "'%s' gives %i ranges (%i)", cases[i].header, cases[i].n, n);
+		for (int j = 0; j < n && j < 3; j++) {
+			test_assert(r[j].off == cases[i].off[j] && r[j].len == cases[i].len[j],
+				"'%s' range %i", cases[i].header, j);
+		}
+	}
+	iovset(&hdr, "bytes=0-", 8);
+	test_assert(http_range_parse(&hdr, 0, r) == 0, "empty file");
+
+	return fails;
+}
@@ -0,0 +1,59 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/* Copyright (c) 2020 Brett Sheffield <bacs@librecast.net> */
+
+#include "test.h"
+#include "../modules/http.h"
+#include <string.h>
+
+static struct { char *list; char *etag; int weak; int strong; } etags[] = {
+	{ "\"abc\"",			"\"abc\"",	1, 1 },
+	{ "\"abc\"",			"\"abcd\"",	0, 0 },
+	{ "\"abcd\"",			"\"abc\"",	0, 0 },
+	{ "\"x\", \"abc\"",		"\"abc\"",	1, 1 },
+	{ "\"x\",\"abc\" ,\"y\"",	"\"abc\"",	1, 1 },
+	{ "W/\"abc\"",			"\"abc\"",	1, 0 },
+	{ "\"abc\"",			"W/\"abc\"",	1, 0 },
+	{ "W/\"abc\"",			"W/\"abc\"",	1, 0 },
+	{ "*",				"\"abc\"",	1, 1 },
+	{ "abc",			"\"abc\"",	0, 0 },
+	{ "\"abc",			"\"abc\"",	0, 0 },
+	{ "\"a,b\"",			"\"a,b\"",	1, 1 },
+	{ "\"a\", garbage, \"abc\"",	"\"abc\"",	0, 0 },
+	{ "",				"\"abc\"",	0, 0 },
+};
+
+static struct { char *date; time_t t; } dates[] = {
+	{ "Sun, 06 Nov 1994 08:49:37 GMT",	784111777 },
+	{ "Sunday, 06-Nov-94 08:49:37 GMT",	784111777 },
+	{ "Sun Nov  6 08:49:37 1994",		784111777 },
+	{ "Thu, 01 Jan 1970 00:00:00 GMT",	0 },
+	{ "Sun, 06 Nov 1994 08:49:37 GMT ",	-1 },
+	{ "Sun, 06 Nov 1994 08:49:37 UTC",	-1 },
+	{ "Sun, 06 Nov 1994",			-1 },
+	{ "yesterday",				-1 },
+	{ "",					-1 },
+};
+
+int main()
+{
+	struct iovec list, etag, date;
+
+	test_name("http_etag_match() / http_date_parse()");
+
+	for (size_t i = 0; i < sizeof etags / sizeof etags[0]; i++) {
+		iovset(&list, etags[i].list, strlen(etags[i].list));
+		iovset(&etag, etags[i].etag, strlen(etags[i].etag));
+		test_assert(http_etag_match(&list, &etag, 0) == etags[i].weak,
+				"'%s' weak match %s", etags[i].list, etags[i].etag);
+		test_assert(http_etag_match(&list, &etag, 1) == etags[i].strong,
+				"'%s' strong match %s", etags[i].list, etags[i].etag);
+	}
+	for (size_t i = 0; i < sizeof dates / sizeof dates[0]; i++) {
+		iovset(&date, dates[i].date, strlen(dates[i].date));
+		test_assert(http_date_parse(&date) == dates[i].t, "'%s'", dates[i].date);
+	}
+	iovset(&date, "Sun, 06 Nov 1994 08:49:37 GMTxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxx", 29);
+	test_assert(http_date_parse(&date) == 784111777, "not terminated");
+
+	return fails;
+}
@@ -0,0 +1,90 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/* Copyright (c) 2020 Brett Sheffield <bacs@librecast.net> */
+
+#include "test.h"
+#include "../modules/tlscache.h"
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+int main()
+{
+	tlscache_t *tc;
+	tlscache_key_t k[3], found;
+	unsigned char id[TLSCACHE_WAYS + 1][TLSCACHE_ID];
+	unsigned char big[TLSCACHE_DATA + 1];
+	char data[TLSCACHE_DATA];
+	int status;
+	pid_t pid;
+
+	test_name("tlscache_get() / tlscache_add() / tlscache_key_current()");
+
+	for (int i = 0; i <= TLSCACHE_WAYS; i++) memset(id[i], 'a' + i, TLSCACHE_ID);
+
+	/* one set, so every id lands in it */
+	tc = tlscache_new(1, 60, 3600);
+	test_assert(tc != NULL, "tlscache_new()");
+	test_assert(tlscache_sessions(tc) == TLSCACHE_WAYS, "sessions");
+
+	test_assert(tlscache_get(tc, id[0], TLSCACHE_ID, 0, data, sizeof data) == 0, "miss");
+	test_assert(tlscache_add(tc, id[0], TLSCACHE_ID, 0, "session", 7) == 0, "added");
+	test_assert(tlscache_get(tc, id[0], TLSCACHE_ID, 0, data, sizeof data) == 7
+			&& !memcmp(data, "session", 7), "hit");
+	test_assert(tlscache_get(tc, id[0], TLSCACHE_ID - 1, 0, data, sizeof data) == 0,
+			"id length matters");
+	test_assert(tlscache_get(tc, id[0], TLSCACHE_ID, 0, data, 6) == 0, "buffer too small");
+	test_assert(tlscache_get(tc, id[0], TLSCACHE_ID, 1, data, sizeof data) == 0,
+			"not resumed for another host");
+	test_assert(tlscache_add(tc, id[0], TLSCACHE_ID, 0, "replaced", 8) == 0, "replaced");
+	test_assert(tlscache_get(tc, id[0], TLSCACHE_ID, 0, data, sizeof data) == 8,
+			"replacement found");
+	test_assert(tlscache_add(tc, id[1], TLSCACHE_ID, 0, big, sizeof big) == -1, "too big");
+	test_assert(tlscache_add(tc, id[1], TLSCACHE_ID + 1, 0, "x", 1) == -1, "id too long");
+
+	/* handlers see what each other cached */
+	if (!(pid = fork())) {
+		if (tlscache_get(tc, id[0], TLSCACHE_ID, 0, data, sizeof data) != 8) _exit(1);
+		if (tlscache_add(tc, id[1], TLSCACHE_ID, 0, "child", 5)) _exit(2);
+		_exit(0);
+	}
+	waitpid(pid, &status, 0);
+	test_assert(WIFEXITED(status) && WEXITSTATUS(status) == 0, "child shares cache");
+	test_assert(tlscache_get(tc, id[1], TLSCACHE_ID, 0, data, sizeof data) == 5,
+			"child's session seen by parent");
+
+	/* full set. The oldest, id[0], makes way */
+	for (int i = 2; i <= TLSCACHE_WAYS; i++) {
+		sleep(i == 2);
+		tlscache_add(tc, id[i], TLSCACHE_ID, 0, "s", 1);
+	}
+	test_assert(tlscache_get(tc, id[0], TLSCACHE_ID, 0, data, sizeof data) == 0, "evicted");
+	test_assert(tlscache_get(tc, id[TLSCACHE_WAYS], TLSCACHE_ID, 0, data, sizeof data) == 1,
+			"newest kept");
+
+	tlscache_remove(tc, id[TLSCACHE_WAYS], TLSCACHE_ID);
+	test_assert(tlscache_get(tc, id[TLSCACHE_WAYS], TLSCACHE_ID, 0, data, sizeof data) == 0,
+			"removed");
+
+	/* ticket keys stay put for their lifetime */
+	test_assert(tlscache_key_current(tc, &k[0]) == 0, "current key");
+	test_assert(tlscache_key_current(tc, &k[1]) == 0 && !memcmp(&k[0], &k[1], sizeof k[0]),
+			"same key");
+	test_assert(tlscache_key_find(tc, k[0].name, &found) == 0
+			&& !memcmp(&found, &k[0], sizeof found), "current key found");
+	tlscache_free(tc);
+
+	/* expired sessions, and keys made anew each time */
+	tc = tlscache_new(100, 0, 0);
+	test_assert(tlscache_sessions(tc) >= 100, "rounded up to whole sets");
+	tlscache_add(tc, id[0], TLSCACHE_ID, 0, "session", 7);
+	test_assert(tlscache_get(tc, id[0], TLSCACHE_ID, 0, data, sizeof data) == 0, "expired");
+	for (int i = 0; i < 3; i++) tlscache_key_current(tc, &k[i]);
+	test_assert(memcmp(k[0].name, k[1].name, TLSCACHE_KEY_NAME)
+			&& memcmp(k[1].name, k[2].name, TLSCACHE_KEY_NAME), "new keys");
+	test_assert(tlscache_key_find(tc, k[1].name, &found) == 1
+			&& !memcmp(&found, &k[1], sizeof found), "key before still found");
+	test_assert(tlscache_key_find(tc, k[0].name, &found) == -1, "older key gone");
+	tlscache_free(tc);
+
+	return fails;
+}
@@ -0,0 +1,80 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/* Copyright (c) 2020 Brett Sheffield <bacs@librecast.net> */
+
+#include "test.h"
+#include "../modules/sni.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int frees;
+
+static void ctx_free(void *ctx)
+{
+	frees++;
+	free(ctx);
+}
+
+static int load(sni_host_t *h, void *arg)
+{
+	(*(int *)arg)++;
+	h->ctx = malloc(1);
+	return 0;
+}
+
+static int add(sni_t *sni, char *line)
+{
+	return sni_add(sni, line, strlen(line));
+}
+
+int main()
+{
+	sni_t *sni;
+	sni_host_t *h;
+	char line[64];
+	int n = 0;
+
+	test_name("sni_add() / sni_find()");
+
+	sni = sni_new();
+	test_assert(sni != NULL, "sni_new()");
+
+	test_assert(add(sni, "example.com") == -1, "no cert or key");
+	test_assert(add(sni, "example.com cert.pem") == -1, "no key");
+	test_assert(add(sni, "example.com\tcert.pem\tkey.pem") == 0, "added");
+	test_assert(add(sni, "*.example.com wild.pem wild.key # comment") == 0, "wildcard added");
+	test_assert(sni_count(sni) == 2, "count");
+
+	h = sni_find(sni, "example.com");
+	test_assert(h && !strcmp(h->cert, "cert.pem") && !strcmp(h->key, "key.pem"), "exact match");
+	test_assert(sni_find(sni, "EXAMPLE.com.") == h, "case and trailing dot ignored");
+
+	h = sni_find(sni, "www.Example.com");
+	test_assert(h && !strcmp(h->cert, "wild.pem"), "wildcard match");
+	test_assert(sni_find(sni, "a.b.example.com") == NULL, "wildcard covers one label");
+	test_assert(sni_find(sni, "example.org") == NULL, "miss");
+	test_assert(sni_find(sni, "com") == NULL, "no label to replace");
+	test_assert(sni_find(sni, "") == NULL, "empty name");
+
+	/* later lines win */
+	test_assert(add(sni, "example.com new.pem new.key") == 0, "replaced");
+	test_assert(sni_count(sni) == 2, "count unchanged");
+	h = sni_find(sni, "example.com");
+	test_assert(h && !strcmp(h->cert, "new.pem"), "replacement found");
+
+	/* enough hosts to grow the table */
+	for (int i = 0; i < 100; i++) {
+		snprintf(line, sizeof line, "host%i.example.net %i.pem %i.key", i, i, i);
+		add(sni, line);
+	}
+	test_assert(sni_count(sni) == 102, "grown");
+	h = sni_find(sni, "host42.example.net");
+	test_assert(h && !strcmp(h->cert, "42.pem"), "found after growing");
+	test_assert(sni_find(sni, "www.example.com") != NULL, "wildcard found after growing");
+
+	test_assert(sni_each(sni, load, &n) == 0 && n == 102, "sni_each()");
+	sni_free(sni, ctx_free);
+	test_assert(frees == 102, "contexts freed");
+
+	return fails;
+}
@@ -0,0 +1,21 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/* Copyright (c) 2020 Brett Sheffield <bacs@librecast.net> */
+
+#include "test.h"
+#include "../src/hash.h"
+
+int main()
+{
+	test_name("hash_fnv1a()");
+
+	/* reference values */
+	test_assert(hash_fnv1a32("", 0) == 0x811c9dc5u, "32 bit, empty");
+	test_assert(hash_fnv1a32("a", 1) == 0xe40c292cu, "32 bit, a");
+	test_assert(hash_fnv1a32("foobar", 6) == 0xbf9cf968u, "32 bit, foobar");
+	test_assert(hash_fnv1a64("", 0) == 0xcbf29ce484222325u, "64 bit, empty");
+	test_assert(hash_fnv1a64("a", 1) == 0xaf63dc4c8601ec8cu, "64 bit, a");
+	test_assert(hash_fnv1a64("foobar", 6) == 0x85944171f73967e8u, "64 bit, foobar");
+	test_assert(hash_fnv1a("foobar", 6) == (size_t)hash_fnv1a64("foobar", 6), "size_t wide");
+
+	return fails;
+}
@@ -0,0 +1,85 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later */
+/* Copyright (c) 2020 Brett Sheffield <bacs@librecast.net> */
+
+#include "test.h"
+#include "../src/config.h"
+#include "../src/scoreboard.h"
+#include "../src/server.h"
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define CLIENTS 8
+
+/* listen on loopback with SO_REUSEPORT, returning socket */
+static int listener(struct sockaddr_in *sa)
+{
+	socklen_t len = sizeof *sa;
+	int yes = 1;
+	int sock = socket(AF_INET, SOCK_STREAM, 0);
+
+	setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &yes, sizeof yes);
+	bind(sock, (struct sockaddr *)sa, len);
+	listen(sock, CLIENTS);
+	getsockname(sock, (struct sockaddr *)sa, &len);
+	return sock;
+}
+
+int main()
+{
+	struct sockaddr_in sa = { .sin_family = AF_INET };
+	int ours[2];
+	int client[CLIENTS];
+	int slot[2];
+	int status;
+	pid_t pid;
+
+	test_name("scoreboard_queued() / scoreboard_backlog()");
+
+	test_assert(scoreboard_init(1, 4) != NULL, "scoreboard_init()");
+	test_assert(scoreboard_backlog() == 0, "no backlog before any handler");
+
+	/* two handlers in one reuseport group, like handler_start() opens */
+	sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	ours[0] = listener(&sa);
+	ours[1] = listener(&sa);
+	test_assert(ours[0] != -1 && ours[1] != -1, "listening");
+
+	/* connections nobody accepts wait in whichever queue the kernel picked */
+	for (int i = 0; i < CLIENTS; i++) {
+		client[i] = socket(AF_INET, SOCK_STREAM, 0);
+		test_assert(!connect(client[i], (struct sockaddr *)&sa, sizeof sa),
+				"connect() %i", i);
+	}
+
+	/* each handler records its own queue, which the controller can't see */
+	for (int i = 0; i < 2; i++) {
+		slot[i] = scoreboard_claim();
+		if (!(pid = fork())) {
+			sb_slot = slot[i];
+			socks = &ours[i];
+			scoreboard_state(SLOT_BUSY, 0);
+			scoreboard_queued(server_backlog(1));
+			_exit(0);
+		}
+		waitpid(pid, &status, 0);
+		atomic_store(&sb->slot[slot[i]].pid, pid);
+	}
+	test_assert(scoreboard_backlog() == CLIENTS,
+			"backlog summed across handlers: %i", scoreboard_backlog());
+
+	/* a handler that exits takes its queue with it */
+	scoreboard_release(atomic_load(&sb->slot[slot[0]].pid));
+	socks = &ours[1];
+	test_assert(scoreboard_backlog() == server_backlog(1),
+			"backlog of remaining handler");
+
+	for (int i = 0; i < CLIENTS; i++) close(client[i]);
+	close(ours[0]);
+	close(ours[1]);
+	scoreboard_free();
+
+	return fails;
+}